@@ -4,6 +4,18 @@ let syncNeeded = false;
 
 let syncTime = 0.11;
 
+// Binary messages are used when the server accepts this websocket subprotocol, JSON otherwise
+const binarySubprotocol = "webgame.binary.v1";
+let useBinaryProtocol = true;
+let binaryProtocol = false;
+let typeNames = [];
+
+const orderCodes = { state_game: 1, state_player: 2, state_entities: 3, remove_entities: 4, types: 5, batch: 6 };
+const actionCodes = { authentication: 1, change_speed: 2, change_dir: 3, move_to: 4 };
+// Strings of the binary protocol are prefixed with their size as a u8
+const maxStringBytes = 255;
+const stateFields = { type: 1, pos: 2, dir: 4, speed: 8 };
+
 function makeid() {
     var text = "";
     var possible = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
@@ -30,9 +42,131 @@ let sprites = {
     object1: "object1.png",
 };
 
-function onOrder(event) {
-    let order = JSON.parse(event.data);
+// Records only hold the fields that changed since the last one of the same
+// entity, the others are left out of the decoded state
+function decodeStateRecord(view, offset) {
+    let state = { id: view.getUint32(offset, true) };
+    let fields = view.getUint8(offset + 4);
+    offset += 5;
+    if (fields & stateFields.type) {
+        state.type = typeNames[view.getUint16(offset, true)];
+        offset += 2;
+    }
+    if (fields & stateFields.pos) {
+        state.pos = { x: view.getFloat32(offset, true), y: view.getFloat32(offset + 4, true) };
+        offset += 8;
+    }
+    if (fields & stateFields.dir) {
+        state.dir = { x: view.getFloat32(offset, true), y: view.getFloat32(offset + 4, true) };
+        offset += 8;
+    }
+    if (fields & stateFields.speed) {
+        state.speed = view.getFloat32(offset, true);
+        offset += 4;
+    }
+    return [state, offset];
+}
+
+// Returns the same order object as the JSON protocol, or null for messages
+// only meant for the decoder itself
+function decodeOrder(data) {
+    if (typeof data === "string")
+        return JSON.parse(data);
+
+    let view = new DataView(data);
+    switch (view.getUint8(0)) {
+        case orderCodes.state_game:
+            return { order: "state", suborder: "game", tick_duration: view.getFloat64(1, true) };
+        case orderCodes.state_player:
+            return Object.assign({ order: "state", suborder: "player" }, decodeStateRecord(view, 1)[0]);
+        case orderCodes.state_entities: {
+            let count = view.getUint32(1, true);
+            let entitiesState = [];
+            let offset = 5;
+            for (let i = 0; i < count; i++) {
+                let state;
+                [state, offset] = decodeStateRecord(view, offset);
+                entitiesState.push(state);
+            }
+            return { order: "state", suborder: "entities", data: entitiesState };
+        }
+        case orderCodes.remove_entities: {
+            let count = view.getUint32(1, true);
+            let ids = [];
+            for (let i = 0; i < count; i++)
+                ids.push(view.getUint32(5 + i * 4, true));
+            return { order: "remove", suborder: "entities", ids: ids };
+        }
+        case orderCodes.types: {
+            let first = view.getUint16(1, true);
+            let count = view.getUint16(3, true);
+            let decoder = new TextDecoder();
+            let offset = 5;
+            for (let i = 0; i < count; i++) {
+                let length = view.getUint8(offset);
+                typeNames[first + i] = decoder.decode(new Uint8Array(data, offset + 1, length));
+                offset += 1 + length;
+            }
+            return null;
+        }
+        default:
+            console.log("ERROR: unknown binary order: " + view.getUint8(0));
+            return null;
+    }
+}
+
+// A message holds one order, or a batch of them, returned in order
+function decodeOrders(data) {
+    if (typeof data === "string") {
+        let parsed = JSON.parse(data);
+        return Array.isArray(parsed) ? parsed : [parsed];
+    }
+
+    let view = new DataView(data);
+    if (view.getUint8(0) !== orderCodes.batch) {
+        let order = decodeOrder(data);
+        return order === null ? [] : [order];
+    }
 
+    let orders = [];
+    let offset = 1;
+    while (offset < data.byteLength) {
+        let size = view.getUint32(offset, true);
+        let order = decodeOrder(data.slice(offset + 4, offset + 4 + size));
+        if (order !== null)
+            orders.push(order);
+        offset += 4 + size;
+    }
+    return orders;
+}
+
+function encodeOrder(order) {
+    if (order.order === "authentication") {
+        let name = new TextEncoder().encode(order.player_name);
+        if (name.length > maxStringBytes)
+            throw new RangeError(`Player name longer than ${maxStringBytes} bytes`);
+        let buffer = new ArrayBuffer(2 + name.length);
+        let view = new DataView(buffer);
+        view.setUint8(0, actionCodes.authentication);
+        view.setUint8(1, name.length);
+        new Uint8Array(buffer, 2).set(name);
+        return buffer;
+    }
+
+    let vec = order.suborder === "change_dir" ? order.dir : order.target_pos;
+    let buffer = new ArrayBuffer(order.suborder === "change_speed" ? 5 : 9);
+    let view = new DataView(buffer);
+    view.setUint8(0, actionCodes[order.suborder]);
+    if (order.suborder === "change_speed")
+        view.setFloat32(1, order.speed, true);
+    else {
+        view.setFloat32(1, vec.x, true);
+        view.setFloat32(5, vec.y, true);
+    }
+    return buffer;
+}
+
+function onOrder(order) {
     //if (debug)
     //    console.log(order);
 
@@ -47,7 +181,7 @@ function onOrder(event) {
                     continue;
                 }
 
-                let pos = [entityState.pos.x, entityState.pos.y];
+                let pos = 'pos' in entityState ? [entityState.pos.x, entityState.pos.y] : null;
 
                 if (!entities.hasOwnProperty(entityState.id)) {
                     let sprite = sprites[entityState.type];
@@ -57,7 +191,7 @@ function onOrder(event) {
                     }
                     entities[entityState.id] = new Entity(pos, sprite);
                 }
-                else
+                else if (pos !== null)
                     entities[entityState.id].pos = pos;
 
                 if ('dir' in entityState)
@@ -87,24 +221,36 @@ function onOrder(event) {
 function initNetwork() {
     if (typeof port === 'undefined' || port === null)
         port = 2000;
-    socket = new WebSocket("ws://" + window.location.host + ":" + port);
+    socket = new WebSocket("ws://" + window.location.host + ":" + port, useBinaryProtocol ? [binarySubprotocol] : []);
+    socket.binaryType = "arraybuffer";
 
     socket.onopen = function (event) {
+        binaryProtocol = socket.protocol === binarySubprotocol;
+        // The server starts every connection from an empty baseline. Our player
+        // and the camera, under negative ids, are kept.
+        for (let id in entities)
+            if (Number(id) >= 0)
+                delete entities[id];
+        typeNames = [];
+        console.log(`Using ${binaryProtocol ? "binary" : "JSON"} protocol`);
         send({ order: "authentication", player_name: "killer69" });
-        socket.onmessage = function (event) {
-            let order = JSON.parse(event.data);
+        // The game state comes first, then the player state, then the usual orders
+        let handleOrder = function (order) {
             console.log(`Got game state, tick duration is ${order.tick_duration}`);
-            socket.onmessage = function (event) {
-                let order = JSON.parse(event.data);
+            handleOrder = function (order) {
                 player.id = order.id;
                 player.pos = [order.pos.x, order.pos.y];
                 player.vel = [order.dir.x, order.dir.y];
                 player.speed = order.speed;
                 console.log(`Got player state, id=${order.id}, pos=${player.pos}, dir=${player.vel}, speed=${order.speed}, max_speed=${order.max_speed}`);
                 camera.pos = player.pos.slice();
-                socket.onmessage = onOrder;
+                handleOrder = onOrder;
             }
         }
+        socket.onmessage = function (event) {
+            for (let order of decodeOrders(event.data))
+                handleOrder(order);
+        }
         opened = true;
     };
 
@@ -127,6 +273,11 @@ function send(order) {
     if (debug)
         console.log(`SENDING ${JSON.stringify(order)}`);
 
+    if (binaryProtocol) {
+        socket.send(encodeOrder(order));
+        return;
+    }
+
     socket.send(JSON.stringify(order, function (key, value) {
         // limit precision of floats
         if (typeof value === 'number') {
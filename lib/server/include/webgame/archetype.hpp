@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+#include "lock.hpp"
+#include "nmoc.hpp"
+#include "vector.hpp"
+
+namespace webgame {
+
+class entity;
+
+// Components of located entities are not stored in the entities themselves
+// but in the chunks of their archetype: one array per component, so that a
+// pass over a component of all the entities of an archetype reads contiguous
+// memory. The entities keep references to their components, which stay valid
+// for their whole life since chunks never move.
+
+//-----------------------------------------------------------------------------
+// CHUNKS
+
+size_t const chunk_capacity = 256;
+
+struct WEBGAME_API located_chunk
+{
+    // Slots in use are below size, with possible holes
+    std::uint32_t   size = 0;
+    // nullptr for a free slot
+    entity         *owner[chunk_capacity] = {};
+    vector          pos[chunk_capacity];
+    vector          published_pos[chunk_capacity];
+};
+
+struct WEBGAME_API mobile_chunk : public located_chunk
+{
+    vector          dir[chunk_capacity];
+    double          speed[chunk_capacity] = {};
+    double          max_speed[chunk_capacity] = {};
+};
+
+// Stable handle of the components of an entity
+struct WEBGAME_API archetype_slot
+{
+    located_chunk  *chunk = nullptr;
+    std::uint32_t   chunk_index = 0;
+    std::uint32_t   index = 0;
+};
+
+//-----------------------------------------------------------------------------
+// ARCHETYPE
+
+class WEBGAME_API archetype_base
+{
+public:
+    virtual ~archetype_base() {}
+
+    virtual archetype_slot  allocate(entity *owner) = 0;
+    virtual void            release(archetype_slot const& slot) = 0;
+};
+
+// Freed slots are reused lowest first, so live entities stay packed at the
+// start of the first chunks
+template<class Chunk>
+class archetype : public archetype_base
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(archetype);
+
+private:
+    std::vector<std::unique_ptr<Chunk>>                 chunks_;
+    // Min heap of (chunk, index) of the free slots
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> free_;
+    size_t                                              size_;
+#ifndef WEBGAME_MONOTHREAD
+    mutable std::mutex                                  mutex_;
+#endif /* !WEBGAME_MONOTHREAD */
+
+public:
+    archetype();
+
+public:
+    virtual archetype_slot  allocate(entity *owner) override;
+    virtual void            release(archetype_slot const& slot) override;
+
+    // Calls f(Chunk &) for each chunk holding live entities. Entities can not
+    // be created nor destroyed from another thread meanwhile.
+    template<class F>
+    void                    for_each_chunk(F &&f);
+    // Number of live entities
+    size_t                  size() const;
+};
+
+// Process wide archetypes, they are never destroyed
+WEBGAME_API extern archetype<located_chunk> &located_archetype();
+WEBGAME_API extern archetype<mobile_chunk>  &mobile_archetype();
+
+} // namespace webgame
+
+#include "archetype.hxx"
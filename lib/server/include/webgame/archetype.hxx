@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <stdexcept>
+
+namespace webgame {
+
+template<class Chunk>
+archetype<Chunk>::archetype()
+    : size_(0)
+{}
+
+template<class Chunk>
+archetype_slot archetype<Chunk>::allocate(entity *owner)
+{
+    WEBGAME_LOCK(mutex_);
+
+    std::pair<std::uint32_t, std::uint32_t> free_slot;
+    if (!free_.empty())
+    {
+        std::pop_heap(free_.begin(), free_.end(), std::greater<std::pair<std::uint32_t, std::uint32_t>>());
+        free_slot = free_.back();
+        free_.pop_back();
+    }
+    else
+    {
+        if (chunks_.size() > 0xffffffff)
+            throw std::runtime_error("archetype: too many chunks");
+
+        // Every slot of the new chunk but the first one becomes free
+        std::uint32_t const new_chunk = static_cast<std::uint32_t>(chunks_.size());
+        chunks_.emplace_back(new Chunk());
+        for (std::uint32_t i = 1; i < chunk_capacity; ++i)
+        {
+            free_.emplace_back(new_chunk, i);
+            std::push_heap(free_.begin(), free_.end(), std::greater<std::pair<std::uint32_t, std::uint32_t>>());
+        }
+        free_slot = { new_chunk, 0 };
+    }
+
+    Chunk &chunk = *chunks_[free_slot.first];
+    chunk.owner[free_slot.second] = owner;
+    chunk.size = std::max(chunk.size, free_slot.second + 1);
+    ++size_;
+
+    archetype_slot slot;
+    slot.chunk = &chunk;
+    slot.chunk_index = free_slot.first;
+    slot.index = free_slot.second;
+    return slot;
+}
+
+template<class Chunk>
+void archetype<Chunk>::release(archetype_slot const& slot)
+{
+    WEBGAME_LOCK(mutex_);
+
+    assert(slot.chunk_index < chunks_.size() && chunks_[slot.chunk_index].get() == slot.chunk);
+
+    Chunk &chunk = *chunks_[slot.chunk_index];
+    chunk.owner[slot.index] = nullptr;
+    while (chunk.size > 0 && chunk.owner[chunk.size - 1] == nullptr)
+        --chunk.size;
+    --size_;
+
+    free_.emplace_back(slot.chunk_index, slot.index);
+    std::push_heap(free_.begin(), free_.end(), std::greater<std::pair<std::uint32_t, std::uint32_t>>());
+}
+
+template<class Chunk>
+template<class F>
+void archetype<Chunk>::for_each_chunk(F &&f)
+{
+    WEBGAME_LOCK(mutex_);
+
+    for (std::unique_ptr<Chunk> const& chunk : chunks_)
+        if (chunk->size > 0)
+            f(*chunk);
+}
+
+template<class Chunk>
+size_t archetype<Chunk>::size() const
+{
+    WEBGAME_LOCK(mutex_);
+
+    return size_;
+}
+
+} // namespace webgame
@@ -31,7 +31,7 @@ public:
     virtual ~behavior();
 
 public:
-    virtual void update(double delta, env &env) = 0;
+    virtual void update(double delta, env const& env) = 0;
 
     virtual nlohmann::json save() const;
     virtual void           load(nlohmann::json const& j);
@@ -60,7 +60,7 @@ public:
     walkaround();
 
 public:
-    virtual void update(double delta, env &env) override;
+    virtual void update(double delta, env const& env) override;
     virtual nlohmann::json save() const override;
     virtual void           load(nlohmann::json const& j) override;
 
@@ -95,7 +95,7 @@ public:
     arealimit(area_type type, double radius, vector const& center);
 
 public:
-    virtual void           update(double delta, env &env) override;
+    virtual void           update(double delta, env const& env) override;
     virtual nlohmann::json save() const override;
     virtual void           load(nlohmann::json const& j) override;
 
@@ -121,7 +121,7 @@ public:
     attack_on_sight(double radius);
 
 public:
-    virtual void           update(double delta, env &env) override;
+    virtual void           update(double delta, env const& env) override;
     virtual nlohmann::json save() const override;
     virtual void           load(nlohmann::json const& j) override;
 
@@ -143,7 +143,7 @@ public:
     stop() = default;
 
 public:
-    virtual void           update(double delta, env &env) override;
+    virtual void           update(double delta, env const& env) override;
     virtual nlohmann::json save() const override;
     virtual void           load(nlohmann::json const& j) override;
 };
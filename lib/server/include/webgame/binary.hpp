@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "config.hpp"
+
+namespace webgame {
+
+// Little endian encoding of the binary wire protocol. Floating point values
+// are sent as 32 bits floats except when written with f64().
+
+//-----------------------------------------------------------------------------
+// BINARY WRITER
+
+class WEBGAME_API binary_writer
+{
+private:
+    std::string &out_;
+
+public:
+    binary_writer(std::string &out);
+
+public:
+    void u8(std::uint8_t v);
+    void u16(std::uint16_t v);
+    void u32(std::uint32_t v);
+    void f32(double v);
+    void f64(double v);
+    // At most 255 bytes
+    void str(std::string const& v);
+};
+
+//-----------------------------------------------------------------------------
+// BINARY READER
+
+// Throws a runtime_error when reading past the end of the data
+class WEBGAME_API binary_reader
+{
+private:
+    char const*         data_;
+    size_t              size_;
+    size_t              pos_;
+
+public:
+    binary_reader(std::string const& data);
+    // The data is not copied and should outlive the reader
+    binary_reader(char const* data, size_t size);
+
+public:
+    std::uint8_t    u8();
+    std::uint16_t   u16();
+    std::uint32_t   u32();
+    double          f32();
+    double          f64();
+    // Prefixed with its size as a u8, so at most 255 bytes: longer player
+    // names can only be sent with the JSON protocol
+    std::string     str();
+
+    bool            at_end() const;
+
+private:
+    std::uint64_t   read(size_t nb_bytes);
+};
+
+} // namespace webgame
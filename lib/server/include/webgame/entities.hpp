@@ -1,26 +1,162 @@
 #pragma once
 
+#include <cstdint>
 #include <initializer_list>
-#include <map>
+#include <iterator>
 #include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <utility>
+#include <vector>
 
 #include "common.hpp"
+#include "config.hpp"
 #include "entity.hpp"
+#include "lock.hpp"
 
 namespace webgame {
 
+//-----------------------------------------------------------------------------
+// ENTITY VIEW
+
+// Entities of a container that are of a given subtype, as listed by the
+// membership list of the subtype. Nothing is copied: the view is invalidated
+// by any change to the container.
+template<class EntityType, class SubType>
+class entity_view
+{
+public:
+    typedef std::pair<id_t, std::shared_ptr<EntityType>> value_type;
+
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag   iterator_category;
+        typedef SubType                     value_type;
+        typedef std::ptrdiff_t              difference_type;
+        typedef SubType*                    pointer;
+        typedef SubType&                    reference;
+
+    private:
+        std::vector<typename entity_view::value_type> const*    values_;
+        std::vector<std::uint32_t>::const_iterator              it_;
+
+    public:
+        const_iterator(std::vector<typename entity_view::value_type> const& values, std::vector<std::uint32_t>::const_iterator it)
+            : values_(&values)
+            , it_(it)
+        {}
+
+    public:
+        // Membership was checked when the entity was added
+        reference       operator*() const { return static_cast<SubType &>(*ptr()); }
+        pointer         operator->() const { return &**this; }
+        std::shared_ptr<EntityType> const& ptr() const { return (*values_)[*it_].second; }
+        const_iterator& operator++() { ++it_; return *this; }
+        const_iterator  operator++(int) { const_iterator prev = *this; ++it_; return prev; }
+        bool            operator==(const_iterator const& other) const { return it_ == other.it_; }
+        bool            operator!=(const_iterator const& other) const { return it_ != other.it_; }
+    };
+
+private:
+    std::vector<value_type> const&      values_;
+    std::vector<std::uint32_t> const&   members_;
+
+public:
+    entity_view(std::vector<value_type> const& values, std::vector<std::uint32_t> const& members)
+        : values_(values)
+        , members_(members)
+    {}
+
+public:
+    const_iterator  begin() const { return const_iterator(values_, members_.cbegin()); }
+    const_iterator  end() const { return const_iterator(values_, members_.cend()); }
+    size_t          size() const { return members_.size(); }
+    bool            empty() const { return members_.empty(); }
+};
+
+//-----------------------------------------------------------------------------
+// ENTITY CONTAINER
+
+// Entities are stored contiguously, in no particular order: an erased entity
+// is replaced by the last one. Lookups by id go through an open addressing
+// table of positions, with linear probing.
+// view<SubType>() iterates over the entities of a subtype. The positions of
+// the entities of each viewed subtype are kept in a membership list, built on
+// the first view of the subtype and kept up to date afterwards.
 template<class EntityType>
-class entity_container : public std::map<id_t, std::shared_ptr<EntityType> const>
+class entity_container
 {
+public:
+    typedef std::pair<id_t, std::shared_ptr<EntityType>>            value_type;
+    // Entities are shared, their ids can not be changed from the container
+    typedef typename std::vector<value_type>::const_iterator        const_iterator;
+    typedef const_iterator                                          iterator;
+
+private:
+    struct membership
+    {
+        std::type_index             type;
+        bool                      (*belongs)(EntityType &ent);
+        // Positions of the members in values_
+        std::vector<std::uint32_t>  members;
+        // Position in members of each entity, npos if it is not a member
+        std::vector<std::uint32_t>  where;
+    };
+
+    static constexpr std::uint32_t  npos = ~std::uint32_t(0);
+
+    std::vector<value_type>                             values_;
+    // Positions in values_ plus one, 0 for an empty bucket. Its size is a power of two.
+    std::vector<std::uint32_t>                          table_;
+    mutable std::vector<std::unique_ptr<membership>>    memberships_;
+#ifndef WEBGAME_MONOTHREAD
+    mutable std::mutex                                  memberships_mutex_;
+#endif /* !WEBGAME_MONOTHREAD */
+
 public:
     entity_container() = default;
     entity_container(std::initializer_list<std::shared_ptr<EntityType>> const& ilist);
+    // Membership lists are not copied, they are rebuilt by the next views
+    entity_container(entity_container const& other);
+    entity_container(entity_container &&other);
+    entity_container &operator=(entity_container const& other);
+    entity_container &operator=(entity_container &&other);
 
 public:
     std::shared_ptr<EntityType> const& add(std::shared_ptr<EntityType> const& ent_ptr);
+    // Returns an iterator to the entity that took the place of the erased one
+    const_iterator                     erase(const_iterator it);
+    size_t                             erase(id_t id);
+    void                               clear();
+    void                               reserve(size_t size);
+
+    const_iterator                     begin() const;
+    const_iterator                     end() const;
+    const_iterator                     cbegin() const;
+    const_iterator                     cend() const;
+    size_t                             size() const;
+    bool                               empty() const;
+
+    const_iterator                     find(id_t id) const;
+    size_t                             count(id_t id) const;
+    // Throws std::out_of_range if there is no such entity
+    std::shared_ptr<EntityType> const& at(id_t id) const;
+
+    // Can be called from several threads at once, as long as the container
+    // is not changed meanwhile
+    template<class SubType>
+    entity_view<EntityType, SubType>   view() const;
+
+private:
+    size_t      bucket_of(id_t id) const;
+    // Bucket holding the id, npos if there is none
+    size_t      find_bucket(id_t id) const;
+    void        rehash(size_t nb_buckets);
+    void        erase_bucket(size_t bucket);
 
     template<class SubType>
-    operator entity_container<SubType>();
+    static bool belongs(EntityType &ent);
 };
 
 class entity;
@@ -1,32 +1,307 @@
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
 namespace webgame {
 
 template<class EntityType>
 entity_container<EntityType>::entity_container(std::initializer_list<std::shared_ptr<EntityType>> const& ilist)
 {
-    for (std::shared_ptr<entity> const& ent_p : ilist)
+    reserve(ilist.size());
+    for (std::shared_ptr<EntityType> const& ent_p : ilist)
         add(ent_p);
 }
 
+template<class EntityType>
+entity_container<EntityType>::entity_container(entity_container const& other)
+    : values_(other.values_)
+    , table_(other.table_)
+{}
+
+template<class EntityType>
+entity_container<EntityType>::entity_container(entity_container &&other)
+    : values_(std::move(other.values_))
+    , table_(std::move(other.table_))
+    , memberships_(std::move(other.memberships_))
+{
+    other.clear();
+}
+
+template<class EntityType>
+entity_container<EntityType> &entity_container<EntityType>::operator=(entity_container const& other)
+{
+    if (this != &other)
+    {
+        values_ = other.values_;
+        table_ = other.table_;
+        memberships_.clear();
+    }
+    return *this;
+}
+
+template<class EntityType>
+entity_container<EntityType> &entity_container<EntityType>::operator=(entity_container &&other)
+{
+    if (this != &other)
+    {
+        values_ = std::move(other.values_);
+        table_ = std::move(other.table_);
+        memberships_ = std::move(other.memberships_);
+        other.clear();
+    }
+    return *this;
+}
+
 template<class EntityType>
 std::shared_ptr<EntityType> const& entity_container<EntityType>::add(std::shared_ptr<EntityType> const& ent_ptr)
 {
-    auto ret = this->insert(std::make_pair(ent_ptr->id(), ent_ptr));
-    assert(ret.second);
-    return ret.first->second;
+    assert(find_bucket(ent_ptr->id()) == npos);
+
+    // At most half full
+    if ((values_.size() + 1) * 2 > table_.size())
+        rehash(std::max<size_t>(16, table_.size() * 2));
+
+    std::uint32_t const pos = static_cast<std::uint32_t>(values_.size());
+    values_.emplace_back(ent_ptr->id(), ent_ptr);
+
+    size_t const mask = table_.size() - 1;
+    size_t bucket = bucket_of(ent_ptr->id());
+    while (table_[bucket] != 0)
+        bucket = (bucket + 1) & mask;
+    table_[bucket] = pos + 1;
+
+    for (std::unique_ptr<membership> const& m : memberships_)
+    {
+        if (m->belongs(*ent_ptr))
+        {
+            m->where.push_back(static_cast<std::uint32_t>(m->members.size()));
+            m->members.push_back(pos);
+        }
+        else
+            m->where.push_back(npos);
+    }
+
+    return values_.back().second;
+}
+
+template<class EntityType>
+typename entity_container<EntityType>::const_iterator entity_container<EntityType>::erase(const_iterator it)
+{
+    std::uint32_t const pos = static_cast<std::uint32_t>(it - values_.cbegin());
+    std::uint32_t const last = static_cast<std::uint32_t>(values_.size() - 1);
+
+    erase_bucket(find_bucket(it->first));
+    // The last entity fills the hole
+    if (pos != last)
+    {
+        table_[find_bucket(values_[last].first)] = pos + 1;
+        values_[pos] = std::move(values_[last]);
+    }
+
+    for (std::unique_ptr<membership> const& m : memberships_)
+    {
+        std::uint32_t const member = m->where[pos];
+        if (member != npos)
+        {
+            std::uint32_t const last_member = m->members.back();
+            m->members[member] = last_member;
+            m->where[last_member] = member;
+            m->members.pop_back();
+        }
+        if (pos != last)
+        {
+            m->where[pos] = m->where[last];
+            if (m->where[pos] != npos)
+                m->members[m->where[pos]] = pos;
+        }
+        m->where.pop_back();
+    }
+
+    values_.pop_back();
+    return values_.cbegin() + pos;
+}
+
+template<class EntityType>
+size_t entity_container<EntityType>::erase(id_t id)
+{
+    const_iterator it = find(id);
+    if (it == cend())
+        return 0;
+    erase(it);
+    return 1;
+}
+
+template<class EntityType>
+void entity_container<EntityType>::clear()
+{
+    values_.clear();
+    std::fill(table_.begin(), table_.end(), 0);
+    for (std::unique_ptr<membership> const& m : memberships_)
+    {
+        m->members.clear();
+        m->where.clear();
+    }
+}
+
+template<class EntityType>
+void entity_container<EntityType>::reserve(size_t size)
+{
+    values_.reserve(size);
+    size_t nb_buckets = std::max<size_t>(16, table_.size());
+    while (size * 2 > nb_buckets)
+        nb_buckets *= 2;
+    if (nb_buckets != table_.size())
+        rehash(nb_buckets);
+}
+
+template<class EntityType>
+typename entity_container<EntityType>::const_iterator entity_container<EntityType>::begin() const
+{
+    return values_.cbegin();
+}
+
+template<class EntityType>
+typename entity_container<EntityType>::const_iterator entity_container<EntityType>::end() const
+{
+    return values_.cend();
+}
+
+template<class EntityType>
+typename entity_container<EntityType>::const_iterator entity_container<EntityType>::cbegin() const
+{
+    return values_.cbegin();
+}
+
+template<class EntityType>
+typename entity_container<EntityType>::const_iterator entity_container<EntityType>::cend() const
+{
+    return values_.cend();
+}
+
+template<class EntityType>
+size_t entity_container<EntityType>::size() const
+{
+    return values_.size();
+}
+
+template<class EntityType>
+bool entity_container<EntityType>::empty() const
+{
+    return values_.empty();
+}
+
+template<class EntityType>
+typename entity_container<EntityType>::const_iterator entity_container<EntityType>::find(id_t id) const
+{
+    size_t const bucket = find_bucket(id);
+    if (bucket == npos)
+        return values_.cend();
+    return values_.cbegin() + (table_[bucket] - 1);
+}
+
+template<class EntityType>
+size_t entity_container<EntityType>::count(id_t id) const
+{
+    return find_bucket(id) == npos ? 0 : 1;
+}
+
+template<class EntityType>
+std::shared_ptr<EntityType> const& entity_container<EntityType>::at(id_t id) const
+{
+    size_t const bucket = find_bucket(id);
+    if (bucket == npos)
+        throw std::out_of_range("entity_container: no entity " + std::to_string(id));
+    return values_[table_[bucket] - 1].second;
 }
 
 template<class EntityType>
 template<class SubType>
-entity_container<EntityType>::operator entity_container<SubType>()
+entity_view<EntityType, SubType> entity_container<EntityType>::view() const
 {
-    entity_container<SubType> sub_container;
-    for (auto const& pair : *this)
+    WEBGAME_LOCK(memberships_mutex_);
+
+    std::type_index const type(typeid(SubType));
+    for (std::unique_ptr<membership> const& m : memberships_)
+        if (m->type == type)
+            return entity_view<EntityType, SubType>(values_, m->members);
+
+    memberships_.emplace_back(new membership{ type, &belongs<SubType>, {}, {} });
+    membership &m = *memberships_.back();
+    m.where.reserve(values_.size());
+    for (std::uint32_t pos = 0; pos < values_.size(); ++pos)
     {
-        std::shared_ptr<SubType> true_ptr = std::dynamic_pointer_cast<SubType>(pair.second);
-        if (true_ptr)
-            sub_container.add(true_ptr);
+        if (belongs<SubType>(*values_[pos].second))
+        {
+            m.where.push_back(static_cast<std::uint32_t>(m.members.size()));
+            m.members.push_back(pos);
+        }
+        else
+            m.where.push_back(npos);
     }
-    return sub_container;
+    return entity_view<EntityType, SubType>(values_, m.members);
+}
+
+// Slot map indexes are dense, they spread over the buckets as they are
+template<class EntityType>
+size_t entity_container<EntityType>::bucket_of(id_t id) const
+{
+    return id & (table_.size() - 1);
+}
+
+template<class EntityType>
+size_t entity_container<EntityType>::find_bucket(id_t id) const
+{
+    if (table_.empty())
+        return npos;
+
+    size_t const mask = table_.size() - 1;
+    for (size_t bucket = bucket_of(id); table_[bucket] != 0; bucket = (bucket + 1) & mask)
+        if (values_[table_[bucket] - 1].first == id)
+            return bucket;
+    return npos;
+}
+
+template<class EntityType>
+void entity_container<EntityType>::rehash(size_t nb_buckets)
+{
+    assert((nb_buckets & (nb_buckets - 1)) == 0);
+
+    table_.assign(nb_buckets, 0);
+    size_t const mask = nb_buckets - 1;
+    for (std::uint32_t pos = 0; pos < values_.size(); ++pos)
+    {
+        size_t bucket = bucket_of(values_[pos].first);
+        while (table_[bucket] != 0)
+            bucket = (bucket + 1) & mask;
+        table_[bucket] = pos + 1;
+    }
+}
+
+// Entries after the bucket are shifted back so that no probe sequence has a hole
+template<class EntityType>
+void entity_container<EntityType>::erase_bucket(size_t bucket)
+{
+    size_t const mask = table_.size() - 1;
+    size_t hole = bucket;
+    for (size_t i = (bucket + 1) & mask; table_[i] != 0; i = (i + 1) & mask)
+    {
+        size_t const home = bucket_of(values_[table_[i] - 1].first);
+        // The entry can move back if its home bucket is not between the hole and it
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            table_[hole] = table_[i];
+            hole = i;
+        }
+    }
+    table_[hole] = 0;
+}
+
+template<class EntityType>
+template<class SubType>
+bool entity_container<EntityType>::belongs(EntityType &ent)
+{
+    return dynamic_cast<SubType *>(&ent) != nullptr;
 }
 
 } // namespace webgame
@@ -2,8 +2,10 @@
 
 #include <nlohmann/json.hpp>
 
+#include "archetype.hpp"
 #include "common.hpp"
 #include "config.hpp"
+#include "entity_type.hpp"
 #include "log.hpp"
 #include "nmoc.hpp"
 #include "vector.hpp"
@@ -11,6 +13,8 @@
 namespace webgame {
 
 class env;
+class spatial_index;
+struct state_record;
 
 //-----------------------------------------------------------------------------
 // ENTITY
@@ -21,21 +25,28 @@ class WEBGAME_API entity
 
 protected:
     id_t        id_;
-    std::string type_;
+    entity_type type_;
+    // Changed since it was last saved or loaded
+    bool        dirty_ = true;
 
 protected:
-    entity() = default;
+    entity();
     entity(std::string const& type);
     virtual ~entity();
 
 public:
-    virtual bool           update(double d, env & env) = 0;
+    virtual bool           update(double d, env const& env) = 0;
     virtual nlohmann::json save() const;
     virtual void           load(nlohmann::json const& j);
     virtual void           build_state_order(nlohmann::json &j) const;
+    virtual void           build_state_record(state_record &r) const;
 
     id_t const&        id() const;
-    std::string const& type() const;
+    entity_type const& type() const;
+
+    void               mark_dirty();
+    void               clear_dirty();
+    bool               is_dirty() const;
 
 #ifdef WEBGAME_TESTS
 public:
@@ -52,19 +63,38 @@ class WEBGAME_API located_entity : public entity
     WEBGAME_NON_MOVABLE_OR_COPYABLE(located_entity);
 
 protected:
-    vector pos_;
+    archetype_base *archetype_;
+    archetype_slot  slot_;
+    // Components, stored in the chunk of the archetype
+    vector         &pos_;
+    // Position as seen by the other entities: it only changes on publish(),
+    // so entities can be updated in parallel while reading each others.
+    vector         &published_pos_;
+    spatial_index  *index_ = nullptr;
 
 protected:
-    located_entity() = default;
+    located_entity();
     located_entity(std::string const& type, vector const& pos);
+    // For derived entities with more components
+    located_entity(archetype_base &archetype);
+    located_entity(archetype_base &archetype, std::string const& type, vector const& pos);
+    virtual ~located_entity();
 
 public:
     virtual nlohmann::json save() const override;
     virtual void           load(nlohmann::json const& j) override;
     virtual void           build_state_order(nlohmann::json &j) const override;
+    virtual void           build_state_record(state_record &r) const override;
 
     void          set_pos(vector const& pos);
     vector const& pos() const;
+    vector const& published_pos() const;
+    void          publish();
+
+    void           set_index(spatial_index *index);
+    spatial_index *index() const;
+
+    archetype_slot const& slot() const;
 
 #ifdef WEBGAME_TESTS
 public:
@@ -81,19 +111,28 @@ class WEBGAME_API mobile_entity : public located_entity
     WEBGAME_NON_MOVABLE_OR_COPYABLE(mobile_entity);
 
 protected:
-    vector dir_;
-    double speed_;
-    double max_speed_;
+    // Components, stored in the chunk of the archetype
+    vector &dir_;
+    double &speed_;
+    double &max_speed_;
 
 protected:
-    mobile_entity() = default;
+    mobile_entity();
     mobile_entity(std::string const& type, vector const& pos, vector const& dir, double speed, double max_speed);
 
 public:
-    virtual bool           update(double d, env & env) override;
+    // before_move(), move() then after_move(). The game loop does not call it
+    // but moves all the mobile entities at once between the two others.
+    virtual bool           update(double d, env const& env) override;
     virtual nlohmann::json save() const override;
     virtual void           load(nlohmann::json const& j) override;
     virtual void           build_state_order(nlohmann::json &j) const override;
+    virtual void           build_state_record(state_record &r) const override;
+
+    // Return true if the state changed, like update()
+    virtual bool before_move(double d, env const& env);
+    bool         move(double d);
+    virtual bool after_move(double d, env const& env);
 
     void set_dir(vector const& vec);
     void set_speed(double speed);
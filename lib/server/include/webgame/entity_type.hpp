@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "config.hpp"
+
+namespace webgame {
+
+// Entity types are interned for the whole process: a type is a small tag,
+// numbered in order of first use, that carries the traits and the faction of
+// the type. Comparing types or testing their traits does not touch their
+// names, which are only needed by JSON and persistence.
+// Tag 0 is the unnamed type of entities that are not loaded yet.
+class WEBGAME_API entity_type
+{
+public:
+    typedef std::uint16_t   tag_type;
+    typedef std::uint32_t   traits_type;
+
+    // Unless the type is declared, its traits come from its name
+    static constexpr traits_type    player_trait = 1 << 0;  // "player"
+    static constexpr traits_type    object_trait = 1 << 1;  // names with "object" in them
+
+private:
+    tag_type    tag_;
+    // Entities of a faction do not attack each other. Each type is its own
+    // faction unless declared otherwise.
+    tag_type    faction_;
+    traits_type traits_;
+
+public:
+    entity_type();
+    explicit entity_type(std::string const& name);
+
+public:
+    // Before any other use of the name. Throws if the type was already
+    // interned with other traits or another faction.
+    static entity_type  declare(std::string const& name, traits_type traits, entity_type const& faction);
+    static entity_type  declare(std::string const& name, traits_type traits);
+    // Number of tags, for the clients that learn their names
+    static size_t       count();
+    static std::string  name_of(tag_type tag);
+
+    std::string         name() const;
+    tag_type            tag() const { return tag_; }
+    tag_type            faction() const { return faction_; }
+    traits_type         traits() const { return traits_; }
+    bool                has(traits_type traits) const { return (traits_ & traits) == traits; }
+
+    bool                operator==(entity_type const& other) const { return tag_ == other.tag_; }
+    bool                operator!=(entity_type const& other) const { return tag_ != other.tag_; }
+};
+
+} // namespace webgame
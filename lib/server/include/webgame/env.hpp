@@ -1,20 +1,73 @@
 #pragma once
 
+#include <iterator>
+#include <vector>
+
 #include "config.hpp"
 #include "entities.hpp"
+#include "spatial_index.hpp"
 
 namespace webgame {
 
+// Read-only view over the entities of a tick, as seen by one entity: the
+// entity itself (if any) is skipped during iteration. Nothing is copied, so
+// the viewed container must outlive the env.
+// Proximity queries work on published positions. They go through the spatial
+// index when one is given and fall back to a linear scan of the view otherwise.
 class WEBGAME_API env
 {
+public:
+    class WEBGAME_API const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag       iterator_category;
+        typedef entities::value_type            value_type;
+        typedef std::ptrdiff_t                  difference_type;
+        typedef value_type const*               pointer;
+        typedef value_type const&               reference;
+
+    private:
+        entities::const_iterator    it_;
+        entities::const_iterator    end_;
+        entity const*               self_;
+
+    public:
+        const_iterator(entities::const_iterator it, entities::const_iterator end, entity const* self);
+
+    public:
+        reference       operator*() const;
+        pointer         operator->() const;
+        const_iterator& operator++();
+        const_iterator  operator++(int);
+        bool            operator==(const_iterator const& other) const;
+        bool            operator!=(const_iterator const& other) const;
+
+    private:
+        void skip_self();
+    };
+
 private:
-    entities entities_;
+    entities const&         entities_;
+    entity const*           self_;
+    spatial_index const*    index_;
 
 public:
-    env(entities const & entities);
+    env(entities const& entities, entity const* self = nullptr, spatial_index const* index = nullptr);
 
 public:
-    entities & others();
+    env const&      others() const;
+    entity const*   self() const;
+
+    const_iterator  begin() const;
+    const_iterator  end() const;
+    bool            empty() const;
+    size_t          size() const;
+
+    std::vector<located_entity const*>  query_radius(vector const& center, double radius) const;
+    located_entity const*               nearest(vector const& center, double radius, spatial_index::filter const& f = spatial_index::filter()) const;
+
+private:
+    bool            sees(located_entity const& ent) const;
 };
 
 } // namespace webgame
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "common.hpp"
+#include "config.hpp"
+#include "lock.hpp"
+#include "nmoc.hpp"
+
+namespace webgame {
+
+// Entity ids are slot map handles: the low bits are the index of a slot, the
+// high bits the generation of the slot, bumped each time it is freed. Freed
+// slots are reused lowest first, so ids stay dense and are handed out in the
+// same order from one run to another, while a stale id never matches the
+// entity that reused its slot.
+// Ids read from the persistence are claimed as they are. An id may be carried
+// by several objects at once, as a living entity and a copy loaded from its
+// save. Persisted ids are pinned: their slot is not reused even when no object
+// carries them anymore, since they may be loaded back.
+// Ids saved before the slot map were drawn at random, two of them may share a
+// slot with different generations. The one that comes second is kept outside
+// the slots, as it is, and the slot they share is pinned for good.
+class WEBGAME_API id_allocator
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(id_allocator);
+
+public:
+    static constexpr unsigned int   index_bits = 22;
+    static constexpr id_t           index_mask = (id_t(1) << index_bits) - 1;
+    static constexpr id_t           max_generation = ~id_t(0) >> index_bits;
+
+private:
+    struct slot
+    {
+        id_t            generation = 0;
+        // Objects carrying the id
+        std::uint32_t   users = 0;
+        bool            pinned = false;
+    };
+
+    std::vector<slot>           slots_;
+    // Min heap of the free indexes. Slots claimed meanwhile are skipped when popped.
+    std::vector<std::uint32_t>  free_;
+    // Pinned ids whose slot holds another generation
+    std::unordered_set<id_t>    outside_;
+    size_t                      size_;
+#ifndef WEBGAME_MONOTHREAD
+    mutable std::mutex          mutex_;
+#endif /* !WEBGAME_MONOTHREAD */
+
+public:
+    id_allocator();
+
+public:
+    static constexpr id_t           make_id(std::uint32_t index, id_t generation) { return (generation << index_bits) | index; }
+    static constexpr std::uint32_t  index_of(id_t id) { return id & index_mask; }
+    static constexpr id_t           generation_of(id_t id) { return id >> index_bits; }
+
+    id_t    allocate();
+    void    claim(id_t id);
+    void    release(id_t id);
+    // Keeps the id from being handed out again, whether it is carried or not
+    void    pin(id_t id);
+
+    bool    in_use(id_t id) const;
+    // Number of ids carried or pinned
+    size_t  size() const;
+
+private:
+    slot    &slot_of(std::uint32_t index);
+    bool    is_free(slot const& s) const;
+    // Returns false if the id is kept outside the slots
+    bool    take(slot &s, id_t id);
+    void    push_free(std::uint32_t index);
+};
+
+// Process wide allocator of the entity ids, it is never destroyed
+WEBGAME_API extern id_allocator &entity_ids();
+
+} // namespace webgame
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include "config.hpp"
+#include "nmoc.hpp"
+
+namespace webgame {
+
+// io_contexts each run by their own thread, pinned to a core where the
+// platform allows it. A connection accepted by a shard stays on it, so its
+// handlers never migrate between cores.
+class WEBGAME_API io_shards
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(io_shards);
+
+private:
+    typedef boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard;
+
+    std::vector<std::unique_ptr<boost::asio::io_context>>   contexts_;
+    std::vector<work_guard>                                 guards_;
+    std::vector<std::thread>                                threads_;
+
+public:
+    explicit io_shards(unsigned int nb_shards);
+    // Stops the shards where they are
+    ~io_shards();
+
+public:
+    size_t                      size() const;
+    boost::asio::io_context &   operator[](size_t i);
+
+    void                        run();
+    // Waits for the shards to run out of work, once their connections are closed
+    void                        join();
+};
+
+} // namespace webgame
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <bitset>
+
+#include "archetype.hpp"
+#include "config.hpp"
+
+namespace webgame {
+
+// Batch integration of the mobile entities of a chunk, equivalent to calling
+// mobile_entity::move() on each of them but over the component arrays. The
+// instruction set is chosen at runtime, all of them give the same results to
+// the bit.
+
+enum class simd_level
+{
+    scalar,
+    sse2,
+    avx2
+};
+
+using slot_mask = std::bitset<chunk_capacity>;
+
+// Best level supported by both the build and the CPU
+WEBGAME_API extern simd_level   detected_simd_level();
+WEBGAME_API extern char const*  simd_level_name(simd_level level);
+
+// Moves the entities of the active slots and returns the slots whose position
+// or direction changed. Other slots are neither read nor written, so their
+// entities may be constructed concurrently.
+WEBGAME_API extern slot_mask    integrate(mobile_chunk &chunk, double d, slot_mask const& active, simd_level level);
+WEBGAME_API extern slot_mask    integrate(mobile_chunk &chunk, double d, slot_mask const& active);
+
+} // namespace webgame
@@ -1,46 +1,141 @@
 #pragma once
 
-#include <iomanip>
+#include <atomic>
+#include <chrono>
 #include <iostream>
-#include <mutex>
-#include <thread>
+#include <string>
 
 #include "config.hpp"
+#include "nmoc.hpp"
+
+// Levels of the lines, the ones under WEBGAME_MIN_LOG_LEVEL are compiled out
+#define WEBGAME_LEVEL_DEBUG     0
+#define WEBGAME_LEVEL_INFO      1
+#define WEBGAME_LEVEL_WARNING   2
+#define WEBGAME_LEVEL_ERROR     3
+
+#ifndef WEBGAME_MIN_LOG_LEVEL
+# define WEBGAME_MIN_LOG_LEVEL WEBGAME_LEVEL_DEBUG
+#endif /* !WEBGAME_MIN_LOG_LEVEL */
 
 namespace webgame {
 
 WEBGAME_API extern bool io_log;
 WEBGAME_API extern bool data_log;
-#ifndef WEBGAME_MONOTHREAD
-WEBGAME_API extern std::recursive_mutex log_mutex;
-#endif /* !WEBGAME_MONOTHREAD */
 WEBGAME_API extern unsigned int title_max_size;
+// Where the lines are written, by the writer thread and by flush_log().
+// Only change it with set_log_stream().
 WEBGAME_API extern std::ostream *log_stream;
 
+// A line of the current thread. It is formatted on this thread, into a
+// buffer the thread reuses, and handed to the writer thread when destroyed:
+// each thread has its own lock free ring, logging never waits for another
+// thread nor for the stream.
+class WEBGAME_API log_line
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(log_line);
+
+private:
+    std::ostream &stream_;
+
+public:
+    log_line();
+    // Starting with the thread and title columns
+    explicit log_line(char const* title);
+    explicit log_line(std::string const& title);
+    ~log_line();
+
+public:
+    std::ostream &  stream();
+
+private:
+    void            write_title(char const* title, size_t size);
+};
+
+// Lets one line through per interval, counting the ones it holds back
+class WEBGAME_API log_limiter
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(log_limiter);
+
+private:
+    std::chrono::steady_clock::duration const       interval_;
+    std::atomic<std::chrono::steady_clock::rep>     next_;
+    std::atomic<size_t>                             suppressed_;
+
+public:
+    template<class Rep, class Per>
+    explicit log_limiter(std::chrono::duration<Rep, Per> const& interval)
+        : interval_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval))
+        , next_(0)
+        , suppressed_(0)
+    {}
+
+public:
+    // From any thread. If the line goes out, suppressed is the number of
+    // lines held back since the previous one.
+    bool    allow(size_t &suppressed);
+};
+
+// Writes what the threads logged so far, waiting for it. Called at exit.
+WEBGAME_API void flush_log();
+// Once the writer is done with the previous stream, which is returned
+WEBGAME_API std::ostream * set_log_stream(std::ostream *stream);
+
 } // namespace webgame
 
 
 #if (!defined(WEBGAME_TESTS) && !defined(WEBGAME_NO_LOG)) || (defined(WEBGAME_TESTS) && !defined(NDEBUG))
-# include "lock.hpp"
-# ifdef WEBGAME_BUILDING_THE_LIB
-#  define _WEBGAME_MY_LOG(to_log)\
+# define _WEBGAME_MY_LOG(to_log)\
+do {\
+::webgame::log_line _my_line;\
+_my_line.stream() << to_log;\
+} while (0)
+# define _WEBGAME_TITLED_LOG(title, to_log)\
 do {\
-WEBGAME_LOCK(log_mutex);\
-*log_stream << to_log << std::endl;\
+::webgame::log_line _my_line(title);\
+_my_line.stream() << to_log;\
 } while (0)
-# else /* WEBGAME_BUILDING_THE_LIB */
-#  define _WEBGAME_MY_LOG(to_log)\
+# define _WEBGAME_LIMITED_LOG(interval, title, to_log)\
 do {\
-WEBGAME_LOCK(webgame::log_mutex);\
-*webgame::log_stream << to_log << std::endl;\
+static ::webgame::log_limiter _my_limiter(interval);\
+size_t _my_suppressed;\
+if (_my_limiter.allow(_my_suppressed))\
+{\
+    ::webgame::log_line _my_line(title);\
+    _my_line.stream() << to_log;\
+    if (_my_suppressed != 0)\
+        _my_line.stream() << " (" << _my_suppressed << " SIMILAR LINE" << (_my_suppressed > 1 ? "S" : "") << " SUPPRESSED)";\
+}\
 } while (0)
-# endif /* WEBGAME_BUILDING_THE_LIB */
 #else /* (!defined(WEBGAME_TESTS) && !defined(WEBGAME_NO_LOG)) || (defined(WEBGAME_TESTS) && !defined(NDEBUG)) */
 # define _WEBGAME_MY_LOG(to_log) do {} while (0)
+# define _WEBGAME_TITLED_LOG(title, to_log) do {} while (0)
+# define _WEBGAME_LIMITED_LOG(interval, title, to_log) do {} while (0)
 #endif /* (!defined(WEBGAME_TESTS) && !defined(WEBGAME_NO_LOG)) || (defined(WEBGAME_TESTS) && !defined(NDEBUG)) */
 
-#ifdef WEBGAME_BUILDING_THE_LIB
-# define WEBGAME_LOG(title, to_log) _WEBGAME_MY_LOG("[" << std::setw(5) << std::this_thread::get_id() << "] [" << std::setw(title_max_size) << title << "] " << to_log)
-#else /* WEBGAME_BUILDING_THE_LIB */
-# define WEBGAME_LOG(title, to_log) _WEBGAME_MY_LOG("[" << std::setw(5) << std::this_thread::get_id() << "] [" << std::setw(webgame::title_max_size) << title << "] " << to_log)
-#endif /* WEBGAME_BUILDING_THE_LIB */
+#if WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_DEBUG
+# define WEBGAME_DEBUG(title, to_log) _WEBGAME_TITLED_LOG(title, to_log)
+#else /* WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_DEBUG */
+# define WEBGAME_DEBUG(title, to_log) do {} while (0)
+#endif /* WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_DEBUG */
+
+#if WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_INFO
+# define WEBGAME_LOG(title, to_log) _WEBGAME_TITLED_LOG(title, to_log)
+// At most one line per interval from the call site
+# define WEBGAME_LOG_EVERY(interval, title, to_log) _WEBGAME_LIMITED_LOG(interval, title, to_log)
+#else /* WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_INFO */
+# define WEBGAME_LOG(title, to_log) do {} while (0)
+# define WEBGAME_LOG_EVERY(interval, title, to_log) do {} while (0)
+#endif /* WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_INFO */
+
+#if WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_WARNING
+# define WEBGAME_WARNING(title, to_log) _WEBGAME_TITLED_LOG(title, to_log)
+#else /* WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_WARNING */
+# define WEBGAME_WARNING(title, to_log) do {} while (0)
+#endif /* WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_WARNING */
+
+#if WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_ERROR
+# define WEBGAME_ERROR(title, to_log) _WEBGAME_TITLED_LOG(title, to_log)
+#else /* WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_ERROR */
+# define WEBGAME_ERROR(title, to_log) do {} while (0)
+#endif /* WEBGAME_MIN_LOG_LEVEL <= WEBGAME_LEVEL_ERROR */
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#include "nmoc.hpp"
+
+namespace webgame {
+
+// Bounded lock free queue with many producers and a single consumer. Each
+// cell of the ring carries a sequence number telling whether it is free for
+// the producer of a given position or filled for the consumer, so producers
+// only contend on the push position and never block the consumer.
+// T should be cheap to copy: values are copied in and out of the cells.
+template<class T>
+class mpsc_queue
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(mpsc_queue);
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T                   value;
+    };
+
+    // On their own cache lines, producers and the consumer do not share them
+    struct alignas(64) position
+    {
+        std::atomic<size_t> value;
+    };
+
+    std::unique_ptr<cell[]> cells_;
+    size_t const            mask_;
+    position                push_pos_;
+    // Only touched by the consumer
+    position                pop_pos_;
+
+public:
+    // The capacity is rounded up to a power of two
+    explicit mpsc_queue(size_t capacity);
+
+public:
+    // From any thread. Returns false if the queue is full.
+    bool    push(T const& value);
+    // From the consumer thread only
+    bool    pop(T &value);
+    // Pops what the queue holds, calling f(T const&) for each value, and
+    // returns the number of values popped. Values pushed meanwhile may be
+    // left for the next drain.
+    template<class F>
+    size_t  drain(F &&f);
+    size_t  capacity() const;
+
+private:
+    static size_t ring_capacity(size_t capacity);
+};
+
+} // namespace webgame
+
+#include "mpsc_queue.hxx"
@@ -0,0 +1,91 @@
+#include <cstdint>
+
+namespace webgame {
+
+template<class T>
+mpsc_queue<T>::mpsc_queue(size_t capacity)
+    : cells_(new cell[ring_capacity(capacity)])
+    , mask_(ring_capacity(capacity) - 1)
+{
+    // A cell is free for the push of its position
+    for (size_t i = 0; i <= mask_; ++i)
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    push_pos_.value.store(0, std::memory_order_relaxed);
+    pop_pos_.value.store(0, std::memory_order_relaxed);
+}
+
+template<class T>
+bool mpsc_queue<T>::push(T const& value)
+{
+    size_t pos = push_pos_.value.load(std::memory_order_relaxed);
+    cell *c;
+    for (;;)
+    {
+        c = &cells_[pos & mask_];
+        size_t const sequence = c->sequence.load(std::memory_order_acquire);
+        std::intptr_t const diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+        if (diff == 0)
+        {
+            if (push_pos_.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        // Not popped since the previous lap
+        else if (diff < 0)
+            return false;
+        // Another producer took the position
+        else
+            pos = push_pos_.value.load(std::memory_order_relaxed);
+    }
+
+    c->value = value;
+    c->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template<class T>
+bool mpsc_queue<T>::pop(T &value)
+{
+    size_t const pos = pop_pos_.value.load(std::memory_order_relaxed);
+    cell &c = cells_[pos & mask_];
+    // Empty, or the producer of the position is not done yet
+    if (c.sequence.load(std::memory_order_acquire) != pos + 1)
+        return false;
+
+    value = c.value;
+    // Free for the push of the next lap
+    c.sequence.store(pos + mask_ + 1, std::memory_order_release);
+    pop_pos_.value.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+template<class T>
+template<class F>
+size_t mpsc_queue<T>::drain(F &&f)
+{
+    // At most one lap, so that busy producers can not hold the consumer
+    T value;
+    size_t nb_popped = 0;
+    while (nb_popped <= mask_ && pop(value))
+    {
+        f(static_cast<T const&>(value));
+        ++nb_popped;
+    }
+    return nb_popped;
+}
+
+template<class T>
+size_t mpsc_queue<T>::capacity() const
+{
+    return mask_ + 1;
+}
+
+template<class T>
+size_t mpsc_queue<T>::ring_capacity(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size *= 2;
+    return size;
+}
+
+} // namespace webgame
@@ -29,13 +29,13 @@ public:
     npc(std::string const& type, vector const& pos, vector const& dir, double speed, double max_speed, behaviors && behaviors = behaviors());
 
 public:
-    virtual bool update(double d, env & env) override;
+    virtual bool           before_move(double d, env const& env) override;
     virtual nlohmann::json save() const override;
     virtual void           load(nlohmann::json const& j) override;
 
 private:
     void init_behaviors();
-    void treatbehaviors(double d, env & env);
+    void treatbehaviors(double d, env const& env);
 
 #ifdef WEBGAME_TESTS
 public:
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "config.hpp"
+#include "vector.hpp"
+
+namespace webgame {
+
+// Order of a client, as sent in JSON:
+//  {"order": "authentication", "player_name": "..."}
+//  {"order": "action", "suborder": "change_speed", "speed": ...}
+//  {"order": "action", "suborder": "change_dir", "dir": {"x": ..., "y": ...}}
+//  {"order": "action", "suborder": "move_to", "target_pos": {"x": ..., "y": ...}}
+struct WEBGAME_API client_order
+{
+    enum kind_t
+    {
+        unknown,
+        authentication,
+        change_speed,
+        change_dir,
+        move_to
+    };
+
+    kind_t      kind = unknown;
+    // Of authentication, points into the parsed message
+    char const* player_name = nullptr;
+    size_t      player_name_size = 0;
+    // Of change_speed
+    double      speed = 0;
+    // Direction of change_dir, target of move_to
+    vector      vec = vector(0, 0);
+};
+
+// Parses the orders above straight from the message, without building a
+// JSON document nor allocating anything. Returns false for any other message,
+// including these orders with unexpected members or escaped strings: the
+// caller falls back to a complete JSON parse, which also reports the errors.
+WEBGAME_API bool parse_client_order(char const* data, size_t size, client_order &order);
+// Same from a JSON document, for the messages the above does not handle.
+// Throws for unknown orders. The name of an authentication is kept in
+// player_name, which the order points to.
+WEBGAME_API void parse_client_order(nlohmann::json const& j, client_order &order, std::string &player_name);
+
+} // namespace webgame
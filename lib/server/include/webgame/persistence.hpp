@@ -20,6 +20,7 @@ public:
 
     virtual bool                    start() = 0;
     virtual void                    stop() = 0;
+    // Entities must be serialized before returning: the server only passes the ones that changed
     virtual void                    async_save(entities const& ents, std::function<save_handler> &&handler) = 0;
     virtual entities                load_all_npes() = 0;
     virtual void                    async_load_player(std::string const& name, std::function<load_player_handler> &&handler) = 0;
@@ -21,7 +21,7 @@ public:
     player();
 
 public:
-    virtual bool           update(double d, env & env) override;
+    virtual bool           after_move(double d, env const& env) override;
     virtual nlohmann::json save() const override;
     virtual void           load(nlohmann::json const& j) override;
 
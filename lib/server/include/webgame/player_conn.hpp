@@ -1,20 +1,26 @@
 #pragma once
 
-#include <list>
+#include <atomic>
+#include <chrono>
 #include <memory>
-#include <mutex>
-#include <queue>
+#include <cstdint>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/strand.hpp>
-#include <boost/beast/core/multi_buffer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
 #include <boost/beast/websocket/stream.hpp>
 
-#include "any.hpp"
+#include "common.hpp"
+#include "mpsc_queue.hpp"
 #include "nmoc.hpp"
 #include "persistence.hpp"
+#include "protocol.hpp"
+#include "vector.hpp"
 
 namespace webgame {
 
@@ -24,17 +30,32 @@ class server;
 class player_conn : public std::enable_shared_from_this<player_conn>
 {
 public:
-    struct patch
+    // Action of the player, applied by the game loop
+    struct command
     {
-        std::string what;
-        any         value;
-
-        patch(std::string &&w, any &&v);
-        patch(patch &&other) = default;
-        patch & operator=(patch &&) = default;
+        enum kind : std::uint8_t
+        {
+            change_speed,
+            change_dir,
+            move_to
+        };
+
+        kind    what;
+        // Of change_speed
+        double  speed;
+        // Direction of change_dir, target of move_to
+        vector  vec;
+    };
 
-        patch(patch const&) = delete;
-        patch & operator=(patch const&) = delete;
+    // Outbound queue of the connection, as last published by its strand
+    struct write_stats
+    {
+        size_t  queued_messages = 0;
+        size_t  queued_bytes = 0;
+        // State snapshots replaced by a newer one before being sent
+        size_t  superseded = 0;
+        // Ticks the connection got nothing, its queue being over the marks
+        size_t  skipped_ticks = 0;
     };
 
     enum state
@@ -59,21 +80,51 @@ public:
 private:
     boost::beast::websocket::stream<boost::asio::ip::tcp::socket>     socket_;
     boost::asio::strand<boost::asio::io_context::executor_type> const strand_;
-    state                                                             state_;
-    boost::beast::multi_buffer                                        read_buffer_;
-    std::list<std::shared_ptr<std::string const>>                     to_write_;
+    // Moved by the strand, the game loop only reads it but for start_playing()
+    std::atomic<state>                                                state_;
+    boost::beast::flat_buffer                                         handshake_buffer_;
+    boost::beast::http::request<boost::beast::http::string_body>      handshake_request_;
+    wire_format                                                       format_;
+    // Flat, so that a message is parsed in place
+    boost::beast::flat_buffer                                         read_buffer_;
+    // Written by the game loop during a tick, posted to the strand by flush()
+    std::vector<std::shared_ptr<std::string const>>                   outbox_;
+    // Position in outbox_ of the snapshot of write_latest(), npos if none
+    size_t                                                            outbox_latest_;
+    // Queued since the last write started, the next one sends them together.
+    // From here on, only touched by the strand.
+    std::vector<std::shared_ptr<std::string const>>                   to_write_;
+    // Being written, as the pieces of one batch
+    std::vector<std::shared_ptr<std::string const>>                   writing_;
+    std::string                                                       batch_frames_;
+    std::vector<boost::asio::const_buffer>                            batch_buffers_;
+    // Position in to_write_ of the snapshot a newer one replaces, npos if none
+    size_t                                                            latest_pos_;
+    // Published by the strand, read by the game loop without waiting for it
+    std::atomic<size_t>                                               queued_messages_;
+    std::atomic<size_t>                                               queued_bytes_;
+    std::atomic<size_t>                                               superseded_;
+    std::atomic<size_t>                                               skipped_ticks_;
+    // Only touched by the game loop
+    size_t                                                            superseded_seen_;
+    bool                                                              congested_;
+    std::chrono::steady_clock::time_point                             congested_since_;
+    bool                                                              aborting_;
     std::shared_ptr<player>                                           player_entity_;
-#ifndef WEBGAME_MONOTHREAD
-    std::recursive_mutex                                              handlers_mutex_;
-#endif /* !WEBGAME_MONOTHREAD */
-    std::queue<patch>                                                 patches_;
-#ifndef WEBGAME_MONOTHREAD
-    mutable std::recursive_mutex                                      patches_mutex_;
-#endif /* !WEBGAME_MONOTHREAD */
+    // Filled by the handlers, drained by the game loop once per tick
+    mpsc_queue<command>                                               commands_;
     boost::beast::websocket::close_code                               close_code_;
     std::string                                                       player_name_;
     std::shared_ptr<server>                                           server_;
     boost::asio::steady_timer                                         close_timer_;
+    double                                                            view_radius_;
+    // Sorted ids of the entities the client knows about, only touched by the game loop
+    std::vector<id_t>                                                 in_view_;
+    // Number of binary type tags the client knows the name of
+    size_t                                                            known_types_;
+    state_baselines                                                   baselines_;
+    // Entities in view that changed during the skipped ticks, only touched by the game loop
+    std::unordered_set<id_t>                                          missed_changes_;
 
 private:
     WEBGAME_NON_MOVABLE_OR_COPYABLE(player_conn);
@@ -82,20 +133,51 @@ public:
     player_conn(boost::asio::ip::tcp::socket &&socket, std::shared_ptr<server> const& server);
 
     void                            start();
+    // The writes, flush() and the congestion are for the game loop only
+    // Keeps the message until the next flush
     void                            write(std::shared_ptr<std::string const> msg);
+    // Same for a state snapshot, superseding the previous one if it is still
+    // queued when the strand gets it
+    void                            write_latest(std::shared_ptr<std::string const> msg);
+    // Posts the messages to the strand, which sends them as one batch, or
+    // after the pending write
+    void                            flush();
     void                            close();
-    patch                           pop_patch();
-    bool                            has_patch() const;
+    // From the simulation, once it checked the player is not already connected
+    void                            on_login(bool accepted);
+    // From the simulation when it adds the player, the connection gets states
+    // from then on. Returns false if it was closed while the player was loading.
+    bool                            start_playing(std::shared_ptr<player> const& player_entity);
+    mpsc_queue<command> &           commands();
+    // Once per tick, before writing to the connection. Returns true if its
+    // queue is over the high-water marks, the tick should be skipped then.
+    // Drops the connection if it stays so for too long.
+    bool                            check_congestion();
+    // Snapshots superseded since the previous call
+    size_t                          take_superseded();
+    // From any thread
+    write_stats                     stats() const;
 
     bool                            is_closed() const;
     std::shared_ptr<player> const&  player_entity() const;
     state                           current_state() const;
     bool                            is_ready() const;
     std::string const&              player_name() const;
+    wire_format                     format() const;
+
+    void                            set_view_radius(double radius);
+    double                          view_radius() const;
+    std::vector<id_t> &             in_view();
+    state_baselines &               baselines();
+    std::unordered_set<id_t> &      missed_changes();
+    void                            sync_types();
 
 private:
+    void enqueue(std::vector<std::shared_ptr<std::string const>> const& batch, size_t latest);
     void write_next();
+    void prepare_batch();
 
+    void on_handshake_request(boost::system::error_code const& ec) noexcept;
     void on_accept(boost::system::error_code const& ec) noexcept;
     void on_read(boost::system::error_code const& error, std::size_t const& bytes_transferred) noexcept;
     void on_write(boost::system::error_code const& ec, std::size_t const& bytes_transferred) noexcept;
@@ -104,11 +186,14 @@ private:
 
     void do_read();
     void do_close(boost::beast::websocket::close_code const& code);
+    void do_abort();
 
-    void interpret(std::string &&order_str);
+    void interpret(char const* data, size_t size);
+    void interpret_json(char const* data, size_t size);
+    void interpret_binary(char const* data, size_t size);
+    void authenticate(std::string const& player_name);
 
-    void push_patch(std::string && what, any && value);
-    void push_patch(patch && p);
+    void push_command(command const& cmd);
 };
 
 } // namespace webgame
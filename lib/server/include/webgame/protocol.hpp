@@ -1,16 +1,163 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "common.hpp"
 #include "config.hpp"
 #include "entities.hpp"
+#include "nmoc.hpp"
+#include "vector.hpp"
 
 namespace webgame {
 
+class binary_writer;
 class player;
 
+// Messages are JSON text unless the client asks for the binary subprotocol
+// during the websocket handshake. Messages queued together are sent as one
+// batch: a JSON array of the orders, or a binary order_batch.
+enum class wire_format
+{
+    json,
+    binary
+};
+
+WEBGAME_API extern char const binary_subprotocol[];
+
+// permessage-deflate of the player websockets, for the clients that offer it
+struct WEBGAME_API compression_options
+{
+    bool    enabled = true;
+    // 9 to 15, fewer bits keep a smaller window per connection but compress less
+    int     window_bits = 15;
+    // 1 to 9, the same tradeoff for the internal state of deflate
+    int     mem_level = 4;
+    // 0 to 9
+    int     level = 6;
+    // Smaller messages are sent as is, with the Boost versions that support it
+    size_t  min_size = 64;
+    // Without it, every message is compressed on its own: a worse ratio, but
+    // nothing is kept per connection between two messages
+    bool    context_takeover = true;
+};
+
+//-----------------------------------------------------------------------------
+// JSON
+
+WEBGAME_API extern std::string json_state_game(double tick_duration);
 WEBGAME_API extern std::string json_state_entities(entities const& entities);
 WEBGAME_API extern std::string json_state_player(std::shared_ptr<player const> e);
+WEBGAME_API extern std::string json_remove_entities(std::vector<id_t> const& ids);
+
+//-----------------------------------------------------------------------------
+// BINARY
+
+// Each binary message starts with one of these
+enum binary_order : std::uint8_t
+{
+    order_state_game = 1,       // f64 tick duration
+    order_state_player,         // state record
+    order_state_entities,       // u32 count, state records
+    order_remove_entities,      // u32 count, u32 ids
+    order_types,                // u16 first tag, u16 count, strings
+    order_batch,                // for each message: u32 size, message
+};
+
+// Each binary message from the client starts with one of these
+enum binary_action : std::uint8_t
+{
+    action_authentication = 1,  // string player name
+    action_change_speed,        // f32 speed
+    action_change_dir,          // f32 x, f32 y
+    action_move_to,             // f32 x, f32 y
+};
+
+// Fields of a state record, as flagged in its mask
+enum state_field : std::uint8_t
+{
+    field_type  = 1 << 0,       // u16 type tag
+    field_pos   = 1 << 1,       // f32 x, f32 y
+    field_dir   = 1 << 2,       // f32 x, f32 y
+    field_speed = 1 << 3,       // f32 speed
+    all_fields  = field_type | field_pos | field_dir | field_speed
+};
+
+// State of an entity as the binary protocol sends it. On the wire, a record
+// is its u32 id, a u8 mask of the fields that follow, then these fields.
+// Unlocated or immobile entities leave the missing fields to zero.
+struct WEBGAME_API state_record
+{
+    id_t            id = 0;
+    std::uint16_t   type = 0;
+    vec2f           pos = vec2f(0, 0);
+    vec2f           dir = vec2f(0, 0);
+    float           speed = 0;
+};
+
+WEBGAME_API extern std::string binary_state_game(double tick_duration);
+WEBGAME_API extern std::string binary_state_player(std::shared_ptr<player const> e);
+WEBGAME_API extern std::string binary_remove_entities(std::vector<id_t> const& ids);
+// Entity types are sent as their entity_type tags. Clients are sent the
+// names of the tags they do not know yet through an order_types message.
+WEBGAME_API extern std::string binary_types(size_t first, size_t last);
+
+//-----------------------------------------------------------------------------
+// STATE BASELINES
+
+// Last record sent to a client for each entity it knows about. Records are
+// sent as deltas against it, with only the fields the client does not have
+// yet. The websocket being reliable and ordered, a record is acknowledged
+// as soon as it is queued: the baseline only dies with the connection, and a
+// new connection starts from an empty one, so full records.
+class WEBGAME_API state_baselines
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(state_baselines);
+
+private:
+    std::unordered_map<id_t, state_record>  sent_;
+
+public:
+    state_baselines() = default;
+
+public:
+    // Writes the delta record and makes the record the new baseline, writes
+    // nothing and returns false if the client is already up to date
+    bool    write(binary_writer &w, state_record const& r);
+    // To call when the client drops the entity
+    void    forget(id_t id);
+    size_t  size() const;
+};
+
+WEBGAME_API extern std::string binary_state_entities(std::vector<state_record const*> const& records, state_baselines &baselines);
+
+//-----------------------------------------------------------------------------
+// STATE FRAGMENTS
+
+// Cache of the serialized state of entities. Each entity is rendered once
+// and the result is reused by every message that needs it, so it must be
+// cleared whenever the entities may have changed.
+class WEBGAME_API state_fragments
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(state_fragments);
+
+private:
+    std::unordered_map<id_t, std::string>   json_fragments_;
+    std::unordered_map<id_t, state_record>  records_;
+
+public:
+    state_fragments() = default;
+
+public:
+    // JSON state order of the entity
+    std::string const&  get(entity const& ent);
+    state_record const& record(entity const& ent);
+    void                clear();
+};
+
+WEBGAME_API extern std::string json_state_entities(std::vector<std::string const*> const& fragments);
 
 } // namespace webgame
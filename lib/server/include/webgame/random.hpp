@@ -4,10 +4,10 @@
 
 namespace webgame {
 
-extern std::random_device                           rd;
-extern std::mt19937                                 gen;
-extern std::uniform_int_distribution<unsigned int>  max_rand;
-extern std::uniform_int_distribution<unsigned int>  &id_rand;
-extern std::uniform_int_distribution<unsigned int>  dir_rand;
+// Engines and distributions are per thread so entities can be updated in parallel
+extern std::random_device                                       rd;
+extern thread_local std::mt19937                                gen;
+extern thread_local std::uniform_int_distribution<unsigned int> max_rand;
+extern thread_local std::uniform_int_distribution<unsigned int> dir_rand;
 
 } // namespace webgame
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <deque>
+#include <functional>
 #include <memory>
+#include <string>
 
 #include <bredis/Connection.hpp>
 #include <bredis/Extract.hpp>
@@ -10,13 +13,34 @@
 
 namespace webgame {
 
+// Asynchronous commands are pipelined: up to pipeline_depth() of them are
+// written back to back without waiting for their replies, which redis sends
+// in the same order and are handed to the continuations in FIFO order.
+// Synchronous commands must not be mixed with pending asynchronous ones.
 class WEBGAME_API redis_helper : public std::enable_shared_from_this<redis_helper>
 {
+private:
+    typedef std::function<void(bredis::extracts::extraction_result_t &&)> continuation;
+
+    // Serialized command(s) and what to do with their replies
+    struct request
+    {
+        std::string     payload;
+        size_t          nb_replies;
+        continuation    on_replies;
+    };
+
 private:
     bredis::Connection<boost::asio::ip::tcp::socket>    socket_;
     boost::asio::streambuf                              read_buffer_;
     boost::asio::streambuf                              write_buffer_;
-    std::list<std::function<void()>>                    tasks_;
+    // Not written yet
+    std::deque<request>                                 queued_;
+    // Written or being written, waiting for their replies
+    std::deque<request>                                 in_flight_;
+    size_t                                              pipeline_depth_;
+    bool                                                writing_;
+    bool                                                reading_;
 #ifndef WEBGAME_MONOTHREAD
     std::recursive_mutex                                tasks_mutex_;
 #endif /* !WEBGAME_MONOTHREAD */
@@ -27,6 +51,10 @@ public:
     redis_helper(boost::asio::ip::tcp::socket &socket);
 
 public:
+    // 1 waits for the reply of each command before writing the next one
+    void set_pipeline_depth(size_t depth);
+    size_t pipeline_depth() const;
+
     void select(unsigned int index);
 
     void flushdb();
@@ -34,19 +62,22 @@ public:
     size_t dbsize();
 
     std::vector<std::string> keys(std::string const& pattern);
+    // One step of a SCAN iteration: starts and ends with cursor "0", count is only a hint
+    std::vector<std::string> scan(std::string &cursor, std::string const& pattern, size_t count);
 
     void async_set(std::string const& key, std::string const& value, std::function<void()> &&handler);
     void async_get(std::string const& key, std::function<void(bool, std::string&&)> &&handler);
 
     std::vector<std::string> multi_get(std::vector<std::string> const& keys);
+    // Keys that do not exist anymore get an empty value
+    std::vector<std::string> mget(std::vector<std::string> const& keys);
 
     void async_multi_set(std::vector<std::pair<std::string, std::string>> const& keys_values, std::function<void()> &&handler);
 
 private:
-    void task_set(std::string const& key, std::string const& value, std::function<void()> &handler);
-    void task_get(std::string const& key, std::function<void(bool, std::string&&)> &handler);
-    void task_multi_set(std::vector<std::pair<std::string, std::string>> const& keys_values, std::function<void()> &handler);
-    void exec_next();
+    void push_request(bredis::command_wrapper_t const& cmd, size_t nb_replies, continuation &&on_replies);
+    void write_next();
+    void read_next();
 
     void command_result_str(bredis::single_command_t const& cmd, std::string const& expected_res);
     static void check_extract_str(bredis::extracts::extraction_result_t const& extract, std::string const& expected_res);
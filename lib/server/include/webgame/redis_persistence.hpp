@@ -21,6 +21,9 @@ private:
     unsigned short port_;
     unsigned int index_;
     boost::asio::ip::tcp::socket socket_;
+    size_t pipeline_depth_;
+    size_t load_batch_size_;
+    unsigned int load_threads_;
 
 private:
     WEBGAME_NON_MOVABLE_OR_COPYABLE(redis_persistence);
@@ -29,6 +32,13 @@ public:
     redis_persistence(boost::asio::io_context &io_context, std::string const& host, unsigned short port = 6379, unsigned int index = 0);
 
 public:
+    // Number of redis commands sent without waiting for their replies, 0 keeps the default
+    void                            set_pipeline_depth(size_t depth);
+    // The world is loaded by batches of about this many entities, each one
+    // being deserialized by up to load_threads threads while the next one is fetched
+    void                            set_load_batch_size(size_t batch_size);
+    void                            set_load_threads(unsigned int nb_threads);
+
     virtual bool                    start() override;
     virtual void                    stop() override;
     virtual void                    async_save(entities const& ents, std::function<save_handler> &&handler) override;
@@ -1,61 +1,107 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <future>
-#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include <boost/asio/executor_work_guard.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
 
 #include "common.hpp"
 #include "config.hpp"
 #include "containers.hpp"
 #include "entities.hpp"
 #include "nmoc.hpp"
+#include "protocol.hpp"
+#include "spatial_index.hpp"
+#include "tick_profiler.hpp"
 #include "time.hpp"
 
 namespace webgame {
 
+class io_shards;
 class persistence;
 class player;
-class vector;
 
 class WEBGAME_API server : public std::enable_shared_from_this<server>
 {
 private:
     typedef std::chrono::duration<double, std::ratio<1>> delta_duration;
+    typedef boost::asio::strand<boost::asio::io_context::executor_type> simulation_strand;
+    typedef boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard;
+
+    // Accepts the connections of an io_context
+    struct listener
+    {
+        boost::asio::io_context&        context;
+        boost::asio::ip::tcp::acceptor  acceptor;
+        boost::asio::ip::tcp::socket    socket;
+
+        explicit listener(boost::asio::io_context &context);
+    };
 
 private:
     connections                              conns_;
     entities                                 entities_;
+    spatial_index                            index_;
     boost::asio::io_context&                 io_context_;
     boost::asio::ip::tcp::endpoint           local_endpoint_;
-    boost::asio::ip::tcp::acceptor           acceptor_;
-    boost::asio::ip::tcp::socket             new_client_socket_;
+    std::vector<std::unique_ptr<listener>>   listeners_;
+    io_shards*                               shards_;
+    // Shard of the next connection, when a single acceptor deals them
+    size_t                                   next_shard_;
     std::shared_ptr<persistence>             persistence_;
+    unsigned int                             update_threads_;
+    double                                   view_radius_;
+    compression_options                      compression_;
+    state_fragments                          fragments_;
     steady_clock::duration                   tick_duration_;
+    steady_clock::duration                   save_interval_;
+    steady_clock::time_point                 next_save_time_;
     steady_clock::time_point                 wake_time_;
 #ifndef NDEBUG
     steady_clock::time_point                 start_time_;
 #endif /* !NDEBUG */
-#ifndef WEBGAME_MONOTHREAD
-    std::recursive_mutex                     server_mutex_;
-#endif /* !WEBGAME_MONOTHREAD */
     std::shared_ptr<bool>                    stop_;
+    // Set by the first do_shutdown() since the start
+    std::atomic<bool>                        shut_down_;
     boost::asio::steady_timer                game_cycle_timer_;
+    // The world (entities, index, connections and logins) is only touched by
+    // the handlers of this strand: the other threads post to it.
+    // It runs on sim_context_ with the simulation thread, on io_context_ otherwise.
+    bool                                     sim_thread_enabled_;
+    boost::asio::io_context                  sim_context_;
+    std::unique_ptr<work_guard>              sim_work_;
+    std::thread                              sim_thread_;
+    simulation_strand                        sim_strand_;
+    // Connection of each logged in player
+    std::unordered_map<std::string, player_conn const*>   logins_;
+    tick_profiler                            profiler_;
 
     WEBGAME_NON_MOVABLE_OR_COPYABLE(server);
 
 public:
     server(boost::asio::io_context &io_context, unsigned int port, std::shared_ptr<persistence> const& persistence);
+    ~server();
 
     template<class Rep = int, class Per = std::milli>
     void start(std::chrono::duration<Rep, Per> const& tick_duration = std::chrono::duration<Rep, Per>(250))
     {
         *stop_ = false;
+        shut_down_ = false;
 
         tick_duration_ = std::chrono::duration_cast<decltype(tick_duration_)>(tick_duration);
 
+        start_simulation();
+
         start_persistence();
 
         start_game();
@@ -63,22 +109,71 @@ public:
         start_network();
     }
 
+    // Waits for the simulation to close the connections and save the world,
+    // io_context must be running
     void                            shutdown();
-    bool                            is_player_connected(std::string const& name);
+
+    // Entities that changed are saved at most once per interval, whatever the tick duration
+    template<class Rep, class Per>
+    void set_save_interval(std::chrono::duration<Rep, Per> const& save_interval)
+    {
+        save_interval_ = std::chrono::duration_cast<decltype(save_interval_)>(save_interval);
+    }
+
+    // The setters below are called before start()
+    void                            set_update_threads(unsigned int nb_threads);
+    // The simulation gets its own thread, io_context threads then only do the
+    // network, persistence and update jobs
+    void                            set_simulation_thread(bool enabled);
+    // Connections are then accepted and served by the shards,
+    // each with its own SO_REUSEPORT acceptor where the platform has it.
+    void                            set_network_shards(io_shards &shards);
+    void                            set_view_radius(double radius);
+    double                          view_radius() const;
+    void                            set_compression(compression_options const& options);
+    compression_options const&      compression() const;
+    // From the network threads, handled by the simulation: a login is
+    // rejected if the player is already connected, the connection loads
+    // its player otherwise
+    void                            login(std::shared_ptr<player_conn> const& conn, std::string const& name);
     void                            register_player(std::shared_ptr<player_conn> const& conn, std::shared_ptr<player> const& new_ent);
+    // Runs the handler between two ticks, with the world and the connections
+    // as the game loop sees them
+    void                            post(std::function<void()> const& handler);
     std::shared_ptr<persistence>    get_persistence();
     connections const&              get_connections() const;
     entities const&                 get_entities() const;
+    // Timings of the game cycles, from any thread
+    tick_profiler const&            profiler() const;
 
 private:
+    void    start_simulation();
+    void    stop_simulation();
     void    start_persistence();
     void    start_game();
     void    start_network();
 
     void    game_cycle(boost::system::error_code const& error, unsigned int nb_ticks);
 
-    void    on_accept(const boost::system::error_code& error) noexcept;
-    void    do_accept();
+    void    update_entities(entities const& alive_entities, double delta, entities &changed_entities);
+
+    void    save_dirty_entities();
+
+    void    update_view(player_conn &conn, entities const& visible_from, entities const& changed_entities, state_fragments &fragments);
+
+    void    add_entity(std::shared_ptr<entity> const& ent);
+    void    remove_entity(id_t id);
+
+    void    on_accept(listener *l, const boost::system::error_code& error) noexcept;
+    void    do_accept(listener *l);
+    void    add_connection(std::shared_ptr<player_conn> const& conn);
+
+    // Returns false if it already ran
+    bool    do_shutdown();
+    // Whether nothing runs the handlers of sim_strand_ anymore
+    bool    simulation_stopped() const;
+    void    do_login(std::shared_ptr<player_conn> const& conn, std::string const& name);
+    void    do_register_player(std::shared_ptr<player_conn> const& conn, std::shared_ptr<player> const& new_ent);
 };
 
 } // namespace webgame
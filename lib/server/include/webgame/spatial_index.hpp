@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "config.hpp"
+#include "nmoc.hpp"
+#include "vector.hpp"
+
+namespace webgame {
+
+class located_entity;
+
+// Uniform grid over located entities published positions. Entities
+// registered here keep a pointer to the index and report their moves through
+// publish(), so the index stays up to date without being rebuilt each tick.
+class WEBGAME_API spatial_index
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(spatial_index);
+
+public:
+    typedef std::function<bool(located_entity const&)> filter;
+
+private:
+    typedef std::uint64_t cell_key;
+
+private:
+    double                                                          cell_size_;
+    std::unordered_map<cell_key, std::vector<located_entity*>>      cells_;
+    std::unordered_map<located_entity const*, cell_key>             where_;
+
+public:
+    spatial_index(double cell_size = 1.);
+    ~spatial_index();
+
+public:
+    void    insert(located_entity &ent);
+    void    remove(located_entity &ent);
+    void    move(located_entity const& ent);
+    void    clear();
+
+    size_t  size() const;
+    double  cell_size() const;
+
+    std::vector<located_entity const*> query_radius(vector const& center, double radius) const;
+    located_entity const*              nearest(vector const& center, double radius, filter const& f = filter()) const;
+
+private:
+    cell_key        key_of(vector const& pos) const;
+    cell_key        key_of(std::int64_t cx, std::int64_t cy) const;
+    std::int64_t    coord_of(double v) const;
+
+    located_entity* cell_erase(cell_key key, located_entity const* ent);
+
+    template<class F>
+    void            for_each_in_radius(vector const& center, double radius, F &&f) const;
+};
+
+} // namespace webgame
@@ -13,7 +13,7 @@ public:
     stationnary_entity(std::string const& type, vector const& pos);
 
 public:
-    virtual bool           update(double d, env & env) override;
+    virtual bool           update(double d, env const& env) override;
     virtual nlohmann::json save() const override;
     virtual void           load(nlohmann::json const& j) override;
 };
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "config.hpp"
+#include "nmoc.hpp"
+#include "time.hpp"
+
+namespace webgame {
+
+// Phases of a game cycle, in order
+enum class tick_phase : unsigned int
+{
+    reaping,        // closed connections and their players removed
+    commands,       // orders of the clients applied
+    update,         // entities updated and published
+    persistence,    // changed entities serialized for the save
+    broadcast       // states queued to the connections
+};
+
+size_t const nb_tick_phases = 5;
+size_t const default_tick_history = 128;
+// The latencies are those of the last minute, in slices of 10 seconds
+size_t const default_latency_slices = 6;
+steady_clock::duration const default_latency_slice = std::chrono::seconds(10);
+
+WEBGAME_API char const* tick_phase_name(tick_phase phase);
+
+// What the broadcast of a tick left to the connections
+struct WEBGAME_API tick_traffic
+{
+    // Left to write on all connections, as their strands last published it
+    size_t  bytes_queued = 0;
+    // Player states replaced by a newer one since the previous tick
+    size_t  superseded = 0;
+    // Connections skipped, their client not keeping up
+    size_t  congested = 0;
+};
+
+// Of one tick
+struct WEBGAME_API tick_breakdown
+{
+    std::array<steady_clock::duration, nb_tick_phases>  phases;
+    steady_clock::duration                              total;
+    // Entities updated, and those of them that changed
+    size_t                                              entities_updated;
+    size_t                                              entities_changed;
+    tick_traffic                                        traffic;
+};
+
+// Counts of values in log-linear buckets, as HDR histograms do: values
+// under 16 have their own bucket, the others fall in 16 buckets per power
+// of two, so that a bucket is within 1/16 of its values whatever their scale.
+class WEBGAME_API latency_histogram
+{
+private:
+    static unsigned int const   sub_bits = 4;
+    static size_t const         sub_count = size_t(1) << sub_bits;
+    static size_t const         nb_buckets = (64 - sub_bits + 1) * sub_count;
+
+    std::array<uint64_t, nb_buckets>    counts_;
+    uint64_t                            count_;
+    uint64_t                            sum_;
+    uint64_t                            max_;
+
+public:
+    latency_histogram();
+
+public:
+    void        record(uint64_t value);
+    void        clear();
+
+    // Adds the values of another histogram
+    void        merge(latency_histogram const& other);
+
+    uint64_t    count() const;
+    uint64_t    max() const;
+    double      mean() const;
+    // Highest value of the bucket holding the p-th percentile, p in [0, 100]
+    uint64_t    percentile(double p) const;
+
+private:
+    static size_t   bucket(uint64_t value);
+    static uint64_t highest_value(size_t bucket);
+};
+
+// Times the phases of the game cycles, always on: a tick costs a clock read
+// per phase and one uncontended lock. Durations are kept in nanoseconds, in
+// a ring of the last tick breakdowns and in histograms per phase. These are
+// rolling: the ticks are recorded in the histograms of a time slice, the
+// oldest slice being cleared for the next one, and the slices of the window
+// are merged when queried.
+class WEBGAME_API tick_profiler
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(tick_profiler);
+
+private:
+    struct latency_slice
+    {
+        std::array<latency_histogram, nb_tick_phases>   phases;
+        latency_histogram                               total;
+        steady_clock::time_point                        start;
+    };
+
+    // Only touched by the game loop
+    tick_breakdown                                      current_;
+    steady_clock::time_point                            tick_start_;
+    steady_clock::time_point                            phase_start_;
+#ifndef WEBGAME_MONOTHREAD
+    mutable std::mutex                                  mutex_;
+#endif /* !WEBGAME_MONOTHREAD */
+    steady_clock::duration const                        slice_duration_;
+    std::vector<latency_slice>                          slices_;
+    // Position in slices_ of the one being recorded
+    size_t                                              slice_;
+    std::vector<tick_breakdown>                         history_;
+    // Position in history_ of the next breakdown
+    size_t                                              next_;
+    uint64_t                                            nb_ticks_;
+    uint64_t                                            entities_updated_;
+    uint64_t                                            superseded_;
+    // Sum over the ticks of the connections skipped
+    uint64_t                                            skipped_ticks_;
+
+public:
+    explicit tick_profiler(size_t history_size = default_tick_history,
+                           steady_clock::duration slice_duration = default_latency_slice,
+                           size_t nb_slices = default_latency_slices);
+
+public:
+    // From the game loop
+    void                        start_tick();
+    // Ends the phase started by the previous call, or by start_tick()
+    void                        end_phase(tick_phase phase);
+    void                        end_tick(size_t entities_updated, size_t entities_changed, tick_traffic const& traffic);
+
+    // From any thread
+    uint64_t                    nb_ticks() const;
+    // Over the window, the slice being recorded included
+    steady_clock::duration      window() const;
+    latency_histogram           histogram(tick_phase phase) const;
+    latency_histogram           total_histogram() const;
+    // Oldest first
+    std::vector<tick_breakdown> history() const;
+    // Lines for the console
+    std::vector<std::string>    summary() const;
+    nlohmann::json              dump() const;
+    void                        reset();
+
+private:
+    // Of the slices in the window, with the mutex held
+    void                        merge_window(std::array<latency_histogram, nb_tick_phases> &phases, latency_histogram &total) const;
+};
+
+} // namespace webgame
@@ -3,6 +3,7 @@
 #include <functional>
 #include <string>
 
+#include <boost/asio/buffer.hpp>
 #include <boost/beast/core/buffers_to_string.hpp>
 
 #include "filesystem.hpp"
@@ -72,10 +73,11 @@ template<class ConstBufferSequence>
 std::string get_readable(ConstBufferSequence const& bufs)
 {
     std::ostringstream ss;
-    for (auto const& b : bufs)
-        for (int i = 0; i < b.size(); ++i)
+    // A single buffer is a sequence too
+    for (auto it = boost::asio::buffer_sequence_begin(bufs); it != boost::asio::buffer_sequence_end(bufs); ++it)
+        for (size_t i = 0; i < it->size(); ++i)
         {
-            char c = static_cast<char const*>(b.data())[i];
+            char c = static_cast<char const*>(it->data())[i];
             if (isprint(c))
                 if (c == '\\')
                     ss << "\\\\";
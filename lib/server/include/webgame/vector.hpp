@@ -1,47 +1,100 @@
 #pragma once
 
-#include <boost/numeric/ublas/vector.hpp>
+#include <cmath>
+#include <cstddef>
+#include <ostream>
+#include <type_traits>
 
 #include <nlohmann/json.hpp>
 
 #include "common.hpp"
 #include "config.hpp"
 
-namespace ublas = boost::numeric::ublas;
-
 namespace webgame {
 
-/* Workaround for Boost UBLAS 1.67 and MSVC 2017 ambiguitie where
-vector(U&&...) is prefered where vector(vector_expression<AE> const&)
-should be chosen unless if constructor prototype is matching perfectly,
-requiring unecessary cast code*/
-using vec_impl = ublas::fixed_vector<double, 2>;
-class WEBGAME_API vector : public vec_impl
+// Plain 2D vector: trivially copyable, x and y packed with nothing around,
+// so arrays of them can be memcpy'd or loaded into SIMD registers
+template<class T>
+class WEBGAME_API basic_vec2
 {
+private:
+    T xy_[2];
+
 public:
-    vector() = default;
-    vector(vector const& other) = default;
-    vector(std::initializer_list<value_type> const& l);
-    template<class T>
-    vector(ublas::vector_expression<T> const& ve)
-        : vec_impl(ve)
+    basic_vec2() = default;
+    constexpr basic_vec2(T x, T y)
+        : xy_{ x, y }
+    {}
+    // Between float and double storage
+    template<class U>
+    constexpr explicit basic_vec2(basic_vec2<U> const& other)
+        : xy_{ static_cast<T>(other.x()), static_cast<T>(other.y()) }
     {}
-    vector(double x, double y);
 
+    // Same JSON form for both storages: {"x": ..., "y": ...}
     nlohmann::json save() const;
     void           load(nlohmann::json const& j);
 
-    bool operator==(vector const& other) const;
-    bool operator!=(vector const& other) const;
+    constexpr T const& x() const { return xy_[0]; }
+    constexpr T const& y() const { return xy_[1]; }
+    constexpr T &operator[](std::size_t i) { return xy_[i]; }
+    constexpr T const& operator[](std::size_t i) const { return xy_[i]; }
+
+    constexpr T length_squared() const { return xy_[0] * xy_[0] + xy_[1] * xy_[1]; }
+    T           norm() const { return std::sqrt(length_squared()); }
+    // A null vector stays null instead of becoming NaN
+    basic_vec2  normalized() const;
+    void        normalize();
 
-    double const& x() const;
-    double const& y() const;
+    constexpr basic_vec2 &operator+=(basic_vec2 const& other) { xy_[0] += other.xy_[0]; xy_[1] += other.xy_[1]; return *this; }
+    constexpr basic_vec2 &operator-=(basic_vec2 const& other) { xy_[0] -= other.xy_[0]; xy_[1] -= other.xy_[1]; return *this; }
+    constexpr basic_vec2 &operator*=(T k) { xy_[0] *= k; xy_[1] *= k; return *this; }
+    constexpr basic_vec2 &operator/=(T k) { xy_[0] /= k; xy_[1] /= k; return *this; }
 
-    double norm() const;
-    vector normalized() const;
-    void normalize();
+    constexpr bool operator==(basic_vec2 const& other) const { return xy_[0] == other.xy_[0] && xy_[1] == other.xy_[1]; }
+    constexpr bool operator!=(basic_vec2 const& other) const { return !(*this == other); }
+
+    // Friends so that scalars convert, as in v * 2
+    friend constexpr basic_vec2 operator+(basic_vec2 a, basic_vec2 const& b) { return a += b; }
+    friend constexpr basic_vec2 operator-(basic_vec2 a, basic_vec2 const& b) { return a -= b; }
+    friend constexpr basic_vec2 operator-(basic_vec2 const& a) { return basic_vec2(-a.xy_[0], -a.xy_[1]); }
+    friend constexpr basic_vec2 operator*(basic_vec2 a, T k) { return a *= k; }
+    friend constexpr basic_vec2 operator*(T k, basic_vec2 a) { return a *= k; }
+    friend constexpr basic_vec2 operator/(basic_vec2 a, T k) { return a /= k; }
+    friend constexpr T          dot(basic_vec2 const& a, basic_vec2 const& b) { return a.xy_[0] * b.xy_[0] + a.xy_[1] * b.xy_[1]; }
 };
 
-WEBGAME_API std::ostream &operator<<(std::ostream &os, vector const&v);
+template<class T>
+basic_vec2<T> basic_vec2<T>::normalized() const
+{
+    basic_vec2 v(*this);
+    v.normalize();
+    return v;
+}
+
+template<class T>
+void basic_vec2<T>::normalize()
+{
+    T const n = norm();
+    if (n != 0)
+        *this /= n;
+}
+
+template<class T>
+std::ostream &operator<<(std::ostream &os, basic_vec2<T> const& v)
+{
+    return os << "(" << v.x() << "," << v.y() << ")";
+}
+
+using vec2 = basic_vec2<double>;
+using vec2f = basic_vec2<float>;
+// Name used all over the engine
+using vector = vec2;
+
+static_assert(std::is_trivially_copyable<vec2>::value && std::is_standard_layout<vec2>::value, "vec2 must be POD");
+static_assert(sizeof(vec2) == 2 * sizeof(double) && sizeof(vec2f) == 2 * sizeof(float), "vec2 must be packed");
+
+extern template class basic_vec2<double>;
+extern template class basic_vec2<float>;
 
 } // namespace webgame
@@ -0,0 +1,154 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/beast/zlib/deflate_stream.hpp>
+
+#include <webgame/entities.hpp>
+#include <webgame/npc.hpp>
+#include <webgame/protocol.hpp>
+
+// Compresses the entity state messages of successive ticks as a websocket
+// with permessage-deflate would, with various compression_options, to weigh
+// the CPU spent per message against the bytes saved
+
+namespace {
+
+namespace zlib = boost::beast::zlib;
+
+int const nb_ticks = 100;
+double const delta = 0.05;
+
+using bench_clock = std::chrono::steady_clock;
+
+struct setting
+{
+    int     level;
+    int     window_bits;
+    int     mem_level;
+    bool    context_takeover;
+};
+
+std::vector<setting> const settings = {
+    { 6, 15, 8, true },
+    { 6, 15, 4, true },
+    { 1, 15, 4, true },
+    { 6, 12, 4, true },
+    { 6, 9, 1, true },
+    { 6, 15, 4, false },
+    { 1, 9, 1, false }
+};
+
+// Every entity moves at every tick, so every message holds all of them
+void make_messages(int nb_npcs, std::vector<std::string> &json_msgs, std::vector<std::string> &binary_msgs)
+{
+    webgame::entities ents;
+    std::vector<std::shared_ptr<webgame::npc>> npcs;
+    for (int i = 0; i < nb_npcs; ++i)
+    {
+        npcs.push_back(std::make_shared<webgame::npc>(i % 3 == 0 ? "npc_ally_1" : "npc_enemy_1", webgame::vector(i % 100, i / 100), webgame::vector(std::cos(i), std::sin(i)), 1, 1));
+        ents.add(npcs.back());
+    }
+
+    webgame::state_fragments fragments;
+    webgame::state_baselines baselines;
+    for (int t = 0; t < nb_ticks; ++t)
+    {
+        for (auto const& npc : npcs)
+        {
+            npc->move(delta);
+            npc->publish();
+        }
+
+        fragments.clear();
+        std::vector<std::string const*> to_send;
+        std::vector<webgame::state_record const*> records;
+        for (auto const& pair : ents)
+        {
+            to_send.push_back(&fragments.get(*pair.second));
+            records.push_back(&fragments.record(*pair.second));
+        }
+        json_msgs.push_back(webgame::json_state_entities(to_send));
+        binary_msgs.push_back(webgame::binary_state_entities(records, baselines));
+    }
+}
+
+// Returns the total size of the compressed messages
+size_t deflate_all(std::vector<std::string> const& msgs, setting const& s)
+{
+    zlib::deflate_stream stream;
+    stream.reset(s.level, s.window_bits, s.mem_level, zlib::Strategy::normal);
+
+    std::vector<unsigned char> out;
+    size_t total = 0;
+    for (std::string const& msg : msgs)
+    {
+        if (!s.context_takeover)
+            stream.reset();
+
+        out.resize(stream.upper_bound(msg.size()) + 16);
+        zlib::z_params zs;
+        zs.next_in = msg.data();
+        zs.avail_in = msg.size();
+        zs.next_out = out.data();
+        zs.avail_out = out.size();
+
+        boost::beast::error_code ec;
+        stream.write(zs, zlib::Flush::sync, ec);
+        if (ec || zs.avail_in != 0)
+            std::cerr << "  deflate error: " << ec.message() << std::endl;
+
+        // permessage-deflate leaves out the 00 00 ff ff ending the sync flush
+        total += zs.total_out - 4;
+    }
+    return total;
+}
+
+void bench(std::string const& format, std::vector<std::string> const& msgs)
+{
+    size_t raw = 0;
+    for (std::string const& msg : msgs)
+        raw += msg.size();
+    std::cout << "  " << format << ", " << raw / msgs.size() << " bytes per message" << std::endl;
+
+    for (setting const& s : settings)
+    {
+        auto start = bench_clock::now();
+        size_t compressed = deflate_all(msgs, s);
+        double const us = std::chrono::duration<double, std::micro>(bench_clock::now() - start).count() / msgs.size();
+
+        // Of zlib, for the deflate side of each connection
+        size_t const memory = (size_t(1) << (s.window_bits + 2)) + (size_t(1) << (s.mem_level + 9));
+
+        std::cout << "    level " << s.level << ", window bits " << s.window_bits << ", mem level " << s.mem_level
+            << (s.context_takeover ? ", takeover" : ", no takeover") << " (" << memory / 1024 << " KiB): "
+            << compressed / msgs.size() << " bytes, "
+            << 100. * (raw - compressed) / raw << "% saved, "
+            << us << " us per message" << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int ac, char **av)
+{
+    std::vector<int> nb_npcs_list = { 10, 100, 1000 };
+    if (ac >= 2)
+        nb_npcs_list = { std::stoi(av[1]) };
+
+    for (int nb_npcs : nb_npcs_list)
+    {
+        std::vector<std::string> json_msgs;
+        std::vector<std::string> binary_msgs;
+        make_messages(nb_npcs, json_msgs, binary_msgs);
+
+        std::cout << nb_npcs << " entities, " << nb_ticks << " ticks" << std::endl;
+        bench("json", json_msgs);
+        bench("binary", binary_msgs);
+    }
+
+    return 0;
+}
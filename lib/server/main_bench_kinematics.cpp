@@ -0,0 +1,77 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <webgame/kinematics.hpp>
+#include <webgame/npc.hpp>
+
+// Compares the per entity mobile_entity::move() with the batch kernels, on
+// entities all moving in various directions
+
+namespace {
+
+int const nb_ticks = 200;
+double const delta = 0.05;
+
+using bench_clock = std::chrono::steady_clock;
+
+std::vector<std::shared_ptr<webgame::npc>> make_npcs(int nb_npcs)
+{
+    std::vector<std::shared_ptr<webgame::npc>> npcs;
+    npcs.reserve(nb_npcs);
+    for (int i = 0; i < nb_npcs; ++i)
+        npcs.push_back(std::make_shared<webgame::npc>("npc1", webgame::vector(0, 0), webgame::vector(std::cos(i), std::sin(i)), 1, 1));
+    return npcs;
+}
+
+void report(std::string const& name, bench_clock::duration elapsed, int nb_npcs)
+{
+    double const ns = std::chrono::duration<double, std::nano>(elapsed).count() / nb_ticks / nb_npcs;
+    std::cout << "  " << name << ": " << ns << " ns per entity" << std::endl;
+}
+
+} // namespace
+
+int main(int ac, char **av)
+{
+    int const nb_npcs = ac >= 2 ? std::stoi(av[1]) : 100000;
+
+    std::cout << nb_npcs << " npcs, " << nb_ticks << " ticks, detected SIMD level: "
+        << webgame::simd_level_name(webgame::detected_simd_level()) << std::endl;
+
+    {
+        auto npcs = make_npcs(nb_npcs);
+        auto start = bench_clock::now();
+        for (int t = 0; t < nb_ticks; ++t)
+            for (auto const& npc : npcs)
+                npc->move(delta);
+        report("mobile_entity::move", bench_clock::now() - start, nb_npcs);
+    }
+
+    for (webgame::simd_level level : { webgame::simd_level::scalar, webgame::simd_level::sse2, webgame::simd_level::avx2 })
+    {
+        if (level > webgame::detected_simd_level())
+            continue;
+
+        auto npcs = make_npcs(nb_npcs);
+        std::unordered_map<webgame::mobile_chunk*, webgame::slot_mask> active;
+        for (auto const& npc : npcs)
+            active[static_cast<webgame::mobile_chunk*>(npc->slot().chunk)].set(npc->slot().index);
+
+        size_t nb_moved = 0;
+        auto start = bench_clock::now();
+        for (int t = 0; t < nb_ticks; ++t)
+            for (auto &pair : active)
+                nb_moved += webgame::integrate(*pair.first, delta, pair.second, level).count();
+        report(std::string("integrate ") + webgame::simd_level_name(level), bench_clock::now() - start, nb_npcs);
+
+        if (nb_moved != size_t(nb_ticks) * nb_npcs)
+            std::cerr << "  unexpected number of moves: " << nb_moved << std::endl;
+    }
+
+    return 0;
+}
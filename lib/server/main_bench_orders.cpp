@@ -0,0 +1,77 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <webgame/order_parser.hpp>
+
+// Compares the complete JSON parse of the orders of the clients with
+// parse_client_order, on a single thread
+
+namespace {
+
+int const nb_rounds = 200000;
+
+using bench_clock = std::chrono::steady_clock;
+
+std::vector<std::string> const orders = {
+    R"({"order": "authentication", "player_name": "player1"})",
+    R"({"order": "action", "suborder": "change_speed", "speed": 0.75})",
+    R"({"order": "action", "suborder": "change_dir", "dir": {"x": -0.6, "y": 0.8}})",
+    R"({"order": "action", "suborder": "move_to", "target_pos": {"x": 1234.5, "y": -67.25}})"
+};
+
+void report(std::string const& name, bench_clock::duration elapsed)
+{
+    double const seconds = std::chrono::duration<double>(elapsed).count();
+    double const nb_messages = double(nb_rounds) * orders.size();
+    std::cout << "  " << name << ": " << nb_messages / seconds << " messages/s, "
+        << seconds * 1e9 / nb_messages << " ns per message" << std::endl;
+}
+
+} // namespace
+
+int main()
+{
+    std::cout << orders.size() * nb_rounds << " messages" << std::endl;
+
+    // Summed so that the parses are not optimized away
+    double sum = 0;
+
+    {
+        auto start = bench_clock::now();
+        for (int r = 0; r < nb_rounds; ++r)
+            for (std::string const& msg : orders)
+            {
+                webgame::client_order order;
+                std::string player_name;
+                webgame::parse_client_order(nlohmann::json::parse(msg.data(), msg.data() + msg.size()), order, player_name);
+                sum += order.speed + order.vec.x() + order.player_name_size;
+            }
+        report("nlohmann::json", bench_clock::now() - start);
+    }
+
+    {
+        size_t nb_failed = 0;
+        auto start = bench_clock::now();
+        for (int r = 0; r < nb_rounds; ++r)
+            for (std::string const& msg : orders)
+            {
+                webgame::client_order order;
+                if (!webgame::parse_client_order(msg.data(), msg.size(), order))
+                    ++nb_failed;
+                sum -= order.speed + order.vec.x() + order.player_name_size;
+            }
+        report("parse_client_order", bench_clock::now() - start);
+
+        if (nb_failed != 0)
+            std::cerr << "  unexpected number of fallbacks: " << nb_failed << std::endl;
+    }
+
+    if (sum > 1e-6 || sum < -1e-6)
+        std::cerr << "  parses do not match: " << sum << std::endl;
+
+    return 0;
+}
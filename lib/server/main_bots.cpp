@@ -159,7 +159,6 @@ int main(int ac, char **av)
                         for (auto &ws : sockets)
                         {
                             std::string text = "{\"order\": \"action\", \"suborder\": \"change_dir\", \"dir\": {\"x\": " + std::to_string(dis(g)) + ", \"y\": " + std::to_string(dis(g)) + "}}";
-                            WEBGAME_LOCK(webgame::log_mutex);
                             CHECK(ws, ec, "WRITING");
                             ws.write(asio::buffer(text), ec);
                             CHECK_DO(ws, ec, "DIRECTION CHANGED", ws.close(beast::websocket::close_code::abnormal, ec); continue);
@@ -171,7 +170,6 @@ int main(int ac, char **av)
                     for (auto &ws : sockets)
                     {
                         beast::multi_buffer buffer;
-                        WEBGAME_LOCK(webgame::log_mutex);
                         CHECK(ws, ec, "READING");
                         ws.read(buffer, ec);
                         CHECK_DO(ws, ec, "READ " << boost::beast::buffers_to_string(buffer.data()), ws.close(beast::websocket::close_code::abnormal, ec); continue);
@@ -181,7 +179,6 @@ int main(int ac, char **av)
                 // CLOSE
                 for (auto &ws : sockets)
                 {
-                    WEBGAME_LOCK(webgame::log_mutex);
                     CHECK(ws, ec, "CLOSING");
                     ws.close(beast::websocket::close_code::normal, ec);
                     WEBGAME_LOG("", "CLOSED");
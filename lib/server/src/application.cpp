@@ -1,9 +1,11 @@
 #include "application.hpp"
 
+#include <memory>
+
 #include <boost/asio/io_context.hpp>
 
 #include "behavior.hpp"
-#include "lock.hpp"
+#include "io_shards.hpp"
 #include "log.hpp"
 #include "redis_persistence.hpp"
 #include "server.hpp"
@@ -15,6 +17,7 @@ void show_help()
     _WEBGAME_MY_LOG("commands:" << std::endl
         << "\thelp" << std::endl
         << "\tinfo" << std::endl
+        << "\tprofile: timings of the last game cycles, as JSON" << std::endl
         << "\texit" << std::endl
         << "\tio: set/unset io log: " << io_log << std::endl
         << "\tdata: set/unset data log (no effect if io log is unset): " << data_log
@@ -29,19 +32,21 @@ void handle_user_input(std::shared_ptr<server> server_p)
         std::cin >> input;
         if (input == "info")
         {
-            WEBGAME_LOCK(log_mutex);
             WEBGAME_LOG("INFO", "Connections: " << server_p->get_connections().size());
             WEBGAME_LOG("INFO", "Entities: " << server_p->get_entities().size());
+            for (std::string const& line : server_p->profiler().summary())
+                WEBGAME_LOG("INFO", line);
             /*LOG("INFO", "Threads: " << network_threads_.size() << " asio thread"
             << (network_threads_.size() > 1 ? "s" : "") << " + user input thread + game loop thread");*/
         }
         else if (input == "help")
         {
-            WEBGAME_LOCK(log_mutex);
             _WEBGAME_MY_LOG("");
             show_help();
             _WEBGAME_MY_LOG("");
         }
+        else if (input == "profile")
+            _WEBGAME_MY_LOG(server_p->profiler().dump().dump());
         else if (input == "data")
             data_log = !data_log;
         else if (input == "io")
@@ -53,7 +58,6 @@ void handle_user_input(std::shared_ptr<server> server_p)
         }
         else
         {
-            WEBGAME_LOCK(log_mutex);
             _WEBGAME_MY_LOG("");
             _WEBGAME_MY_LOG("Unknown command: " << input);
             _WEBGAME_MY_LOG("");
@@ -69,21 +73,35 @@ int application(int ac, char **av)
 
     unsigned short  port = 2000;
     unsigned int    nb_threads = std::thread::hardware_concurrency();
+    // Without shards, the connections are served by the threads of the game
+    unsigned int    nb_shards = 0;
 
     if (ac >= 2)
         port = std::stoi(av[1]);
     if (ac >= 3)
         nb_threads = std::stoi(av[2]);
+    if (ac >= 4)
+        nb_shards = std::stoi(av[3]);
 
 
     boost::asio::io_context ioc;
 
     std::vector<std::thread> network_threads;
+    std::unique_ptr<io_shards> shards;
 
     try {
         auto game_server = std::make_shared<server>(ioc, port, std::make_shared<redis_persistence>(ioc, "localhost"));
 
+        game_server->set_update_threads(nb_threads);
+        game_server->set_simulation_thread(true);
+        if (nb_shards > 0)
+        {
+            shards.reset(new io_shards(nb_shards));
+            game_server->set_network_shards(*shards);
+        }
         game_server->start();
+        if (shards)
+            shards->run();
 
         for (unsigned int i = 0; i < nb_threads; ++i)
             network_threads.emplace_back([&ioc, i] {
@@ -105,6 +123,8 @@ int application(int ac, char **av)
 
     for (std::thread & t : network_threads)
         t.join();
+    if (shards)
+        shards->join();
 
 #ifdef _WIN32
     system("PAUSE");
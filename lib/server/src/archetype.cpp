@@ -0,0 +1,20 @@
+#include "archetype.hpp"
+
+namespace webgame {
+
+template class archetype<located_chunk>;
+template class archetype<mobile_chunk>;
+
+archetype<located_chunk> &located_archetype()
+{
+    static archetype<located_chunk> *instance = new archetype<located_chunk>();
+    return *instance;
+}
+
+archetype<mobile_chunk> &mobile_archetype()
+{
+    static archetype<mobile_chunk> *instance = new archetype<mobile_chunk>();
+    return *instance;
+}
+
+} // namespace webgame
@@ -68,7 +68,7 @@ walkaround::walkaround()
     , t_(0)
 {}
 
-void walkaround::update(double delta, env &env)
+void walkaround::update(double delta, env const& env)
 {
     assert(self_ != nullptr);
     resolved_ = true;
@@ -142,12 +142,13 @@ arealimit::arealimit(area_type area_type, double radius, vector const& center)
     , center_(center)
 {}
 
-void arealimit::update(double delta, env &env)
+void arealimit::update(double delta, env const& env)
 {
     assert(self_ != nullptr);
     if (area_type_ == square)
     {
-        if (self_->pos()[0] > center_[0] + radius_ || self_->pos()[0] < center_[0] - radius_ || self_->pos()[1] > center_[1] + radius_ || self_->pos()[1] < center_[1] - radius_)
+        vector const& pos = self_->pos();
+        if (pos.x() > center_.x() + radius_ || pos.x() < center_.x() - radius_ || pos.y() > center_.y() + radius_ || pos.y() < center_.y() - radius_)
         {
             self_->set_speed(self_->max_speed());
             self_->set_dir(center_ - self_->pos());
@@ -212,31 +213,22 @@ attack_on_sight::attack_on_sight(double radius)
     , radius_(radius)
 {}
 
-void attack_on_sight::update(double delta, env &env)
+void attack_on_sight::update(double delta, env const& env)
 {
     assert(self_ != nullptr);
 
-    double enemy_dist = 0;
-    std::shared_ptr<located_entity const> closest_enemy;
-    for (auto const& e : static_cast<entity_container<located_entity>>(env.others()))
-    {
-        if (e.second->type() == self_->type() || e.second->type().find("object") != std::string::npos)
-            continue;
-        double dist = vector((self_->pos() - e.second->pos())).norm();
-        if (dist > radius_ || (closest_enemy && dist >= enemy_dist))
-            continue;
-
-        enemy_dist = dist;
-        closest_enemy = e.second;
-    }
+    located_entity const* closest_enemy = env.nearest(self_->pos(), radius_, [this](located_entity const& e) {
+        return e.type().faction() != self_->type().faction() && !e.type().has(entity_type::object_trait);
+    });
 
     if (closest_enemy)
     {
+        double enemy_dist = (self_->pos() - closest_enemy->published_pos()).norm();
         self_->set_speed(enemy_dist <= 0.15f ? 0.f : self_->max_speed());
-        self_->set_dir(closest_enemy->pos() - self_->pos());
+        self_->set_dir(closest_enemy->published_pos() - self_->pos());
     }
 
-    resolved_ = !closest_enemy;
+    resolved_ = closest_enemy == nullptr;
 }
 
 nlohmann::json attack_on_sight::save() const
@@ -276,7 +268,7 @@ WEBGAME_REGISTER(behavior, attack_on_sight);
 //-----------------------------------------------------------------------------
 // STOP
 
-void stop::update(double delta, env &env)
+void stop::update(double delta, env const& env)
 {
     self_->set_speed(0.f);
     resolved_ = true;
@@ -0,0 +1,136 @@
+#include "binary.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace webgame {
+
+namespace {
+
+void write(std::string &out, std::uint64_t v, size_t nb_bytes)
+{
+    for (size_t i = 0; i < nb_bytes; ++i)
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// BINARY WRITER
+
+binary_writer::binary_writer(std::string &out)
+    : out_(out)
+{}
+
+void binary_writer::u8(std::uint8_t v)
+{
+    write(out_, v, 1);
+}
+
+void binary_writer::u16(std::uint16_t v)
+{
+    write(out_, v, 2);
+}
+
+void binary_writer::u32(std::uint32_t v)
+{
+    write(out_, v, 4);
+}
+
+void binary_writer::f32(double v)
+{
+    float f = static_cast<float>(v);
+    std::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    write(out_, bits, 4);
+}
+
+void binary_writer::f64(double v)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    write(out_, bits, 8);
+}
+
+void binary_writer::str(std::string const& v)
+{
+    if (v.size() > 0xff)
+        throw std::runtime_error("binary_writer: string too long: " + v);
+
+    u8(static_cast<std::uint8_t>(v.size()));
+    out_ += v;
+}
+
+//-----------------------------------------------------------------------------
+// BINARY READER
+
+binary_reader::binary_reader(std::string const& data)
+    : binary_reader(data.data(), data.size())
+{}
+
+binary_reader::binary_reader(char const* data, size_t size)
+    : data_(data)
+    , size_(size)
+    , pos_(0)
+{}
+
+std::uint8_t binary_reader::u8()
+{
+    return static_cast<std::uint8_t>(read(1));
+}
+
+std::uint16_t binary_reader::u16()
+{
+    return static_cast<std::uint16_t>(read(2));
+}
+
+std::uint32_t binary_reader::u32()
+{
+    return static_cast<std::uint32_t>(read(4));
+}
+
+double binary_reader::f32()
+{
+    std::uint32_t bits = static_cast<std::uint32_t>(read(4));
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+double binary_reader::f64()
+{
+    std::uint64_t bits = read(8);
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+std::string binary_reader::str()
+{
+    size_t size = u8();
+    if (size_ - pos_ < size)
+        throw std::runtime_error("binary_reader: truncated data");
+
+    std::string v(data_ + pos_, size);
+    pos_ += size;
+    return v;
+}
+
+bool binary_reader::at_end() const
+{
+    return pos_ == size_;
+}
+
+std::uint64_t binary_reader::read(size_t nb_bytes)
+{
+    if (size_ - pos_ < nb_bytes)
+        throw std::runtime_error("binary_reader: truncated data");
+
+    std::uint64_t v = 0;
+    for (size_t i = 0; i < nb_bytes; ++i)
+        v |= static_cast<std::uint64_t>(static_cast<unsigned char>(data_[pos_ + i])) << (8 * i);
+    pos_ += nb_bytes;
+    return v;
+}
+
+} // namespace webgame
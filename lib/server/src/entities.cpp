@@ -15,6 +15,4 @@ template class WEBGAME_API entity_container<entity>;
 //template class WEBGAME_API entity_container<npc>;
 //template class WEBGAME_API entity_container<player>;
 
-//template WEBGAME_API entity_container<entity>::operator entity_container<located_entity>;
-
 } // namespace webgame
@@ -1,26 +1,43 @@
 #include "entity.hpp"
 
-#include "random.hpp"
+#include "id_allocator.hpp"
+#include "protocol.hpp"
 #include "save_load.hpp"
+#include "spatial_index.hpp"
 
 namespace webgame {
 
+namespace {
+
+mobile_chunk &mobile_components(archetype_slot const& slot)
+{
+    return static_cast<mobile_chunk &>(*slot.chunk);
+}
+
+} // namespace
+
 //-----------------------------------------------------------------------------
 // ENTITY
 
+entity::entity()
+    : id_(entity_ids().allocate())
+{}
+
 entity::entity(std::string const& type)
-    : id_(id_rand(gen))
+    : id_(entity_ids().allocate())
     , type_(type)
 {}
 
 entity::~entity()
-{}
+{
+    entity_ids().release(id_);
+}
 
 nlohmann::json entity::save() const
 {
     return {
         {"id", id_},
-        {"type", type_}
+        {"type", type_.name()}
     };
 }
 
@@ -30,14 +47,28 @@ void entity::load(nlohmann::json const& j)
         || !j.count("type") || !j["type"].is_string())
         throw std::runtime_error("entity: invalid JSON");
 
-    id_ = j["id"];
-    type_ = j["type"];
+    // The persisted id is kept, the one given at construction is freed
+    id_t const id = j["id"];
+    if (id != id_)
+    {
+        entity_ids().claim(id);
+        entity_ids().release(id_);
+        id_ = id;
+    }
+    type_ = entity_type(j["type"].get<std::string>());
+    dirty_ = false;
 }
 
 void entity::build_state_order(nlohmann::json &j) const
 {
     j["id"] = id_;
-    j["type"] = type_;
+    j["type"] = type_.name();
+}
+
+void entity::build_state_record(state_record &r) const
+{
+    r.id = id_;
+    r.type = type_.tag();
 }
 
 id_t const& entity::id() const
@@ -45,11 +76,26 @@ id_t const& entity::id() const
     return id_;
 }
 
-std::string const& entity::type() const
+entity_type const& entity::type() const
 {
     return type_;
 }
 
+void entity::mark_dirty()
+{
+    dirty_ = true;
+}
+
+void entity::clear_dirty()
+{
+    dirty_ = false;
+}
+
+bool entity::is_dirty() const
+{
+    return dirty_;
+}
+
 #ifdef WEBGAME_TESTS
 bool entity::operator==(entity const& other) const
 {
@@ -65,11 +111,44 @@ bool entity::operator!=(entity const& other) const
 //-----------------------------------------------------------------------------
 // LOCATED ENTITY
 
+located_entity::located_entity()
+    : located_entity(located_archetype())
+{}
+
 located_entity::located_entity(std::string const& type, vector const& pos)
-    : entity(type)
-    , pos_(pos)
+    : located_entity(located_archetype(), type, pos)
 {}
 
+located_entity::located_entity(archetype_base &archetype)
+    : entity()
+    , archetype_(&archetype)
+    , slot_(archetype.allocate(this))
+    , pos_(slot_.chunk->pos[slot_.index])
+    , published_pos_(slot_.chunk->published_pos[slot_.index])
+{
+    // The slot may have been used by a dead entity
+    pos_ = vector(0, 0);
+    published_pos_ = pos_;
+}
+
+located_entity::located_entity(archetype_base &archetype, std::string const& type, vector const& pos)
+    : entity(type)
+    , archetype_(&archetype)
+    , slot_(archetype.allocate(this))
+    , pos_(slot_.chunk->pos[slot_.index])
+    , published_pos_(slot_.chunk->published_pos[slot_.index])
+{
+    pos_ = pos;
+    published_pos_ = pos;
+}
+
+located_entity::~located_entity()
+{
+    if (index_ != nullptr)
+        index_->remove(*this);
+    archetype_->release(slot_);
+}
+
 nlohmann::json located_entity::save() const
 {
     return {
@@ -84,6 +163,7 @@ void located_entity::load(nlohmann::json const& j)
 
     entity::load(j["entity"]);
     pos_.load(j["pos"]);
+    published_pos_ = pos_;
 }
 
 void located_entity::build_state_order(nlohmann::json &j) const
@@ -92,9 +172,18 @@ void located_entity::build_state_order(nlohmann::json &j) const
     j["pos"] = pos_.save();
 }
 
+void located_entity::build_state_record(state_record &r) const
+{
+    entity::build_state_record(r);
+    r.pos = vec2f(pos_);
+}
+
 void located_entity::set_pos(vector const& pos)
 {
+    if (pos_ == pos)
+        return;
     pos_ = pos;
+    dirty_ = true;
 }
 
 vector const& located_entity::pos() const
@@ -102,6 +191,35 @@ vector const& located_entity::pos() const
     return pos_;
 }
 
+vector const& located_entity::published_pos() const
+{
+    return published_pos_;
+}
+
+void located_entity::publish()
+{
+    if (published_pos_ == pos_)
+        return;
+    published_pos_ = pos_;
+    if (index_ != nullptr)
+        index_->move(*this);
+}
+
+void located_entity::set_index(spatial_index *index)
+{
+    index_ = index;
+}
+
+spatial_index *located_entity::index() const
+{
+    return index_;
+}
+
+archetype_slot const& located_entity::slot() const
+{
+    return slot_;
+}
+
 #ifdef WEBGAME_TESTS
 bool located_entity::operator==(entity const& other) const
 {
@@ -125,14 +243,41 @@ bool located_entity::operator!=(entity const& other) const
 //-----------------------------------------------------------------------------
 // MOBILE_ENTITY
 
+mobile_entity::mobile_entity()
+    : located_entity(mobile_archetype())
+    , dir_(mobile_components(slot_).dir[slot_.index])
+    , speed_(mobile_components(slot_).speed[slot_.index])
+    , max_speed_(mobile_components(slot_).max_speed[slot_.index])
+{
+    dir_ = vector(0, 0);
+    speed_ = 0;
+    max_speed_ = 0;
+}
+
 mobile_entity::mobile_entity(std::string const& type, vector const& pos, vector const& dir, double speed, double max_speed)
-    : located_entity(type, pos)
-    , dir_(dir)
-    , speed_(speed)
-    , max_speed_(max_speed)
-{}
+    : located_entity(mobile_archetype(), type, pos)
+    , dir_(mobile_components(slot_).dir[slot_.index])
+    , speed_(mobile_components(slot_).speed[slot_.index])
+    , max_speed_(mobile_components(slot_).max_speed[slot_.index])
+{
+    dir_ = dir;
+    speed_ = speed;
+    max_speed_ = max_speed;
+}
 
-bool mobile_entity::update(double d, env & env)
+bool mobile_entity::update(double d, env const& env)
+{
+    bool has_changed = before_move(d, env);
+    has_changed = move(d) || has_changed;
+    return after_move(d, env) || has_changed;
+}
+
+bool mobile_entity::before_move(double, env const&)
+{
+    return false;
+}
+
+bool mobile_entity::move(double d)
 {
     vector prev_pos = pos_;
     vector prev_dir = dir_;
@@ -140,16 +285,24 @@ bool mobile_entity::update(double d, env & env)
     if (dir_.norm() > std::numeric_limits<double>::epsilon() && speed_ > std::numeric_limits<double>::epsilon())
     {
         dir_.normalize();
-        pos_ = pos_ + dir_ * speed_ * d;
+        set_pos(pos_ + dir_ * speed_ * d);
         assert(!std::isnan(dir_[0]));
         assert(!std::isnan(dir_[1]));
         assert(!std::isnan(pos_[0]));
         assert(!std::isnan(pos_[1]));
         assert(!std::isnan(speed_));
     }
+
+    if (prev_dir != dir_)
+        dirty_ = true;
     return prev_pos != pos_ || prev_dir != dir_;
 }
 
+bool mobile_entity::after_move(double, env const&)
+{
+    return false;
+}
+
 nlohmann::json mobile_entity::save() const
 {
     return {
@@ -181,19 +334,36 @@ void mobile_entity::build_state_order(nlohmann::json &j) const
     j["speed"] = speed_;
 }
 
+void mobile_entity::build_state_record(state_record &r) const
+{
+    located_entity::build_state_record(r);
+    r.dir = vec2f(dir_);
+    r.speed = static_cast<float>(speed_);
+}
+
 void mobile_entity::set_dir(vector const& dir)
 {
+    if (dir_ == dir)
+        return;
     dir_ = dir;
+    dirty_ = true;
 }
 
 void mobile_entity::set_speed(double speed)
 {
-    speed_ = std::max(std::min(speed, max_speed_), 0.);
+    speed = std::max(std::min(speed, max_speed_), 0.);
+    if (speed_ == speed)
+        return;
+    speed_ = speed;
+    dirty_ = true;
 }
 
 void mobile_entity::set_max_speed(double max_speed)
 {
+    if (max_speed_ == max_speed)
+        return;
     max_speed_ = max_speed;
+    dirty_ = true;
 }
 
 vector const& mobile_entity::dir() const
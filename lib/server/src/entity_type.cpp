@@ -0,0 +1,139 @@
+#include "entity_type.hpp"
+
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "lock.hpp"
+
+namespace webgame {
+
+namespace {
+
+struct type_entry
+{
+    std::string                 name;
+    entity_type::traits_type    traits;
+    entity_type::tag_type       faction;
+};
+
+struct type_registry
+{
+#ifndef WEBGAME_MONOTHREAD
+    std::mutex                                              mutex;
+#endif /* !WEBGAME_MONOTHREAD */
+    std::vector<type_entry>                                 entries;
+    std::unordered_map<std::string, entity_type::tag_type>  tags;
+
+    type_registry()
+    {
+        entries.push_back({ std::string(), 0, 0 });
+        tags.emplace(std::string(), 0);
+    }
+};
+
+// Never destroyed, entities may outlive static destruction
+type_registry &registry()
+{
+    static type_registry *instance = new type_registry();
+    return *instance;
+}
+
+entity_type::traits_type traits_of(std::string const& name)
+{
+    entity_type::traits_type traits = 0;
+    if (name == "player")
+        traits |= entity_type::player_trait;
+    if (name.find("object") != std::string::npos)
+        traits |= entity_type::object_trait;
+    return traits;
+}
+
+// The registry must be locked
+entity_type::tag_type intern(type_registry &r, std::string const& name, entity_type::traits_type traits, bool declared, entity_type::tag_type faction)
+{
+    auto it = r.tags.find(name);
+    if (it != r.tags.end())
+    {
+        type_entry const& entry = r.entries[it->second];
+        if (declared && (entry.traits != traits || entry.faction != faction))
+            throw std::runtime_error("entity_type: type " + name + " already in use with other traits");
+        return it->second;
+    }
+
+    if (r.entries.size() > 0xffff)
+        throw std::runtime_error("entity_type: too many entity types");
+
+    entity_type::tag_type const tag = static_cast<entity_type::tag_type>(r.entries.size());
+    r.entries.push_back({ name, traits, declared ? faction : tag });
+    r.tags.emplace(name, tag);
+    return tag;
+}
+
+} // namespace
+
+entity_type::entity_type()
+    : tag_(0)
+    , faction_(0)
+    , traits_(0)
+{}
+
+entity_type::entity_type(std::string const& name)
+{
+    type_registry &r = registry();
+    WEBGAME_LOCK(r.mutex);
+
+    tag_ = intern(r, name, traits_of(name), false, 0);
+    faction_ = r.entries[tag_].faction;
+    traits_ = r.entries[tag_].traits;
+}
+
+entity_type entity_type::declare(std::string const& name, traits_type traits, entity_type const& faction)
+{
+    {
+        type_registry &r = registry();
+        WEBGAME_LOCK(r.mutex);
+
+        intern(r, name, traits, true, faction.faction());
+    }
+    return entity_type(name);
+}
+
+entity_type entity_type::declare(std::string const& name, traits_type traits)
+{
+    {
+        type_registry &r = registry();
+        WEBGAME_LOCK(r.mutex);
+
+        // Its own faction
+        auto it = r.tags.find(name);
+        tag_type const faction = it != r.tags.end() ? it->second : static_cast<tag_type>(r.entries.size());
+        intern(r, name, traits, true, faction);
+    }
+    return entity_type(name);
+}
+
+size_t entity_type::count()
+{
+    type_registry &r = registry();
+    WEBGAME_LOCK(r.mutex);
+
+    return r.entries.size();
+}
+
+std::string entity_type::name_of(tag_type tag)
+{
+    type_registry &r = registry();
+    WEBGAME_LOCK(r.mutex);
+
+    if (tag >= r.entries.size())
+        throw std::out_of_range("entity_type: unknown tag " + std::to_string(tag));
+    return r.entries[tag].name;
+}
+
+std::string entity_type::name() const
+{
+    return name_of(tag_);
+}
+
+} // namespace webgame
@@ -1,14 +1,152 @@
 #include "env.hpp"
 
+#include <limits>
+
 namespace webgame {
 
-env::env(entities const & entities)
+//-----------------------------------------------------------------------------
+// CONST ITERATOR
+
+env::const_iterator::const_iterator(entities::const_iterator it, entities::const_iterator end, entity const* self)
+    : it_(it)
+    , end_(end)
+    , self_(self)
+{
+    skip_self();
+}
+
+env::const_iterator::reference env::const_iterator::operator*() const
+{
+    return *it_;
+}
+
+env::const_iterator::pointer env::const_iterator::operator->() const
+{
+    return &*it_;
+}
+
+env::const_iterator& env::const_iterator::operator++()
+{
+    ++it_;
+    skip_self();
+    return *this;
+}
+
+env::const_iterator env::const_iterator::operator++(int)
+{
+    const_iterator prev = *this;
+    ++*this;
+    return prev;
+}
+
+bool env::const_iterator::operator==(const_iterator const& other) const
+{
+    return it_ == other.it_;
+}
+
+bool env::const_iterator::operator!=(const_iterator const& other) const
+{
+    return !(*this == other);
+}
+
+void env::const_iterator::skip_self()
+{
+    if (it_ != end_ && it_->second.get() == self_)
+        ++it_;
+}
+
+//-----------------------------------------------------------------------------
+// ENV
+
+env::env(entities const& entities, entity const* self, spatial_index const* index)
     : entities_(entities)
+    , self_(self)
+    , index_(index)
 {}
 
-entities & env::others()
+env const& env::others() const
+{
+    return *this;
+}
+
+entity const* env::self() const
+{
+    return self_;
+}
+
+env::const_iterator env::begin() const
+{
+    return const_iterator(entities_.cbegin(), entities_.cend(), self_);
+}
+
+env::const_iterator env::end() const
+{
+    return const_iterator(entities_.cend(), entities_.cend(), self_);
+}
+
+bool env::empty() const
+{
+    return begin() == end();
+}
+
+size_t env::size() const
+{
+    if (self_ == nullptr)
+        return entities_.size();
+
+    auto it = entities_.find(self_->id());
+    if (it != entities_.cend() && it->second.get() == self_)
+        return entities_.size() - 1;
+    return entities_.size();
+}
+
+std::vector<located_entity const*> env::query_radius(vector const& center, double radius) const
+{
+    std::vector<located_entity const*> found;
+
+    if (index_ != nullptr)
+    {
+        for (located_entity const* ent : index_->query_radius(center, radius))
+            if (sees(*ent))
+                found.push_back(ent);
+        return found;
+    }
+
+    for (located_entity const& ent : entities_.view<located_entity>())
+        if (&ent != self_ && (ent.published_pos() - center).norm() <= radius)
+            found.push_back(&ent);
+    return found;
+}
+
+located_entity const* env::nearest(vector const& center, double radius, spatial_index::filter const& f) const
+{
+    if (index_ != nullptr)
+        return index_->nearest(center, radius, [this, &f](located_entity const& ent) {
+            return sees(ent) && (!f || f(ent));
+        });
+
+    located_entity const* closest = nullptr;
+    double closest_dist = std::numeric_limits<double>::max();
+    for (located_entity const& ent : entities_.view<located_entity>())
+    {
+        if (&ent == self_)
+            continue;
+        double dist = (ent.published_pos() - center).norm();
+        if (dist > radius || dist >= closest_dist || (f && !f(ent)))
+            continue;
+        closest = &ent;
+        closest_dist = dist;
+    }
+    return closest;
+}
+
+// The index may hold entities that are not part of this tick's view
+bool env::sees(located_entity const& ent) const
 {
-    return entities_;
+    if (&ent == self_)
+        return false;
+    auto it = entities_.find(ent.id());
+    return it != entities_.cend() && it->second.get() == &ent;
 }
 
 } // namespace webgame
@@ -0,0 +1,145 @@
+#include "id_allocator.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <stdexcept>
+
+namespace webgame {
+
+id_allocator::id_allocator()
+    : size_(0)
+{}
+
+id_t id_allocator::allocate()
+{
+    WEBGAME_LOCK(mutex_);
+
+    std::uint32_t index = static_cast<std::uint32_t>(slots_.size());
+    while (!free_.empty())
+    {
+        std::pop_heap(free_.begin(), free_.end(), std::greater<std::uint32_t>());
+        std::uint32_t const candidate = free_.back();
+        free_.pop_back();
+        if (is_free(slots_[candidate]))
+        {
+            index = candidate;
+            break;
+        }
+    }
+
+    if (index == slots_.size())
+    {
+        if (index > index_mask)
+            throw std::runtime_error("id_allocator: no more ids");
+        slots_.emplace_back();
+    }
+
+    slot &s = slots_[index];
+    s.users = 1;
+    ++size_;
+    return make_id(index, s.generation);
+}
+
+void id_allocator::claim(id_t id)
+{
+    WEBGAME_LOCK(mutex_);
+
+    slot &s = slot_of(index_of(id));
+    if (take(s, id))
+        ++s.users;
+}
+
+void id_allocator::release(id_t id)
+{
+    WEBGAME_LOCK(mutex_);
+
+    std::uint32_t const index = index_of(id);
+    if (index < slots_.size() && slots_[index].generation != generation_of(id) && outside_.count(id) != 0)
+        return;
+    assert(index < slots_.size() && slots_[index].generation == generation_of(id) && slots_[index].users > 0);
+
+    slot &s = slots_[index];
+    --s.users;
+    if (is_free(s))
+    {
+        s.generation = (s.generation + 1) & max_generation;
+        --size_;
+        push_free(index);
+    }
+}
+
+void id_allocator::pin(id_t id)
+{
+    WEBGAME_LOCK(mutex_);
+
+    slot &s = slot_of(index_of(id));
+    if (take(s, id))
+        s.pinned = true;
+}
+
+bool id_allocator::in_use(id_t id) const
+{
+    WEBGAME_LOCK(mutex_);
+
+    std::uint32_t const index = index_of(id);
+    return (index < slots_.size() && !is_free(slots_[index]) && slots_[index].generation == generation_of(id))
+        || outside_.count(id) != 0;
+}
+
+size_t id_allocator::size() const
+{
+    WEBGAME_LOCK(mutex_);
+
+    return size_;
+}
+
+id_allocator::slot &id_allocator::slot_of(std::uint32_t index)
+{
+    // The slots skipped to reach the index become free
+    if (index >= slots_.size())
+    {
+        std::uint32_t const old_size = static_cast<std::uint32_t>(slots_.size());
+        slots_.resize(index + 1);
+        for (std::uint32_t i = old_size; i < index; ++i)
+            push_free(i);
+    }
+    return slots_[index];
+}
+
+bool id_allocator::is_free(slot const& s) const
+{
+    return s.users == 0 && !s.pinned;
+}
+
+bool id_allocator::take(slot &s, id_t id)
+{
+    if (is_free(s))
+    {
+        s.generation = generation_of(id);
+        ++size_;
+        return true;
+    }
+    if (s.generation == generation_of(id))
+        return true;
+
+    // Pinned, the slot never reaches the generation of the id
+    s.pinned = true;
+    if (outside_.insert(id).second)
+        ++size_;
+    return false;
+}
+
+void id_allocator::push_free(std::uint32_t index)
+{
+    free_.push_back(index);
+    std::push_heap(free_.begin(), free_.end(), std::greater<std::uint32_t>());
+}
+
+id_allocator &entity_ids()
+{
+    static id_allocator *instance = new id_allocator();
+    return *instance;
+}
+
+} // namespace webgame
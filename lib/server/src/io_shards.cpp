@@ -0,0 +1,94 @@
+#include "io_shards.hpp"
+
+#include <algorithm>
+
+#ifdef __linux__
+# include <pthread.h>
+# include <sched.h>
+#endif /* __linux__ */
+
+#include "lock.hpp"
+#include "log.hpp"
+
+namespace webgame {
+
+namespace {
+
+// Shard i on core i, wrapping around if there are more shards than cores
+void pin_to_core(std::thread &t, size_t i)
+{
+#ifdef __linux__
+    unsigned int nb_cores = std::max(std::thread::hardware_concurrency(), 1u);
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(i % nb_cores, &cpus);
+    if (pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus) != 0)
+        WEBGAME_LOG("STARTUP", "COULD NOT PIN SHARD #" << i + 1 << " TO A CORE");
+#else
+    (void)t;
+    (void)i;
+#endif /* __linux__ */
+}
+
+} // namespace
+
+io_shards::io_shards(unsigned int nb_shards)
+{
+    nb_shards = std::max(nb_shards, 1u);
+    for (unsigned int i = 0; i < nb_shards; ++i)
+    {
+        // Run by a single thread, which lets asio spare some locking
+        contexts_.emplace_back(new boost::asio::io_context(1));
+        guards_.emplace_back(boost::asio::make_work_guard(*contexts_.back()));
+    }
+}
+
+io_shards::~io_shards()
+{
+    for (auto &context : contexts_)
+        context->stop();
+    for (std::thread &t : threads_)
+        if (t.joinable())
+            t.join();
+}
+
+size_t io_shards::size() const
+{
+    return contexts_.size();
+}
+
+boost::asio::io_context & io_shards::operator[](size_t i)
+{
+    return *contexts_[i];
+}
+
+void io_shards::run()
+{
+    for (size_t i = 0; i < contexts_.size(); ++i)
+    {
+        boost::asio::io_context &context = *contexts_[i];
+        threads_.emplace_back([&context, i] {
+            WEBGAME_LOG("STARTUP", "SHARD #" << i + 1 << " RUNNING");
+            try {
+                context.run();
+            }
+            catch (std::exception const& e) {
+                _WEBGAME_MY_LOG("EXCEPTION THROWN: " << e.what());
+            }
+            WEBGAME_LOG("STARTUP", "SHARD #" << i + 1 << " STOPPED");
+        });
+        pin_to_core(threads_.back(), i);
+    }
+}
+
+void io_shards::join()
+{
+    for (work_guard &guard : guards_)
+        guard.reset();
+    for (std::thread &t : threads_)
+        if (t.joinable())
+            t.join();
+}
+
+} // namespace webgame
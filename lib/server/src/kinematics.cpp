@@ -0,0 +1,229 @@
+#include "kinematics.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+# define WEBGAME_KINEMATICS_X86
+# include <immintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+#  define WEBGAME_TARGET_SSE2
+#  define WEBGAME_TARGET_AVX2
+# else /* _MSC_VER */
+#  define WEBGAME_TARGET_SSE2 __attribute__((target("sse2")))
+#  define WEBGAME_TARGET_AVX2 __attribute__((target("avx2")))
+# endif /* _MSC_VER */
+#endif /* x86 */
+
+namespace webgame {
+
+// The kernels see the x and y of consecutive entities as one array of doubles
+static_assert(sizeof(vector) == 2 * sizeof(double), "vector must be two packed doubles");
+
+namespace {
+
+double const epsilon = std::numeric_limits<double>::epsilon();
+
+double *xy(vector &v)
+{
+    return &v[0];
+}
+
+//-----------------------------------------------------------------------------
+// SCALAR
+
+// Same operations in the same order as mobile_entity::move()
+slot_mask integrate_scalar(mobile_chunk &chunk, double d, slot_mask const& active)
+{
+    slot_mask changed;
+    for (std::uint32_t i = 0; i < chunk.size; ++i)
+    {
+        if (!active[i])
+            continue;
+
+        double *pos = xy(chunk.pos[i]);
+        double *dir = xy(chunk.dir[i]);
+        double const speed = chunk.speed[i];
+
+        double const norm = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1]);
+        if (norm > epsilon && speed > epsilon)
+        {
+            double const new_dir[2] = { dir[0] / norm, dir[1] / norm };
+            double const new_pos[2] = { pos[0] + new_dir[0] * speed * d, pos[1] + new_dir[1] * speed * d };
+            if (new_pos[0] != pos[0] || new_pos[1] != pos[1] || new_dir[0] != dir[0] || new_dir[1] != dir[1])
+                changed.set(i);
+            dir[0] = new_dir[0];
+            dir[1] = new_dir[1];
+            pos[0] = new_pos[0];
+            pos[1] = new_pos[1];
+        }
+        // As for vector::operator!=, a NaN is always a change
+        else if (pos[0] != pos[0] || pos[1] != pos[1] || dir[0] != dir[0] || dir[1] != dir[1])
+            changed.set(i);
+    }
+    return changed;
+}
+
+#ifdef WEBGAME_KINEMATICS_X86
+
+//-----------------------------------------------------------------------------
+// SSE2
+
+// One entity at a time, its x and y side by side
+WEBGAME_TARGET_SSE2
+slot_mask integrate_sse2(mobile_chunk &chunk, double d, slot_mask const& active)
+{
+    slot_mask changed;
+    __m128d const d_v = _mm_set1_pd(d);
+    for (std::uint32_t i = 0; i < chunk.size; ++i)
+    {
+        if (!active[i])
+            continue;
+
+        double *pos_p = xy(chunk.pos[i]);
+        double *dir_p = xy(chunk.dir[i]);
+        double const speed = chunk.speed[i];
+
+        __m128d const pos = _mm_loadu_pd(pos_p);
+        __m128d const dir = _mm_loadu_pd(dir_p);
+        __m128d const squares = _mm_mul_pd(dir, dir);
+        __m128d const norm = _mm_sqrt_pd(_mm_add_pd(squares, _mm_shuffle_pd(squares, squares, 1)));
+
+        if (_mm_cvtsd_f64(norm) > epsilon && speed > epsilon)
+        {
+            __m128d const new_dir = _mm_div_pd(dir, norm);
+            __m128d const new_pos = _mm_add_pd(pos, _mm_mul_pd(_mm_mul_pd(new_dir, _mm_set1_pd(speed)), d_v));
+            __m128d const diff = _mm_or_pd(_mm_cmpneq_pd(new_pos, pos), _mm_cmpneq_pd(new_dir, dir));
+            if (_mm_movemask_pd(diff) != 0)
+                changed.set(i);
+            _mm_storeu_pd(dir_p, new_dir);
+            _mm_storeu_pd(pos_p, new_pos);
+        }
+        else if (_mm_movemask_pd(_mm_or_pd(_mm_cmpneq_pd(pos, pos), _mm_cmpneq_pd(dir, dir))) != 0)
+            changed.set(i);
+    }
+    return changed;
+}
+
+//-----------------------------------------------------------------------------
+// AVX2
+
+// Two entities at a time. Inactive slots are masked out of loads and stores.
+WEBGAME_TARGET_AVX2
+slot_mask integrate_avx2(mobile_chunk &chunk, double d, slot_mask const& active)
+{
+    slot_mask changed;
+    __m256d const d_v = _mm256_set1_pd(d);
+    __m256d const epsilon_v = _mm256_set1_pd(epsilon);
+    for (std::uint32_t i = 0; i < chunk.size; i += 2)
+    {
+        std::int64_t const active0 = active[i] ? -1 : 0;
+        std::int64_t const active1 = active[i + 1] ? -1 : 0;
+        if (active0 == 0 && active1 == 0)
+            continue;
+
+        __m256i const lanes = _mm256_set_epi64x(active1, active1, active0, active0);
+        double *pos_p = xy(chunk.pos[i]);
+        double *dir_p = xy(chunk.dir[i]);
+
+        __m256d const pos = _mm256_maskload_pd(pos_p, lanes);
+        __m256d const dir = _mm256_maskload_pd(dir_p, lanes);
+        // (s0, s1) to (s0, s0, s1, s1)
+        __m128d const speeds = _mm_maskload_pd(&chunk.speed[i], _mm_set_epi64x(active1, active0));
+        __m256d const speed = _mm256_permute4x64_pd(_mm256_castpd128_pd256(speeds), _MM_SHUFFLE(1, 1, 0, 0));
+
+        __m256d const squares = _mm256_mul_pd(dir, dir);
+        __m256d const norm = _mm256_sqrt_pd(_mm256_add_pd(squares, _mm256_permute_pd(squares, 0x5)));
+        __m256d const moving = _mm256_and_pd(_mm256_cmp_pd(norm, epsilon_v, _CMP_GT_OQ), _mm256_cmp_pd(speed, epsilon_v, _CMP_GT_OQ));
+
+        __m256d const new_dir = _mm256_blendv_pd(dir, _mm256_div_pd(dir, norm), moving);
+        __m256d const new_pos = _mm256_blendv_pd(pos, _mm256_add_pd(pos, _mm256_mul_pd(_mm256_mul_pd(new_dir, speed), d_v)), moving);
+        __m256d const diff = _mm256_or_pd(_mm256_cmp_pd(new_pos, pos, _CMP_NEQ_UQ), _mm256_cmp_pd(new_dir, dir, _CMP_NEQ_UQ));
+        int const bits = _mm256_movemask_pd(diff) & _mm256_movemask_pd(_mm256_castsi256_pd(lanes));
+        if (bits & 0x3)
+            changed.set(i);
+        if (bits & 0xc)
+            changed.set(i + 1);
+
+        _mm256_maskstore_pd(dir_p, lanes, new_dir);
+        _mm256_maskstore_pd(pos_p, lanes, new_pos);
+    }
+    return changed;
+}
+
+bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return false;
+    __cpuid(regs, 1);
+    bool const osxsave = (regs[2] & (1 << 27)) != 0;
+    bool const avx = (regs[2] & (1 << 28)) != 0;
+    // The OS must save the ymm registers
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else /* _MSC_VER */
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif /* _MSC_VER */
+}
+
+#endif /* WEBGAME_KINEMATICS_X86 */
+
+} // namespace
+
+simd_level detected_simd_level()
+{
+#ifdef WEBGAME_KINEMATICS_X86
+    static simd_level const level = cpu_has_avx2() ? simd_level::avx2 : simd_level::sse2;
+    return level;
+#else /* WEBGAME_KINEMATICS_X86 */
+    return simd_level::scalar;
+#endif /* WEBGAME_KINEMATICS_X86 */
+}
+
+char const* simd_level_name(simd_level level)
+{
+    switch (level)
+    {
+    case simd_level::scalar:
+        return "scalar";
+    case simd_level::sse2:
+        return "sse2";
+    case simd_level::avx2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+slot_mask integrate(mobile_chunk &chunk, double d, slot_mask const& active, simd_level level)
+{
+#ifdef WEBGAME_KINEMATICS_X86
+    // A level the CPU does not support falls back to the detected one
+    if (level > detected_simd_level())
+        level = detected_simd_level();
+    switch (level)
+    {
+    case simd_level::avx2:
+        return integrate_avx2(chunk, d, active);
+    case simd_level::sse2:
+        return integrate_sse2(chunk, d, active);
+    case simd_level::scalar:
+        break;
+    }
+#endif /* WEBGAME_KINEMATICS_X86 */
+    return integrate_scalar(chunk, d, active);
+}
+
+slot_mask integrate(mobile_chunk &chunk, double d, slot_mask const& active)
+{
+    return integrate(chunk, d, active, detected_simd_level());
+}
+
+} // namespace webgame
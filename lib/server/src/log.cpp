@@ -1,14 +1,335 @@
 #include "log.hpp"
 
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "mpsc_queue.hpp"
+
 namespace webgame {
 
 bool io_log = false;
 bool data_log = false;
 
-#ifndef WEBGAME_MONOTHREAD
-std::recursive_mutex log_mutex;
-#endif /* !WEBGAME_MONOTHREAD */
 unsigned int title_max_size = 50;
 std::ostream *log_stream = &std::cout;
 
+namespace {
+
+// Lines a thread can log before the writer catches up, the next ones are dropped
+size_t const ring_capacity = 1024;
+// The writer sleeps at most this long with lines waiting
+auto const writer_period = std::chrono::milliseconds(50);
+
+// Appends what is streamed to a string
+class string_buffer : public std::streambuf
+{
+private:
+    std::string &text_;
+
+public:
+    explicit string_buffer(std::string &text)
+        : text_(text)
+    {}
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+            text_ += traits_type::to_char_type(c);
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(char const* s, std::streamsize n) override
+    {
+        text_.append(s, static_cast<size_t>(n));
+        return n;
+    }
+};
+
+// Where a line is formatted, its capacity is kept from one line to the next
+struct line_buffer
+{
+    std::string     text;
+    string_buffer   buffer;
+    std::ostream    stream;
+
+    line_buffer()
+        : buffer(text)
+        , stream(&buffer)
+    {
+        stream.flags(log_stream->flags());
+    }
+};
+
+#ifndef WEBGAME_MONOTHREAD
+// The lines of a thread. The string copies in and out of the ring reuse the
+// capacity of its cells.
+struct log_ring
+{
+    mpsc_queue<std::string> lines;
+    std::atomic<size_t>     dropped;
+    // Its thread exited, the writer forgets it once it is drained
+    std::atomic<bool>       orphan;
+
+    log_ring()
+        : lines(ring_capacity)
+        , dropped(0)
+        , orphan(false)
+    {}
+};
+
+class log_writer
+{
+    WEBGAME_NON_MOVABLE_OR_COPYABLE(log_writer);
+
+private:
+    // Only locked when a thread logs for the first time, by the drains and
+    // when the stream changes
+    std::mutex                              rings_mutex_;
+    std::vector<std::shared_ptr<log_ring>>  rings_;
+    std::mutex                              wake_mutex_;
+    std::condition_variable                 wake_;
+    std::atomic<bool>                       sleeping_;
+
+public:
+    log_writer()
+        : sleeping_(false)
+    {
+        std::thread(&log_writer::run, this).detach();
+        std::atexit(flush_log);
+    }
+
+public:
+    void add(std::shared_ptr<log_ring> const& ring)
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(ring);
+    }
+
+    std::ostream * set_stream(std::ostream *stream)
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        std::ostream *previous = log_stream;
+        log_stream = stream;
+        return previous;
+    }
+
+    // A wake up missed here only delays the lines by writer_period
+    void wake()
+    {
+        if (sleeping_.load(std::memory_order_relaxed))
+            wake_.notify_one();
+    }
+
+    // Returns true if something was written
+    bool drain()
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+
+        std::ostream &out = *log_stream;
+        bool written = false;
+        for (auto it = rings_.begin(); it != rings_.end();)
+        {
+            log_ring &ring = **it;
+            // Before the drain, so that the last lines of its thread are written
+            bool const orphan = ring.orphan.load(std::memory_order_acquire);
+
+            size_t const nb_lines = ring.lines.drain([&out](std::string const& line) {
+                out << line << '\n';
+            });
+            size_t const nb_dropped = ring.dropped.exchange(0);
+            if (nb_dropped != 0)
+                out << "[LOG] " << nb_dropped << " LINE" << (nb_dropped > 1 ? "S" : "") << " DROPPED, THE WRITER DID NOT KEEP UP\n";
+            written = written || nb_lines != 0 || nb_dropped != 0;
+
+            if (orphan && nb_lines == 0)
+                it = rings_.erase(it);
+            else
+                ++it;
+        }
+
+        if (written)
+            out.flush();
+        return written;
+    }
+
+private:
+    void run()
+    {
+        for (;;)
+        {
+            if (drain())
+                continue;
+
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            sleeping_.store(true, std::memory_order_relaxed);
+            wake_.wait_for(lock, writer_period);
+            sleeping_.store(false, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Leaked, the detached writer thread may outlive static destructors
+log_writer & writer()
+{
+    static log_writer *w = new log_writer;
+    return *w;
+}
+#endif /* !WEBGAME_MONOTHREAD */
+
+// Buffers of the current thread, one per line being formatted: the
+// expression of a line may log too
+struct thread_log
+{
+    std::string                                 thread_id;
+    std::vector<std::unique_ptr<line_buffer>>   buffers;
+    size_t                                      depth;
+#ifndef WEBGAME_MONOTHREAD
+    std::shared_ptr<log_ring>                   ring;
+#endif /* !WEBGAME_MONOTHREAD */
+
+    thread_log()
+        : depth(0)
+#ifndef WEBGAME_MONOTHREAD
+        , ring(std::make_shared<log_ring>())
+#endif /* !WEBGAME_MONOTHREAD */
+    {
+        std::ostringstream id;
+        id << "[" << std::setw(5) << std::this_thread::get_id() << "] ";
+        thread_id = id.str();
+
+#ifndef WEBGAME_MONOTHREAD
+        writer().add(ring);
+#endif /* !WEBGAME_MONOTHREAD */
+    }
+
+    ~thread_log()
+    {
+#ifndef WEBGAME_MONOTHREAD
+        ring->orphan.store(true, std::memory_order_release);
+#endif /* !WEBGAME_MONOTHREAD */
+    }
+
+    line_buffer & push()
+    {
+        if (depth == buffers.size())
+            buffers.emplace_back(new line_buffer);
+        line_buffer &line = *buffers[depth++];
+        line.text.clear();
+        return line;
+    }
+
+    void pop()
+    {
+        line_buffer &line = *buffers[--depth];
+#ifndef WEBGAME_MONOTHREAD
+        if (ring->lines.push(line.text))
+            writer().wake();
+        else
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+#else /* !WEBGAME_MONOTHREAD */
+        *log_stream << line.text << std::endl;
+#endif /* !WEBGAME_MONOTHREAD */
+    }
+};
+
+thread_log & this_thread_log()
+{
+    thread_local thread_log log;
+    return log;
+}
+
+} // namespace
+
+//---------------------------------------------------------------------------------------------------------------------
+
+log_line::log_line()
+    : stream_(this_thread_log().push().stream)
+{}
+
+log_line::log_line(char const* title)
+    : log_line()
+{
+    write_title(title, std::char_traits<char>::length(title));
+}
+
+log_line::log_line(std::string const& title)
+    : log_line()
+{
+    write_title(title.data(), title.size());
+}
+
+log_line::~log_line()
+{
+    this_thread_log().pop();
+}
+
+std::ostream & log_line::stream()
+{
+    return stream_;
+}
+
+// As std::setw would, right aligned
+void log_line::write_title(char const* title, size_t size)
+{
+    thread_log &log = this_thread_log();
+    std::string &text = log.buffers[log.depth - 1]->text;
+
+    text += log.thread_id;
+    text += '[';
+    if (size < title_max_size)
+        text.append(title_max_size - size, ' ');
+    text.append(title, size);
+    text += "] ";
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool log_limiter::allow(size_t &suppressed)
+{
+    std::chrono::steady_clock::rep const now = std::chrono::steady_clock::now().time_since_epoch().count();
+    std::chrono::steady_clock::rep next = next_.load(std::memory_order_relaxed);
+
+    // Another thread may let its line through meanwhile
+    if (now < next || !next_.compare_exchange_strong(next, now + interval_.count(), std::memory_order_relaxed))
+    {
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void flush_log()
+{
+#ifndef WEBGAME_MONOTHREAD
+    // A drain takes up to a whole ring from each thread
+    writer().drain();
+#else /* !WEBGAME_MONOTHREAD */
+    log_stream->flush();
+#endif /* !WEBGAME_MONOTHREAD */
+}
+
+std::ostream * set_log_stream(std::ostream *stream)
+{
+#ifndef WEBGAME_MONOTHREAD
+    // The writer uses the stream while it holds the lock of the rings
+    return writer().set_stream(stream);
+#else /* !WEBGAME_MONOTHREAD */
+    std::ostream *previous = log_stream;
+    log_stream = stream;
+    return previous;
+#endif /* !WEBGAME_MONOTHREAD */
+}
+
 } // namespace webgame
@@ -11,16 +11,14 @@ npc::npc(std::string const& type, vector const& pos, vector const& dir, double s
     init_behaviors();
 }
 
-bool npc::update(double d, env & env)
+bool npc::before_move(double d, env const& env)
 {
     vector prev_pos = pos_;
     vector prev_dir = dir_;
     double prev_speed = speed_;
 
     treatbehaviors(d, env);
-    bool has_changed = prev_pos != pos_ || prev_dir != dir_ || prev_speed != speed_;
-
-    return mobile_entity::update(d, env) || has_changed;
+    return prev_pos != pos_ || prev_dir != dir_ || prev_speed != speed_;
 }
 
 nlohmann::json npc::save() const
@@ -58,7 +56,7 @@ void npc::init_behaviors()
         p.second->set_self(this);
 }
 
-void npc::treatbehaviors(double d, env & env)
+void npc::treatbehaviors(double d, env const& env)
 {
     if (behaviors_.empty())
         return;
@@ -0,0 +1,282 @@
+#include "order_parser.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace webgame {
+
+namespace {
+
+// Longer numbers go through the complete parse
+size_t const max_number_size = 32;
+
+// Members of an order, as bits of a mask
+enum order_member : unsigned int
+{
+    member_order        = 1 << 0,
+    member_suborder     = 1 << 1,
+    member_player_name  = 1 << 2,
+    member_speed        = 1 << 3,
+    member_dir          = 1 << 4,
+    member_target_pos   = 1 << 5
+};
+
+template<size_t N>
+bool is(char const* s, size_t size, char const (&literal)[N])
+{
+    return size == N - 1 && std::memcmp(s, literal, N - 1) == 0;
+}
+
+bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Reads JSON tokens in place. Every read skips the whitespaces before the token.
+class scanner
+{
+private:
+    char const* it_;
+    char const* end_;
+
+public:
+    scanner(char const* data, size_t size)
+        : it_(data)
+        , end_(data + size)
+    {}
+
+public:
+    bool at_end()
+    {
+        skip_spaces();
+        return it_ == end_;
+    }
+
+    // Consumes c if it comes next
+    bool next_is(char c)
+    {
+        skip_spaces();
+        if (it_ == end_ || *it_ != c)
+            return false;
+        ++it_;
+        return true;
+    }
+
+    // Without its quotes. Strings with escapes are left to the complete parse.
+    bool string(char const*& s, size_t &size)
+    {
+        if (!next_is('"'))
+            return false;
+
+        char const* start = it_;
+        for (; it_ != end_ && *it_ != '"'; ++it_)
+            if (*it_ == '\\' || static_cast<unsigned char>(*it_) < 0x20)
+                return false;
+        if (it_ == end_)
+            return false;
+
+        s = start;
+        size = static_cast<size_t>(it_ - start);
+        ++it_;
+        return true;
+    }
+
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    bool number(double &v)
+    {
+        skip_spaces();
+        char const* start = it_;
+
+        if (it_ != end_ && *it_ == '-')
+            ++it_;
+        if (it_ != end_ && *it_ == '0')
+            ++it_;
+        else if (!digits())
+            return false;
+        if (it_ != end_ && *it_ == '.')
+        {
+            ++it_;
+            if (!digits())
+                return false;
+        }
+        if (it_ != end_ && (*it_ == 'e' || *it_ == 'E'))
+        {
+            ++it_;
+            if (it_ != end_ && (*it_ == '+' || *it_ == '-'))
+                ++it_;
+            if (!digits())
+                return false;
+        }
+
+        // strtod needs a terminated string
+        size_t const size = static_cast<size_t>(it_ - start);
+        if (size > max_number_size)
+            return false;
+        char buffer[max_number_size + 1];
+        std::memcpy(buffer, start, size);
+        buffer[size] = '\0';
+        v = std::strtod(buffer, nullptr);
+        // Out of the range of a double, the complete parse reports it
+        return std::isfinite(v);
+    }
+
+    // {"x": ..., "y": ...}, in any order
+    bool point(vector &v)
+    {
+        if (!next_is('{'))
+            return false;
+
+        bool has_x = false;
+        bool has_y = false;
+        do {
+            char const* key;
+            size_t key_size;
+            if (!string(key, key_size) || !next_is(':'))
+                return false;
+            if (is(key, key_size, "x") && !has_x)
+                has_x = number(v[0]);
+            else if (is(key, key_size, "y") && !has_y)
+                has_y = number(v[1]);
+            else
+                return false;
+        } while (next_is(','));
+
+        return has_x && has_y && next_is('}');
+    }
+
+private:
+    void skip_spaces()
+    {
+        while (it_ != end_ && (*it_ == ' ' || *it_ == '\t' || *it_ == '\n' || *it_ == '\r'))
+            ++it_;
+    }
+
+    // At least one
+    bool digits()
+    {
+        char const* start = it_;
+        while (it_ != end_ && is_digit(*it_))
+            ++it_;
+        return it_ != start;
+    }
+};
+
+} // namespace
+
+bool parse_client_order(char const* data, size_t size, client_order &order)
+{
+    scanner s(data, size);
+
+    char const* order_name = nullptr;
+    size_t order_name_size = 0;
+    char const* suborder = nullptr;
+    size_t suborder_size = 0;
+    unsigned int members = 0;
+
+    if (!s.next_is('{'))
+        return false;
+    do {
+        char const* key;
+        size_t key_size;
+        if (!s.string(key, key_size) || !s.next_is(':'))
+            return false;
+
+        unsigned int member;
+        bool read;
+        if (is(key, key_size, "order"))
+        {
+            member = member_order;
+            read = s.string(order_name, order_name_size);
+        }
+        else if (is(key, key_size, "suborder"))
+        {
+            member = member_suborder;
+            read = s.string(suborder, suborder_size);
+        }
+        else if (is(key, key_size, "player_name"))
+        {
+            member = member_player_name;
+            read = s.string(order.player_name, order.player_name_size);
+        }
+        else if (is(key, key_size, "speed"))
+        {
+            member = member_speed;
+            read = s.number(order.speed);
+        }
+        else if (is(key, key_size, "dir"))
+        {
+            member = member_dir;
+            read = s.point(order.vec);
+        }
+        else if (is(key, key_size, "target_pos"))
+        {
+            member = member_target_pos;
+            read = s.point(order.vec);
+        }
+        else
+            return false;
+
+        if (!read || (members & member) != 0)
+            return false;
+        members |= member;
+    } while (s.next_is(','));
+    if (!s.next_is('}') || !s.at_end())
+        return false;
+
+    if (members == (member_order | member_player_name) && is(order_name, order_name_size, "authentication"))
+        order.kind = client_order::authentication;
+    else if (members & member_order && is(order_name, order_name_size, "action") && members & member_suborder)
+    {
+        if (members == (member_order | member_suborder | member_speed) && is(suborder, suborder_size, "change_speed"))
+            order.kind = client_order::change_speed;
+        else if (members == (member_order | member_suborder | member_dir) && is(suborder, suborder_size, "change_dir"))
+            order.kind = client_order::change_dir;
+        else if (members == (member_order | member_suborder | member_target_pos) && is(suborder, suborder_size, "move_to"))
+            order.kind = client_order::move_to;
+        else
+            return false;
+    }
+    else
+        return false;
+
+    return true;
+}
+
+void parse_client_order(nlohmann::json const& j, client_order &order, std::string &player_name)
+{
+    std::string order_name = j.at("order");
+    if (order_name == "authentication")
+    {
+        player_name = j.at("player_name").get<std::string>();
+        order.kind = client_order::authentication;
+        order.player_name = player_name.data();
+        order.player_name_size = player_name.size();
+    }
+    else if (order_name == "action")
+    {
+        std::string suborder = j.at("suborder");
+        if (suborder == "change_speed")
+        {
+            order.kind = client_order::change_speed;
+            order.speed = j.at("speed").get<double>();
+        }
+        else if (suborder == "change_dir")
+        {
+            order.kind = client_order::change_dir;
+            order.vec = vector(j.at("dir").at("x").get<double>(), j.at("dir").at("y").get<double>());
+        }
+        else if (suborder == "move_to")
+        {
+            order.kind = client_order::move_to;
+            order.vec = vector(j.at("target_pos").at("x").get<double>(), j.at("target_pos").at("y").get<double>());
+        }
+        else
+            throw std::runtime_error("UNKNOWN ACTION: " + suborder);
+    }
+    else
+        throw std::runtime_error("UNKNOWN ORDER: " + order_name);
+}
+
+} // namespace webgame
@@ -1,8 +1,5 @@
 #include "player.hpp"
 
-#include <boost/geometry/arithmetic/dot_product.hpp>
-#include <boost/geometry/geometries/point_xy.hpp>
-
 #include "save_load.hpp"
 
 namespace webgame {
@@ -12,28 +9,29 @@ player::player()
     , moving_to_(false)
 {}
 
-bool player::update(double d, env & env)
+bool player::after_move(double d, env const& env)
 {
-    bool has_changed = mobile_entity::update(d, env);
     if (moving_to_)
     {
         if (speed_ != 0)
         {
-            vector to_vec = target_pos_ - pos_;
-            boost::geometry::model::d2::point_xy<double> geo_to_vec(to_vec.x(), to_vec.y());
-            boost::geometry::model::d2::point_xy<double> geo_dir(dir_.x(), dir_.y());
-            if (pos_ == target_pos_ || boost::geometry::dot_product(geo_to_vec, geo_dir) < 0)
+            // Past the target once it is behind
+            if (pos_ == target_pos_ || dot(target_pos_ - pos_, dir_) < 0)
             {
                 speed_ = 0;
-                pos_ = target_pos_;
+                set_pos(target_pos_);
                 moving_to_ = false;
+                dirty_ = true;
                 return true;
             }
         }
         else
+        {
             moving_to_ = false;
+            dirty_ = true;
+        }
     }
-    return has_changed;
+    return false;
 }
 
 nlohmann::json player::save() const
@@ -64,11 +62,15 @@ void player::move_to(vector const& target_pos)
     target_pos_ = target_pos;
     dir_ = target_pos_ - pos_;
     moving_to_ = true;
+    dirty_ = true;
 }
 
 void player::stop()
 {
+    if (!moving_to_)
+        return;
     moving_to_ = false;
+    dirty_ = true;
 }
 
 bool player::is_moving_to() const
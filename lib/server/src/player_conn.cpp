@@ -1,13 +1,17 @@
 #include "player_conn.hpp"
 
+#include <cmath>
+
 #include <boost/asio/bind_executor.hpp>
-#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/beast/http/read.hpp>
 
 #include <nlohmann/json.hpp>
 
-#include "any.hpp"
+#include "binary.hpp"
+#include "entity_type.hpp"
 #include "lock.hpp"
 #include "log.hpp"
+#include "order_parser.hpp"
 #include "player.hpp"
 #include "protocol.hpp"
 #include "server.hpp"
@@ -16,9 +20,81 @@
 
 namespace asio = boost::asio;
 namespace beast = boost::beast;
+namespace http = boost::beast::http;
 
 namespace webgame {
 
+namespace {
+
+// Commands a client can send within a tick
+size_t const command_queue_capacity = 128;
+
+// Beyond these, the connection is congested and skips ticks
+size_t const high_water_messages = 64;
+size_t const high_water_bytes = 256 * 1024;
+// A connection congested for that long is dropped
+std::chrono::steady_clock::duration const max_congestion = std::chrono::seconds(10);
+
+size_t const npos = static_cast<size_t>(-1);
+
+// NaN or infinite, a value would end in the position of the player
+double read_finite(binary_reader &r)
+{
+    double const v = r.f32();
+    if (!std::isfinite(v))
+        throw std::runtime_error("INVALID VALUE");
+    return v;
+}
+
+// Sec-WebSocket-Protocol holds a comma separated list of the subprotocols the client supports
+bool offers_subprotocol(beast::string_view offered, beast::string_view wanted)
+{
+    while (!offered.empty())
+    {
+        size_t end = offered.find(',');
+        beast::string_view token = offered.substr(0, end);
+        while (!token.empty() && token.front() == ' ')
+            token.remove_prefix(1);
+        while (!token.empty() && token.back() == ' ')
+            token.remove_suffix(1);
+        if (token == wanted)
+            return true;
+        if (end == beast::string_view::npos)
+            break;
+        offered.remove_prefix(end + 1);
+    }
+    return false;
+}
+
+// Only the Boost versions from 1.75 have a minimum size to compress
+template<class Options>
+auto set_min_size(Options &options, size_t min_size, int) -> decltype(options.msg_size_threshold = min_size, void())
+{
+    options.msg_size_threshold = min_size;
+}
+
+template<class Options>
+void set_min_size(Options &, size_t, long)
+{}
+
+beast::websocket::permessage_deflate deflate_options(compression_options const& compression)
+{
+    beast::websocket::permessage_deflate options;
+    options.server_enable = compression.enabled;
+    // The window bits and the context takeover go both ways, for what the
+    // server keeps to inflate as well
+    options.server_max_window_bits = compression.window_bits;
+    options.client_max_window_bits = compression.window_bits;
+    options.server_no_context_takeover = !compression.context_takeover;
+    options.client_no_context_takeover = !compression.context_takeover;
+    options.compLevel = compression.level;
+    options.memLevel = compression.mem_level;
+    set_min_size(options, compression.min_size, 0);
+    return options;
+}
+
+} // namespace
+
 class entity;
 
 std::vector<std::string> const player_conn::state_str = {
@@ -35,43 +111,73 @@ std::vector<std::string> const player_conn::state_str = {
 };
 
 #define CONN_LOG(to_log) WEBGAME_LOG(addr_str, to_log)
-
-player_conn::patch::patch(std::string &&w, any &&v)
-    : what(std::move(w))
-    , value(std::move(v))
-{}
+#define CONN_DEBUG(to_log) WEBGAME_DEBUG(addr_str, to_log)
 
 player_conn::player_conn(asio::ip::tcp::socket &&socket, std::shared_ptr<server> const& server)
     : addr_str(socket.remote_endpoint().address().to_string() + ":" + std::to_string(socket.remote_endpoint().port()))
     , socket_(std::move(socket))
     , strand_(socket_.get_executor())
     , state_(none)
+    , format_(wire_format::json)
+    , outbox_latest_(npos)
+    , latest_pos_(npos)
+    , queued_messages_(0)
+    , queued_bytes_(0)
+    , superseded_(0)
+    , skipped_ticks_(0)
+    , superseded_seen_(0)
+    , congested_(false)
+    , aborting_(false)
+    , commands_(command_queue_capacity)
     , close_code_(beast::websocket::close_code::none)
     , server_(server)
     , close_timer_(socket_.get_executor().context())
+    , view_radius_(server->view_radius())
+    , known_types_(0)
 {
     state_ = ready;
     socket_.auto_fragment(true);
+    socket_.set_option(deflate_options(server->compression()));
 
     CONN_LOG("CONNECTED");
 }
 
 void player_conn::start()
 {
-    WEBGAME_LOCK(handlers_mutex_);
-
-    socket_.async_accept(asio::bind_executor(strand_, std::bind(&player_conn::on_accept, shared_from_this(), std::placeholders::_1)));
+    // The upgrade request is read first to know which subprotocol the client wants
+    http::async_read(socket_.next_layer(), handshake_buffer_, handshake_request_, asio::bind_executor(strand_, std::bind(&player_conn::on_handshake_request, shared_from_this(), std::placeholders::_1)));
     state_ = handshaking;
 }
 
 void player_conn::write(std::shared_ptr<std::string const> msg)
 {
-    WEBGAME_LOCK(handlers_mutex_);
+    outbox_.emplace_back(std::move(msg));
+}
 
-    to_write_.emplace_back(msg);
+void player_conn::write_latest(std::shared_ptr<std::string const> msg)
+{
+    if (outbox_latest_ == npos)
+    {
+        outbox_latest_ = outbox_.size();
+        write(std::move(msg));
+        return;
+    }
 
-    if (to_write_.size() == 1)
-        asio::post(socket_.get_executor(), asio::bind_executor(strand_, std::bind(&player_conn::write_next, shared_from_this())));
+    // Not posted yet, the older one is never sent
+    outbox_[outbox_latest_] = std::move(msg);
+    ++superseded_;
+}
+
+void player_conn::flush()
+{
+    if (outbox_.empty())
+        return;
+
+    // The strand owns the queue: the game loop never waits for the handlers
+    std::vector<std::shared_ptr<std::string const>> batch;
+    batch.swap(outbox_);
+    asio::post(socket_.get_executor(), asio::bind_executor(strand_, std::bind(&player_conn::enqueue, shared_from_this(), std::move(batch), outbox_latest_)));
+    outbox_latest_ = npos;
 }
 
 void player_conn::close()
@@ -82,20 +188,83 @@ void player_conn::close()
         asio::post(socket_.get_executor(), asio::bind_executor(strand_, std::bind(&player_conn::do_close, shared_from_this(), beast::websocket::close_code::normal)));
 }
 
-player_conn::patch player_conn::pop_patch()
+void player_conn::on_login(bool accepted)
 {
-    WEBGAME_LOCK(patches_mutex_);
+    if (!accepted)
+    {
+        CONN_LOG("AUTHENTICATION: PLAYER " << player_name_ << " ALREADY CONNECTED");
+        asio::post(socket_.get_executor(), asio::bind_executor(strand_, std::bind(&player_conn::do_close, shared_from_this(), beast::websocket::close_code::abnormal)));
+        return;
+    }
 
-    patch p = std::move(patches_.front());
-    patches_.pop();
-    return p;
+    CONN_LOG("LOADING PLAYER " << player_name_);
+    server_->get_persistence()->async_load_player(player_name_, std::bind(&player_conn::on_player_load, shared_from_this(), std::placeholders::_1));
 }
 
-bool player_conn::has_patch() const
+bool player_conn::start_playing(std::shared_ptr<player> const& player_entity)
 {
-    WEBGAME_LOCK(patches_mutex_);
+    // Unless the strand started closing it meanwhile
+    state expected = loading_player;
+    if (!state_.compare_exchange_strong(expected, reading))
+        return false;
 
-    return !patches_.empty();
+    player_entity_ = player_entity;
+    player_entity->set_conn(this);
+    return true;
+}
+
+mpsc_queue<player_conn::command> & player_conn::commands()
+{
+    return commands_;
+}
+
+bool player_conn::check_congestion()
+{
+    size_t queued_messages = queued_messages_.load(std::memory_order_relaxed);
+    size_t queued_bytes = queued_bytes_.load(std::memory_order_relaxed);
+    if (queued_messages <= high_water_messages && queued_bytes <= high_water_bytes)
+    {
+        if (congested_)
+            CONN_LOG("CONGESTION OVER, " << skipped_ticks_ << " TICKS SKIPPED SO FAR");
+        congested_ = false;
+        return false;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (!congested_)
+    {
+        CONN_LOG("CONGESTED: " << queued_messages << " MESSAGES, " << queued_bytes << " BYTES QUEUED");
+        congested_ = true;
+        congested_since_ = now;
+    }
+    else if (now - congested_since_ > max_congestion && !aborting_)
+    {
+        // The pending write may never complete, a websocket close would wait behind it
+        CONN_LOG("CONGESTED FOR TOO LONG, DROPPING THE CONNECTION");
+        aborting_ = true;
+        asio::post(socket_.get_executor(), asio::bind_executor(strand_, std::bind(&player_conn::do_abort, shared_from_this())));
+    }
+
+    ++skipped_ticks_;
+    return true;
+}
+
+size_t player_conn::take_superseded()
+{
+    size_t superseded = superseded_;
+    size_t taken = superseded - superseded_seen_;
+    superseded_seen_ = superseded;
+    return taken;
+}
+
+player_conn::write_stats player_conn::stats() const
+{
+    write_stats stats;
+    stats.queued_messages = queued_messages_.load(std::memory_order_relaxed);
+    stats.queued_bytes = queued_bytes_.load(std::memory_order_relaxed);
+    stats.superseded = superseded_.load(std::memory_order_relaxed);
+    stats.skipped_ticks = skipped_ticks_.load(std::memory_order_relaxed);
+    return stats;
 }
 
 bool player_conn::is_closed() const
@@ -123,21 +292,153 @@ std::string const& player_conn::player_name() const
     return player_name_;
 }
 
-void player_conn::write_next()
+void player_conn::set_view_radius(double radius)
+{
+    view_radius_ = radius;
+}
+
+double player_conn::view_radius() const
 {
-    WEBGAME_LOCK(handlers_mutex_);
+    return view_radius_;
+}
+
+wire_format player_conn::format() const
+{
+    return format_;
+}
 
+std::vector<id_t> & player_conn::in_view()
+{
+    return in_view_;
+}
+
+state_baselines & player_conn::baselines()
+{
+    return baselines_;
+}
+
+std::unordered_set<id_t> & player_conn::missed_changes()
+{
+    return missed_changes_;
+}
+
+void player_conn::sync_types()
+{
+    if (format_ != wire_format::binary)
+        return;
+
+    size_t nb_types = entity_type::count();
+    if (nb_types == known_types_)
+        return;
+
+    write(std::make_shared<std::string const>(binary_types(known_types_, nb_types)));
+    known_types_ = nb_types;
+}
+
+void player_conn::enqueue(std::vector<std::shared_ptr<std::string const>> const& batch, size_t latest)
+{
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        std::shared_ptr<std::string const> const& msg = batch[i];
+        if (i == latest && latest_pos_ != npos)
+        {
+            // In place, it keeps its order relative to the other messages
+            std::shared_ptr<std::string const> &queued = to_write_[latest_pos_];
+            queued_bytes_ -= queued->size();
+            queued_bytes_ += msg->size();
+            ++superseded_;
+            queued = msg;
+            continue;
+        }
+
+        if (i == latest)
+            latest_pos_ = to_write_.size();
+        ++queued_messages_;
+        queued_bytes_ += msg->size();
+        to_write_.push_back(msg);
+    }
+
+    // Otherwise on_write sends them
+    if (writing_.empty())
+        write_next();
+}
+
+void player_conn::write_next()
+{
     if (!(state_ == loading_player || state_ == reading) || to_write_.empty())
         return;
 
-    socket_.async_write(asio::buffer(*to_write_.front()), asio::bind_executor(strand_, std::bind(&player_conn::on_write, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
+    writing_.swap(to_write_);
+    latest_pos_ = npos;
+    prepare_batch();
+
+    socket_.async_write(batch_buffers_, asio::bind_executor(strand_, std::bind(&player_conn::on_write, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
     state_ = writing;
 }
 
-void player_conn::on_accept(boost::system::error_code const& ec) noexcept
+void player_conn::prepare_batch()
+{
+    batch_buffers_.clear();
+
+    // Alone, a message is sent as is
+    if (writing_.size() == 1)
+    {
+        batch_buffers_.push_back(asio::buffer(*writing_.front()));
+        return;
+    }
+
+    // The messages are gathered by the write, not copied into the batch
+    if (format_ == wire_format::binary)
+    {
+        // All sizes first, the buffers point into the frames
+        batch_frames_.clear();
+        binary_writer w(batch_frames_);
+        w.u8(order_batch);
+        for (std::shared_ptr<std::string const> const& msg : writing_)
+            w.u32(static_cast<std::uint32_t>(msg->size()));
+
+        batch_buffers_.push_back(asio::buffer(batch_frames_.data(), 1));
+        for (size_t i = 0; i < writing_.size(); ++i)
+        {
+            batch_buffers_.push_back(asio::buffer(batch_frames_.data() + 1 + 4 * i, 4));
+            batch_buffers_.push_back(asio::buffer(*writing_[i]));
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < writing_.size(); ++i)
+        {
+            batch_buffers_.push_back(asio::buffer(i == 0 ? "[" : ",", 1));
+            batch_buffers_.push_back(asio::buffer(*writing_[i]));
+        }
+        batch_buffers_.push_back(asio::buffer("]", 1));
+    }
+}
+
+void player_conn::on_handshake_request(boost::system::error_code const& ec) noexcept
 {
-    WEBGAME_LOCK(handlers_mutex_);
+    if (ec)
+    {
+        on_accept(ec);
+        return;
+    }
+
+    if (offers_subprotocol(handshake_request_[http::field::sec_websocket_protocol], binary_subprotocol))
+    {
+        format_ = wire_format::binary;
+        socket_.binary(true);
+
+        auto decorate = [](beast::websocket::response_type &res) {
+            res.set(http::field::sec_websocket_protocol, binary_subprotocol);
+        };
+        socket_.async_accept_ex(handshake_request_, decorate, asio::bind_executor(strand_, std::bind(&player_conn::on_accept, shared_from_this(), std::placeholders::_1)));
+    }
+    else
+        socket_.async_accept(handshake_request_, asio::bind_executor(strand_, std::bind(&player_conn::on_accept, shared_from_this(), std::placeholders::_1)));
+}
 
+void player_conn::on_accept(boost::system::error_code const& ec) noexcept
+{
     if (ec)
     {
         CONN_LOG("HANDSHAKE ERROR" << ": " << ec.message());
@@ -146,7 +447,7 @@ void player_conn::on_accept(boost::system::error_code const& ec) noexcept
         return;
     }
 
-    CONN_LOG("HANDSHAKED");
+    CONN_LOG("HANDSHAKED" << (format_ == wire_format::binary ? " (BINARY)" : ""));
 
     do_read();
     state_ = authenticating;
@@ -154,8 +455,6 @@ void player_conn::on_accept(boost::system::error_code const& ec) noexcept
 
 void player_conn::on_read(boost::system::error_code const& ec, std::size_t const& bytes_transferred) noexcept
 {
-    WEBGAME_LOCK(handlers_mutex_);
-
     assert(state_ != closed);
 
     if (ec)
@@ -189,24 +488,27 @@ void player_conn::on_read(boost::system::error_code const& ec, std::size_t const
     }
 
     if (io_log && data_log)
-        CONN_LOG("READ " << bytes_transferred << " BYTES: " << std::endl << get_readable(read_buffer_.data()));
+        CONN_DEBUG("READ " << bytes_transferred << " BYTES: " << std::endl << get_readable(read_buffer_.data()));
     else if (io_log)
-        CONN_LOG("READ " << bytes_transferred << " BYTES");
+        CONN_DEBUG("READ " << bytes_transferred << " BYTES");
 
-    std::string order_str = boost::beast::buffers_to_string(read_buffer_.data());
+    // The message is read whole into the flat buffer, it is parsed where it lies
+    asio::const_buffer order = read_buffer_.data();
+    interpret(static_cast<char const*>(order.data()), order.size());
     read_buffer_.consume(read_buffer_.size());
 
-    interpret(std::move(order_str));
-
     do_read();
 }
 
 void player_conn::on_write(beast::error_code const& ec, std::size_t const& bytes_transferred) noexcept
 {
-    WEBGAME_LOCK(handlers_mutex_);
-
-    auto msg = to_write_.front();
-    to_write_.pop_front();
+    std::vector<std::shared_ptr<std::string const>> written;
+    written.swap(writing_);
+    for (std::shared_ptr<std::string const> const& msg : written)
+    {
+        --queued_messages_;
+        queued_bytes_ -= msg->size();
+    }
 
     if (ec)
     {
@@ -230,16 +532,19 @@ void player_conn::on_write(beast::error_code const& ec, std::size_t const& bytes
     state_ = reading;
 
     if (io_log && data_log)
-        CONN_LOG("ON WRITE: " << bytes_transferred << " WRITTEN: " << std::endl << *msg);
+    {
+        CONN_DEBUG("ON WRITE: " << bytes_transferred << " WRITTEN IN " << written.size() << " MESSAGES:");
+        for (std::shared_ptr<std::string const> const& msg : written)
+            CONN_DEBUG(*msg);
+    }
     else if (io_log)
-        CONN_LOG("ON WRITE: " << bytes_transferred << " WRITTEN");
+        CONN_DEBUG("ON WRITE: " << bytes_transferred << " WRITTEN IN " << written.size() << " MESSAGES");
 
     write_next();
 }
 
 void player_conn::on_close() noexcept
 {
-    WEBGAME_LOCK(handlers_mutex_);
     if (close_timer_.cancel() == 1)
         CONN_LOG("ON CLOSE: GRACEFUL CLOSE");
     else
@@ -253,12 +558,7 @@ void player_conn::on_player_load(std::shared_ptr<player> const& player_entity)
 
     CONN_LOG("PLAYER LOADED id=" << player_entity->id());
 
-    player_entity_ = player_entity;
-    player_entity->set_conn(this);
-
     server_->register_player(shared_from_this(), player_entity);
-
-    state_ = reading;
 }
 
 void player_conn::do_read()
@@ -268,8 +568,6 @@ void player_conn::do_read()
 
 void player_conn::do_close(beast::websocket::close_code const& code)
 {
-    WEBGAME_LOCK(handlers_mutex_);
-
     if (state_ == closed || state_ == closing)
     {
         CONN_LOG("WARNING: TRYING TO CLOSE BUT SOCKET IS ALREADY IN " << (state_ == closed ? "CLOSED" : "CLOSING") << " STATE");
@@ -289,81 +587,117 @@ void player_conn::do_close(beast::websocket::close_code const& code)
     // If the endpoint does not acknowledge the close after N seconds, we force it by closing the underlying tcp socket
     close_timer_.expires_after(std::chrono::seconds(10));
     std::shared_ptr<player_conn> this_p = shared_from_this();
-    close_timer_.async_wait([this, this_p](boost::system::error_code const& error) {
-        WEBGAME_LOCK(handlers_mutex_);
+    close_timer_.async_wait(asio::bind_executor(strand_, [this, this_p](boost::system::error_code const& error) {
         if (state_ != closed && socket_.next_layer().is_open())
         {
             CONN_LOG("WEBSOCKET CLOSE DID NOT SUCCEED. CLOSING THE TCP SOCKET");
             socket_.next_layer().shutdown(asio::ip::tcp::socket::shutdown_both);
             socket_.next_layer().close();
         }
-    });
+    }));
 
     socket_.async_close(code, asio::bind_executor(strand_, std::bind(&player_conn::on_close, shared_from_this())));
     state_ = closing;
 }
 
-void player_conn::interpret(std::string &&order_str)
+void player_conn::do_abort()
 {
-    //CONN_LOG("INTERPRETING " << order_str);
+    if (!socket_.next_layer().is_open())
+        return;
 
+    // Pending operations complete with an error, the connection ends up closed
+    boost::system::error_code ec;
+    socket_.next_layer().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+    socket_.next_layer().close(ec);
+}
+
+void player_conn::interpret(char const* data, size_t size)
+{
     try {
-        nlohmann::json j = nlohmann::json::parse(std::move(order_str));
+        if (format_ == wire_format::binary)
+            interpret_binary(data, size);
+        else
+            interpret_json(data, size);
+    }
+    catch (std::exception const& e) {
+        CONN_LOG("INTERPRET ERROR: " << e.what());
+        do_close(beast::websocket::close_code::abnormal);
+    }
+}
 
-        std::string order = j["order"];
-        if (state_ == authenticating)
-        {
-            if (order != "authentication")
-                throw std::runtime_error("AUTHENTICATION: NOT AN AUTHENTICATION ORDER");
+void player_conn::interpret_json(char const* data, size_t size)
+{
+    // The usual orders are read without building a document, the others go
+    // through the complete parse, which throws for what is not an order
+    client_order order;
+    std::string player_name;
+    if (!parse_client_order(data, size, order))
+        parse_client_order(nlohmann::json::parse(data, data + size), order, player_name);
+
+    if (state_ == authenticating)
+    {
+        if (order.kind != client_order::authentication)
+            throw std::runtime_error("AUTHENTICATION: NOT AN AUTHENTICATION ORDER");
 
-            std::string player_name = j["player_name"];
-            if (server_->is_player_connected(player_name))
-                throw std::runtime_error("AUTHENTICATION: PLAYER " + player_name + " ALREADY CONNECTED");
+        authenticate(std::string(order.player_name, order.player_name_size));
+    }
+    else if (order.kind == client_order::change_speed)
+        push_command({ command::change_speed, order.speed, vector(0, 0) });
+    else if (order.kind == client_order::change_dir)
+        push_command({ command::change_dir, 0, order.vec });
+    else if (order.kind == client_order::move_to)
+        push_command({ command::move_to, 0, order.vec });
+    else
+        throw std::runtime_error("UNKNOWN ORDER: authentication");
+}
 
-            if (player_name.empty())
-                throw std::runtime_error("AUTHENTICATION: INVALID PLAYER NAME");
+void player_conn::interpret_binary(char const* data, size_t size)
+{
+    binary_reader r(data, size);
 
-            player_name_ = player_name;
+    std::uint8_t action = r.u8();
+    if (state_ == authenticating)
+    {
+        if (action != action_authentication)
+            throw std::runtime_error("AUTHENTICATION: NOT AN AUTHENTICATION ORDER");
 
-            CONN_LOG("LOADING PLAYER " << player_name_);
-            server_->get_persistence()->async_load_player(player_name_, std::bind(&player_conn::on_player_load, shared_from_this(), std::placeholders::_1));
-            state_ = loading_player;
-        }
-        else if (order == "action")
+        authenticate(r.str());
+    }
+    else
+    {
+        if (action == action_change_speed)
+            push_command({ command::change_speed, read_finite(r), vector(0, 0) });
+        else if (action == action_change_dir || action == action_move_to)
         {
-            std::string suborder = j["suborder"];
-            WEBGAME_LOCK(patches_mutex_);
-
-            if (suborder == "change_speed")
-                push_patch("speed", any(j["speed"].get<double>()));
-            else if (suborder == "change_dir")
-                push_patch("dir", any(vector({ j["dir"]["x"].get<double>(), j["dir"]["y"].get<double>() })));
-            else if (suborder == "move_to")
-                push_patch("target_pos", any(vector({ j["target_pos"]["x"].get<double>(), j["target_pos"]["y"].get<double>() })));
-            else
-                throw std::runtime_error("UNKNOWN ACTION: " + suborder);
+            double x = read_finite(r);
+            double y = read_finite(r);
+            push_command({ action == action_change_dir ? command::change_dir : command::move_to, 0, vector(x, y) });
         }
         else
-            throw std::runtime_error("UNKNOWN ORDER: " + order);
-    }
-    catch (std::exception const& e) {
-        CONN_LOG("INTERPRET ERROR: " << e.what());
-        do_close(beast::websocket::close_code::abnormal);
+            throw std::runtime_error("UNKNOWN ACTION: " + std::to_string(action));
     }
+
+    if (!r.at_end())
+        throw std::runtime_error("TRAILING DATA IN ORDER");
 }
 
-void player_conn::push_patch(std::string && what, any && value)
+void player_conn::authenticate(std::string const& player_name)
 {
-    WEBGAME_LOCK(patches_mutex_);
+    if (player_name.empty())
+        throw std::runtime_error("AUTHENTICATION: INVALID PLAYER NAME");
 
-    push_patch(patch(std::move(what), std::move(value)));
+    player_name_ = player_name;
+
+    CONN_LOG("LOGGING IN " << player_name_);
+    state_ = loading_player;
+    server_->login(shared_from_this(), player_name_);
 }
 
-void player_conn::push_patch(patch && p)
+void player_conn::push_command(command const& cmd)
 {
-    WEBGAME_LOCK(patches_mutex_);
-
-    patches_.emplace(std::move(p));
+    // The client sends faster than the game loop applies, the command is lost
+    if (!commands_.push(cmd))
+        CONN_LOG("COMMAND QUEUE FULL, COMMAND DROPPED");
 }
 
 } // namespace webgame
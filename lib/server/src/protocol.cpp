@@ -1,11 +1,55 @@
 #include "protocol.hpp"
 
+#include <cassert>
+
+#include "binary.hpp"
 #include "entities.hpp"
 #include "entity.hpp"
+#include "entity_type.hpp"
 #include "player.hpp"
 
 namespace webgame {
 
+char const binary_subprotocol[] = "webgame.binary.v1";
+
+namespace {
+
+void write_state_record(binary_writer &w, state_record const& r, std::uint8_t fields)
+{
+    w.u32(r.id);
+    w.u8(fields);
+    if (fields & field_type)
+        w.u16(r.type);
+    if (fields & field_pos)
+    {
+        w.f32(r.pos.x());
+        w.f32(r.pos.y());
+    }
+    if (fields & field_dir)
+    {
+        w.f32(r.dir.x());
+        w.f32(r.dir.y());
+    }
+    if (fields & field_speed)
+        w.f32(r.speed);
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// JSON
+
+std::string json_state_game(double tick_duration)
+{
+    nlohmann::json j = {
+        {"order", "state"},
+        {"suborder", "game"},
+        {"tick_duration", tick_duration}
+    };
+
+    return j.dump();
+}
+
 std::string json_state_entities(entities const& entities)
 {
     nlohmann::json j = {
@@ -34,4 +78,188 @@ std::string json_state_player(std::shared_ptr<player const> e)
     return j.dump();
 }
 
+std::string json_remove_entities(std::vector<id_t> const& ids)
+{
+    nlohmann::json j = {
+        {"order", "remove"},
+        {"suborder", "entities"},
+        {"ids", ids}
+    };
+
+    return j.dump();
+}
+
+//-----------------------------------------------------------------------------
+// BINARY
+
+std::string binary_state_game(double tick_duration)
+{
+    std::string msg;
+    binary_writer w(msg);
+    w.u8(order_state_game);
+    w.f64(tick_duration);
+
+    return msg;
+}
+
+std::string binary_state_player(std::shared_ptr<player const> e)
+{
+    std::string msg;
+    binary_writer w(msg);
+    w.u8(order_state_player);
+    state_record r;
+    e->build_state_record(r);
+    write_state_record(w, r, all_fields);
+
+    return msg;
+}
+
+std::string binary_remove_entities(std::vector<id_t> const& ids)
+{
+    std::string msg;
+    msg.reserve(5 + 4 * ids.size());
+    binary_writer w(msg);
+    w.u8(order_remove_entities);
+    w.u32(static_cast<std::uint32_t>(ids.size()));
+    for (id_t id : ids)
+        w.u32(id);
+
+    return msg;
+}
+
+std::string binary_types(size_t first, size_t last)
+{
+    assert(first <= last && last <= entity_type::count());
+
+    std::string msg;
+    binary_writer w(msg);
+    w.u8(order_types);
+    w.u16(static_cast<std::uint16_t>(first));
+    w.u16(static_cast<std::uint16_t>(last - first));
+    for (size_t tag = first; tag < last; ++tag)
+        w.str(entity_type::name_of(static_cast<entity_type::tag_type>(tag)));
+
+    return msg;
+}
+
+//-----------------------------------------------------------------------------
+// STATE BASELINES
+
+bool state_baselines::write(binary_writer &w, state_record const& r)
+{
+    auto it = sent_.find(r.id);
+    if (it == sent_.end())
+    {
+        write_state_record(w, r, all_fields);
+        sent_.emplace(r.id, r);
+        return true;
+    }
+
+    state_record &sent = it->second;
+    std::uint8_t fields = 0;
+    if (r.type != sent.type)
+        fields |= field_type;
+    if (r.pos != sent.pos)
+        fields |= field_pos;
+    if (r.dir != sent.dir)
+        fields |= field_dir;
+    if (r.speed != sent.speed)
+        fields |= field_speed;
+
+    if (fields == 0)
+        return false;
+
+    write_state_record(w, r, fields);
+    sent = r;
+    return true;
+}
+
+void state_baselines::forget(id_t id)
+{
+    sent_.erase(id);
+}
+
+size_t state_baselines::size() const
+{
+    return sent_.size();
+}
+
+std::string binary_state_entities(std::vector<state_record const*> const& records, state_baselines &baselines)
+{
+    std::string msg;
+    msg.reserve(5 + 31 * records.size());
+    binary_writer w(msg);
+    w.u8(order_state_entities);
+    w.u32(0);
+
+    std::uint32_t count = 0;
+    for (state_record const* r : records)
+        if (baselines.write(w, *r))
+            ++count;
+
+    if (count == 0)
+        return std::string();
+
+    // Now that we know it, the count goes after the order byte
+    std::string count_bytes;
+    binary_writer(count_bytes).u32(count);
+    msg.replace(1, 4, count_bytes);
+
+    return msg;
+}
+
+//-----------------------------------------------------------------------------
+// STATE FRAGMENTS
+
+std::string const& state_fragments::get(entity const& ent)
+{
+    auto it = json_fragments_.find(ent.id());
+    if (it != json_fragments_.end())
+        return it->second;
+
+    nlohmann::json j;
+    ent.build_state_order(j);
+    return json_fragments_.emplace(ent.id(), j.dump()).first->second;
+}
+
+state_record const& state_fragments::record(entity const& ent)
+{
+    auto it = records_.find(ent.id());
+    if (it != records_.end())
+        return it->second;
+
+    state_record r;
+    ent.build_state_record(r);
+    return records_.emplace(ent.id(), r).first->second;
+}
+
+void state_fragments::clear()
+{
+    json_fragments_.clear();
+    records_.clear();
+}
+
+std::string json_state_entities(std::vector<std::string const*> const& fragments)
+{
+    static std::string const head = R"({"order":"state","suborder":"entities","data":[)";
+    static std::string const tail = "]}";
+
+    size_t size = head.size() + tail.size() + fragments.size();
+    for (std::string const* fragment : fragments)
+        size += fragment->size();
+
+    std::string msg;
+    msg.reserve(size);
+    msg += head;
+    for (size_t i = 0; i < fragments.size(); ++i)
+    {
+        if (i != 0)
+            msg += ',';
+        msg += *fragments[i];
+    }
+    msg += tail;
+
+    return msg;
+}
+
 } // namespace webgame
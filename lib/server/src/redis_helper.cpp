@@ -1,5 +1,10 @@
 #include "redis_helper.hpp"
 
+#include <algorithm>
+#include <ostream>
+
+#include <boost/asio/write.hpp>
+
 #include <bredis/Extract.hpp>
 #include <bredis/MarkerHelpers.hpp>
 
@@ -12,10 +17,32 @@ using result_t = bredis::parse_result_mapper_t<it_t, policy_t>;
 
 namespace webgame {
 
+namespace {
+
+size_t const default_pipeline_depth = 16;
+
+} // namespace
+
 redis_helper::redis_helper(boost::asio::ip::tcp::socket &socket)
     : socket_(std::move(socket))
+    , pipeline_depth_(default_pipeline_depth)
+    , writing_(false)
+    , reading_(false)
 {}
 
+void redis_helper::set_pipeline_depth(size_t depth)
+{
+    WEBGAME_LOCK(tasks_mutex_);
+
+    pipeline_depth_ = std::max(depth, size_t(1));
+    write_next();
+}
+
+size_t redis_helper::pipeline_depth() const
+{
+    return pipeline_depth_;
+}
+
 void redis_helper::select(unsigned int idx)
 {
     command_result_str(bredis::single_command_t({ "SELECT", std::to_string(idx) }), "OK");
@@ -59,20 +86,52 @@ std::vector<std::string> redis_helper::keys(std::string const& pattern)
     return keys;
 }
 
+std::vector<std::string> redis_helper::scan(std::string &cursor, std::string const& pattern, size_t count)
+{
+    socket_.write(bredis::single_command_t({ "SCAN", cursor, "MATCH", pattern, "COUNT", std::to_string(count) }));
+    result_t res = socket_.read(read_buffer_);
+    bredis::extracts::extraction_result_t extract = boost::apply_visitor(bredis::extractor<it_t>(), res.result);
+    read_buffer_.consume(res.consumed);
+
+    std::vector<std::string> keys;
+    try {
+        bredis::extracts::array_holder_t &reply = boost::get<bredis::extracts::array_holder_t>(extract);
+        if (reply.elements.size() != 2)
+            throw std::runtime_error("redis_helper: scan: result array size is bad");
+        cursor = std::move(boost::get<bredis::extracts::string_t>(reply.elements[0]).str);
+        bredis::extracts::array_holder_t &array = boost::get<bredis::extracts::array_holder_t>(reply.elements[1]);
+        keys.reserve(array.elements.size());
+        for (bredis::extracts::extraction_result_t &array_elem : array.elements)
+            keys.emplace_back(std::move(boost::get<bredis::extracts::string_t>(array_elem).str));
+    }
+    catch (boost::bad_get const&) {
+        throw std::runtime_error("redis_helper: scan: result is malformed");
+    }
+    return keys;
+}
+
 void redis_helper::async_set(std::string const& key, std::string const& value, std::function<void()> &&handler)
 {
-    WEBGAME_LOCK(tasks_mutex_);
-    tasks_.emplace_back(std::bind(&redis_helper::task_set, shared_from_this(), key, value, std::move(handler)));
-    if (tasks_.size() == 1)
-        tasks_.front()();
+    push_request(bredis::single_command_t({ "SET", key, value }), 1, [handler = std::move(handler)](bredis::extracts::extraction_result_t &&extract) {
+        check_extract_str(extract, "OK");
+        handler();
+    });
 }
 
 void redis_helper::async_get(std::string const& key, std::function<void(bool, std::string&&)> &&handler)
 {
-    WEBGAME_LOCK(tasks_mutex_);
-    tasks_.emplace_back(std::bind(&redis_helper::task_get, shared_from_this(), key, std::move(handler)));
-    if (tasks_.size() == 1)
-        tasks_.front()();
+    push_request(bredis::single_command_t({ "GET", key }), 1, [handler = std::move(handler)](bredis::extracts::extraction_result_t &&extract) {
+        bool success;
+        std::string str;
+        try {
+            str = std::move(boost::get<bredis::extracts::string_t>(extract).str);
+            success = true;
+        }
+        catch (...) {
+            success = false;
+        }
+        handler(success, std::move(str));
+    });
 }
 
 std::vector<std::string> redis_helper::multi_get(std::vector<std::string> const& keys)
@@ -127,65 +186,45 @@ std::vector<std::string> redis_helper::multi_get(std::vector<std::string> const&
     return values;
 }
 
-void redis_helper::async_multi_set(std::vector<std::pair<std::string, std::string>> const& keys_values, std::function<void()> &&handler)
+std::vector<std::string> redis_helper::mget(std::vector<std::string> const& keys)
 {
-    WEBGAME_LOCK(tasks_mutex_);
-    tasks_.emplace_back(std::bind(&redis_helper::task_multi_set, shared_from_this(), keys_values, std::move(handler)));
-    if (tasks_.size() == 1)
-        tasks_.front()();
-}
+    if (keys.empty())
+        return std::vector<std::string>();
 
-void redis_helper::task_set(std::string const& key, std::string const& value, std::function<void()> &handler)
-{
-    auto this_p = shared_from_this();
-    socket_.async_write(write_buffer_, bredis::single_command_t({ "SET", key, value }), [this_p, &handler](boost::system::error_code const& ec, std::size_t bytes_transferred) {
-        if (ec)
-            throw std::runtime_error("redis_helper: task_set: error during async write: " + ec.message());
-        this_p->write_buffer_.consume(bytes_transferred);
-        this_p->socket_.async_read(this_p->read_buffer_, [this_p, &handler](boost::system::error_code const& ec, result_t &&res) {
-            if (ec)
-                throw std::runtime_error("redis_helper: task_set: error during async read: " + ec.message());
-
-            bredis::extracts::extraction_result_t extract = boost::apply_visitor(bredis::extractor<it_t>(), res.result);
-            this_p->read_buffer_.consume(res.consumed);
-            check_extract_str(extract, "OK");
-            handler();
-            this_p->exec_next();
-        });
-    });
-}
+    std::vector<boost::string_ref> args;
+    args.reserve(keys.size() + 1);
+    args.emplace_back("MGET");
+    for (std::string const& key : keys)
+        args.emplace_back(key);
 
-void redis_helper::task_get(std::string const& key, std::function<void(bool, std::string&&)> &handler)
-{
-    auto this_p = shared_from_this();
-    socket_.async_write(write_buffer_, bredis::single_command_t({ "GET", key }), [this_p, &handler](boost::system::error_code const& ec, std::size_t bytes_transferred) {
-        if (ec)
-            throw std::runtime_error("redis_helper: task_get: error during async write: " + ec.message());
-        this_p->write_buffer_.consume(bytes_transferred);
-        this_p->socket_.async_read(this_p->read_buffer_, [this_p, &handler](boost::system::error_code const& ec, result_t &&res) {
-            if (ec)
-                throw std::runtime_error("redis_helper: task_get: error during async read: " + ec.message());
-
-            bredis::extracts::extraction_result_t extract = boost::apply_visitor(bredis::extractor<it_t>(), res.result);
-            this_p->read_buffer_.consume(res.consumed);
-            bool success;
-            std::string str;
-            try {
-                str = std::move(boost::get<bredis::extracts::string_t>(extract).str);
-                success = true;
-            }
-            catch (...) {
-                success = false;
-            }
-            handler(success, std::move(str));
-            this_p->exec_next();
-        });
-    });
+    socket_.write(bredis::single_command_t(args.cbegin(), args.cend()));
+    result_t res = socket_.read(read_buffer_);
+    bredis::extracts::extraction_result_t extract = boost::apply_visitor(bredis::extractor<it_t>(), res.result);
+    read_buffer_.consume(res.consumed);
+
+    bredis::extracts::array_holder_t *results_p;
+    try {
+        results_p = &boost::get<bredis::extracts::array_holder_t>(extract);
+    }
+    catch (...) {
+        throw std::runtime_error("redis_helper: mget: result is not an array");
+    }
+    if (results_p->elements.size() != keys.size())
+        throw std::runtime_error("redis_helper: mget: result array size is bad");
+
+    std::vector<std::string> values;
+    values.reserve(keys.size());
+    for (bredis::extracts::extraction_result_t &res_element : results_p->elements)
+    {
+        bredis::extracts::string_t *str_p = boost::get<bredis::extracts::string_t>(&res_element);
+        values.emplace_back(str_p ? std::move(str_p->str) : std::string());
+    }
+
+    return values;
 }
 
-void redis_helper::task_multi_set(std::vector<std::pair<std::string, std::string>> const& keys_values, std::function<void()> &handler)
+void redis_helper::async_multi_set(std::vector<std::pair<std::string, std::string>> const& keys_values, std::function<void()> &&handler)
 {
-    auto this_p = shared_from_this();
     bredis::command_container_t transaction;
     transaction.reserve(keys_values.size() + 2);
     transaction.emplace_back(bredis::single_command_t({ "MULTI" }));
@@ -193,66 +232,115 @@ void redis_helper::task_multi_set(std::vector<std::pair<std::string, std::string
         transaction.emplace_back(bredis::single_command_t({ "SET", key_value.first, key_value.second }));
     transaction.emplace_back(bredis::single_command_t({ "EXEC" }));
 
-    socket_.async_write(write_buffer_, transaction, [this_p, &keys_values, &handler](boost::system::error_code const& ec, std::size_t bytes_transferred) {
-        if (ec)
-            throw std::runtime_error("redis_helper: task_multi_set: error during async write: " + ec.message());
-        this_p->write_buffer_.consume(bytes_transferred);
-        this_p->socket_.async_read(this_p->read_buffer_, [this_p, &keys_values, &handler](boost::system::error_code const& ec, result_t &&res) {
-            if (ec)
-                throw std::runtime_error("redis_helper: task_multi_set: error during async read: " + ec.message());
-
-            // fixme
-
-            //bredis::markers::array_holder_t<it_t> &results_array = boost::get<bredis::markers::array_holder_t<it_t>>(res.result);
-            bredis::extracts::extraction_result_t extract = boost::apply_visitor(bredis::extractor<it_t>(), res.result);
-            this_p->read_buffer_.consume(res.consumed);
-
-            bredis::markers::array_holder_t<it_t> &results_array = boost::get<bredis::markers::array_holder_t<it_t>>(res.result);
-            if (results_array.elements.size() != keys_values.size() + 2)
-                throw std::runtime_error("redis_helper: task_multi_set: result array size is bad");
-
-            //if (!boost::apply_visitor(bredis::marker_helpers::equality<it_t>("OK"), results_array.elements[0]))
-                //throw std::runtime_error("");
-            check_extract_str(boost::apply_visitor(bredis::extractor<it_t>(), results_array.elements[0]), "OK");
-
-
-            int i;
-            for (i = 1; i < keys_values.size() + 1; ++i)
-                //if (!boost::apply_visitor(bredis::marker_helpers::equality<it_t>("QUEUED"), results_array.elements[i]))
-                    //throw std::runtime_error("");
-                check_extract_str(boost::apply_visitor(bredis::extractor<it_t>(), results_array.elements[i]), "QUEUED");
-
-            bredis::extracts::extraction_result_t set_results_extract = boost::apply_visitor(bredis::extractor<it_t>(), results_array.elements[i]);
-            bredis::extracts::array_holder_t *set_results_p;
-            try {
-                set_results_p = &boost::get<bredis::extracts::array_holder_t>(set_results_extract);
-            }
-            catch (...) {
-                throw std::runtime_error("redis_helper: task_multi_set: set results is not an array");
-            }
-
-            if (set_results_p->elements.size() != keys_values.size())
-                throw std::runtime_error("redis_helper: task_multi_set: set results array size is bad");
-
-            for (bredis::extracts::extraction_result_t & res_element : set_results_p->elements)
-                check_extract_str(res_element, "OK");
-
-            handler();
-            this_p->exec_next();
-        }, keys_values.size() + 2);
+    size_t nb_sets = keys_values.size();
+    push_request(transaction, nb_sets + 2, [nb_sets, handler = std::move(handler)](bredis::extracts::extraction_result_t &&extract) {
+        bredis::extracts::array_holder_t *results_p;
+        try {
+            results_p = &boost::get<bredis::extracts::array_holder_t>(extract);
+        }
+        catch (...) {
+            throw std::runtime_error("redis_helper: async_multi_set: results are not an array");
+        }
+
+        if (results_p->elements.size() != nb_sets + 2)
+            throw std::runtime_error("redis_helper: async_multi_set: result array size is bad");
+
+        check_extract_str(results_p->elements[0], "OK");
+        for (size_t i = 1; i < nb_sets + 1; ++i)
+            check_extract_str(results_p->elements[i], "QUEUED");
+
+        bredis::extracts::array_holder_t *set_results_p;
+        try {
+            set_results_p = &boost::get<bredis::extracts::array_holder_t>(results_p->elements[nb_sets + 1]);
+        }
+        catch (...) {
+            throw std::runtime_error("redis_helper: async_multi_set: set results is not an array");
+        }
+
+        if (set_results_p->elements.size() != nb_sets)
+            throw std::runtime_error("redis_helper: async_multi_set: set results array size is bad");
+
+        for (bredis::extracts::extraction_result_t & res_element : set_results_p->elements)
+            check_extract_str(res_element, "OK");
+
+        handler();
     });
 }
 
-void redis_helper::exec_next()
+void redis_helper::push_request(bredis::command_wrapper_t const& cmd, size_t nb_replies, continuation &&on_replies)
 {
+    // Commands only reference their arguments, so they are serialized right away
+    request req;
+    req.payload = boost::apply_visitor(bredis::command_serializer_visitor(), cmd);
+    req.nb_replies = nb_replies;
+    req.on_replies = std::move(on_replies);
+
     WEBGAME_LOCK(tasks_mutex_);
+    queued_.emplace_back(std::move(req));
+    write_next();
+}
 
-    tasks_.pop_front();
+void redis_helper::write_next()
+{
+    WEBGAME_LOCK(tasks_mutex_);
 
-    if (tasks_.empty())
+    if (writing_ || queued_.empty() || in_flight_.size() >= pipeline_depth_)
         return;
 
-    tasks_.front()();
+    // All the requests the pipeline can take go in one write
+    std::ostream os(&write_buffer_);
+    while (!queued_.empty() && in_flight_.size() < pipeline_depth_)
+    {
+        request &req = queued_.front();
+        os.write(req.payload.data(), req.payload.size());
+        std::string().swap(req.payload);
+        in_flight_.emplace_back(std::move(req));
+        queued_.pop_front();
+    }
+
+    writing_ = true;
+    auto this_p = shared_from_this();
+    boost::asio::async_write(socket_.next_layer(), write_buffer_, [this_p](boost::system::error_code const& ec, std::size_t) {
+        if (ec)
+            throw std::runtime_error("redis_helper: error during async write: " + ec.message());
+
+        WEBGAME_LOCK(this_p->tasks_mutex_);
+        this_p->writing_ = false;
+        this_p->read_next();
+        this_p->write_next();
+    });
+
+    read_next();
+}
+
+void redis_helper::read_next()
+{
+    WEBGAME_LOCK(tasks_mutex_);
+
+    if (reading_ || in_flight_.empty())
+        return;
+
+    reading_ = true;
+    auto this_p = shared_from_this();
+    socket_.async_read(read_buffer_, [this_p](boost::system::error_code const& ec, result_t &&res) {
+        if (ec)
+            throw std::runtime_error("redis_helper: error during async read: " + ec.message());
+
+        bredis::extracts::extraction_result_t extract = boost::apply_visitor(bredis::extractor<it_t>(), res.result);
+        this_p->read_buffer_.consume(res.consumed);
+
+        request req;
+        {
+            WEBGAME_LOCK(this_p->tasks_mutex_);
+            req = std::move(this_p->in_flight_.front());
+            this_p->in_flight_.pop_front();
+            this_p->reading_ = false;
+            this_p->read_next();
+            this_p->write_next();
+        }
+
+        req.on_replies(std::move(extract));
+    }, in_flight_.front().nb_replies);
 }
 
 // HELPERS
@@ -1,6 +1,9 @@
 #include "redis_persistence.hpp"
 
+#include <algorithm>
+#include <future>
 #include <memory>
+#include <thread>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/connect.hpp>
@@ -8,6 +11,7 @@
 #include <boost/serialization/shared_ptr.hpp>
 
 #include "entities.hpp"
+#include "id_allocator.hpp"
 #include "log.hpp"
 #include "npc.hpp"
 #include "player.hpp"
@@ -18,13 +22,58 @@ namespace asio = boost::asio;
 
 namespace webgame {
 
+namespace {
+
+size_t const default_load_batch_size = 1000;
+
+typedef std::vector<std::shared_ptr<entity>> loaded_entities;
+
+loaded_entities load_entities(std::shared_ptr<std::vector<std::string> const> const& values, size_t begin, size_t end)
+{
+    loaded_entities ents;
+    ents.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i)
+        // Deleted between SCAN and MGET
+        if (!(*values)[i].empty())
+            ents.emplace_back(load_entity(nlohmann::json::parse((*values)[i])));
+    return ents;
+}
+
+// Keys are <table>:<id>
+id_t id_of_key(std::string const& key)
+{
+    return static_cast<id_t>(std::stoul(key.substr(key.find(':') + 1)));
+}
+
+} // namespace
+
 redis_persistence::redis_persistence(boost::asio::io_context &io_context, std::string const& host, unsigned short port, unsigned int index)
     : socket_(io_context)
     , host_(host)
     , port_(port)
     , index_(index)
+    , pipeline_depth_(0)
+    , load_batch_size_(default_load_batch_size)
+    , load_threads_(std::max(std::thread::hardware_concurrency(), 1u))
 {}
 
+void redis_persistence::set_pipeline_depth(size_t depth)
+{
+    pipeline_depth_ = depth;
+    if (helper_ && pipeline_depth_ != 0)
+        helper_->set_pipeline_depth(pipeline_depth_);
+}
+
+void redis_persistence::set_load_batch_size(size_t batch_size)
+{
+    load_batch_size_ = std::max(batch_size, size_t(1));
+}
+
+void redis_persistence::set_load_threads(unsigned int nb_threads)
+{
+    load_threads_ = std::max(nb_threads, 1u);
+}
+
 bool redis_persistence::start()
 {
     try {
@@ -37,6 +86,8 @@ bool redis_persistence::start()
         helper_ = std::make_shared<redis_helper>(socket_);
 
         helper_->select(index_);
+        if (pipeline_depth_ != 0)
+            helper_->set_pipeline_depth(pipeline_depth_);
 
         return true;
     }
@@ -58,8 +109,11 @@ void redis_persistence::async_save(entities const& ents, std::function<save_hand
     keys_values.reserve(ents.size());
     for (auto const& e : ents)
     {
+        // Once saved, an id is not handed out again even if the entity dies
+        entity_ids().pin(e.first);
+
         std::string key;
-        if (e.second->type() == "player")
+        if (e.second->type().has(entity_type::player_trait))
             key = "player";
         else
             key = "npe";
@@ -81,19 +135,62 @@ entities redis_persistence::load_all_npes()
 {
     WEBGAME_LOG("REDIS", "LOADING ALL NON PLAYABLE ENTITIES");
 
-    std::vector<std::string> keys = helper_->keys("npe:*");
+#ifndef WEBGAME_MONOTHREAD
+    std::launch const policy = std::launch::async;
+#else
+    std::launch const policy = std::launch::deferred;
+#endif /* !WEBGAME_MONOTHREAD */
+
+    // Players are loaded when they log in, their ids must not be handed to
+    // other entities meanwhile
+    std::string cursor = "0";
+    do {
+        for (std::string const& key : helper_->scan(cursor, "player:*", load_batch_size_))
+            entity_ids().pin(id_of_key(key));
+    } while (cursor != "0");
+
+    // Neither to the entities being built before they load theirs: a slot
+    // freed by a loaded entity comes back with the next generation
+    std::vector<std::vector<std::string>> batches;
+    do {
+        batches.push_back(helper_->scan(cursor, "npe:*", load_batch_size_));
+        for (std::string const& key : batches.back())
+            entity_ids().pin(id_of_key(key));
+    } while (cursor != "0");
 
-    if (keys.empty())
+    entities ents;
+    // Deserialization of the previous batch
+    std::vector<std::future<loaded_entities>> pending;
+    auto collect = [&ents, &pending] {
+        for (std::future<loaded_entities> &f : pending)
+            for (std::shared_ptr<entity> const& ent : f.get())
+                // SCAN may return a key more than once
+                if (ents.find(ent->id()) == ents.end())
+                {
+                    entity_ids().pin(ent->id());
+                    ents.add(ent);
+                }
+        if (!pending.empty())
+            WEBGAME_LOG("REDIS", ents.size() << " NON PLAYABLE ENTITIES LOADED");
+        pending.clear();
+    };
+
+    for (std::vector<std::string> const& keys : batches)
     {
-        WEBGAME_LOG("REDIS", "NOTHING TO LOAD");
-        return entities();
+        auto values = std::make_shared<std::vector<std::string> const>(helper_->mget(keys));
+
+        collect();
+
+        size_t const nb_chunks = std::max<size_t>(1, std::min<size_t>(load_threads_, values->size()));
+        size_t const chunk_size = (values->size() + nb_chunks - 1) / nb_chunks;
+        for (size_t begin = 0; begin < values->size(); begin += chunk_size)
+            pending.emplace_back(std::async(policy, load_entities, values, begin, std::min(values->size(), begin + chunk_size)));
     }
 
-    std::vector<std::string> values = helper_->multi_get(keys);
+    collect();
 
-    entities ents;
-    for (std::string const& value : values)
-        ents.add(load_entity(nlohmann::json::parse(value)));
+    if (ents.empty())
+        WEBGAME_LOG("REDIS", "NOTHING TO LOAD");
     return ents;
 }
 
@@ -112,6 +209,7 @@ void redis_persistence::async_load_player(std::string const& name, std::function
             WEBGAME_LOG("REDIS", "PLAYER DOES NOT EXIST, CREATING IT");
             // We create a default entity
             auto new_ent = std::make_shared<player>();
+            entity_ids().pin(new_ent->id());
 
             WEBGAME_LOG("REDIS", "STORING IT IN player:<id> table");
             // We serialize it and store it in player:<id> table
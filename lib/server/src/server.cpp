@@ -1,20 +1,28 @@
 #include "server.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <exception>
 #include <future>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/connect.hpp>
 #include <boost/asio/streambuf.hpp>
 #include <boost/asio/use_future.hpp>
 #include <boost/beast/core/buffers_to_string.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/property_tree/ptree.hpp>
 
 #include "behavior.hpp"
 #include "entities.hpp"
 #include "entity.hpp"
 #include "env.hpp"
+#include "io_shards.hpp"
+#include "kinematics.hpp"
 #include "lock.hpp"
 #include "log.hpp"
 #include "npc.hpp"
@@ -24,6 +32,7 @@
 #include "protocol.hpp"
 #include "save_load.hpp"
 #include "stationnary_entity.hpp"
+#include "tick_profiler.hpp"
 #include "time.hpp"
 #include "utils.hpp"
 #include "vector.hpp"
@@ -35,84 +44,274 @@ namespace beast = boost::beast;
 
 namespace webgame {
 
+namespace {
+
+// Roughly what the client shows around the player
+double const default_view_radius = 3.;
+
+steady_clock::duration const default_save_interval = std::chrono::seconds(1);
+
+// How often shutdown() checks that something still runs the simulation
+auto const shutdown_poll_interval = std::chrono::milliseconds(50);
+
+void write_state_player(player_conn &conn)
+{
+    if (conn.format() != wire_format::binary)
+    {
+        conn.write_latest(std::make_shared<std::string const>(json_state_player(conn.player_entity())));
+        return;
+    }
+
+    // Encoding first registers the type tag of the player, if needed
+    std::string msg = binary_state_player(conn.player_entity());
+    conn.sync_types();
+    conn.write_latest(std::make_shared<std::string const>(std::move(msg)));
+}
+
+void apply_command(player &p, player_conn::command const& cmd)
+{
+    switch (cmd.what)
+    {
+    case player_conn::command::change_speed:
+        p.set_speed(cmd.speed);
+        break;
+    case player_conn::command::change_dir:
+        p.set_dir(cmd.vec);
+        p.stop();
+        break;
+    case player_conn::command::move_to:
+        p.move_to(cmd.vec);
+        break;
+    }
+}
+
+// Below this many entities per chunk, splitting the update costs more than it saves
+size_t const min_update_chunk_size = 64;
+
+// Entity update phase of a tick, split in chunks. The game loop and the
+// helpers it posts on the io_context claim chunks until none is left, so the
+// phase completes even if no helper gets to run. A helper running after every
+// chunk has been claimed returns without touching the entities.
+struct update_job
+{
+    enum phase_t
+    {
+        // update() for the entities that do not move, before_move() for the others
+        before_move_phase,
+        // after_move(), mobile entities only
+        after_move_phase
+    };
+
+    phase_t                                                     phase;
+    entities const*                                             alive_entities;
+    spatial_index const*                                        index;
+    double                                                      delta;
+    std::vector<std::shared_ptr<entity> const*>                 ents;
+    // Same order as ents, nullptr for the entities that do not move
+    std::vector<mobile_entity*>                                 mobiles;
+    size_t                                                      chunk_size;
+    size_t                                                      nb_chunks;
+    std::atomic<size_t>                                         next_chunk;
+    std::vector<std::vector<std::shared_ptr<entity> const*>>    changed;
+    std::vector<std::exception_ptr>                             errors;
+    size_t                                                      nb_done;
+#ifndef WEBGAME_MONOTHREAD
+    std::mutex                                                  done_mutex;
+    std::condition_variable                                     done_cv;
+#endif /* !WEBGAME_MONOTHREAD */
+
+    void run()
+    {
+        for (;;)
+        {
+            size_t const chunk = next_chunk++;
+            if (chunk >= nb_chunks)
+                return;
+
+            try {
+                size_t const end = std::min(ents.size(), (chunk + 1) * chunk_size);
+                for (size_t i = chunk * chunk_size; i < end; ++i)
+                {
+                    std::shared_ptr<entity> const& ent = *ents[i];
+                    // The env is a view over alive entities that skips the entity itself
+                    env env(*alive_entities, ent.get(), index);
+                    bool has_changed;
+                    if (phase == after_move_phase)
+                        has_changed = mobiles[i]->after_move(delta, env);
+                    else if (mobiles[i] != nullptr)
+                        has_changed = mobiles[i]->before_move(delta, env);
+                    else
+                        has_changed = ent->update(delta, env);
+                    if (has_changed)
+                        changed[chunk].push_back(&ent);
+                }
+            }
+            catch (...) {
+                errors[chunk] = std::current_exception();
+            }
+
+            WEBGAME_LOCK(done_mutex);
+            ++nb_done;
+#ifndef WEBGAME_MONOTHREAD
+            done_cv.notify_all();
+#endif /* !WEBGAME_MONOTHREAD */
+        }
+    }
+};
+
+// Late helpers may still hold the job once the phase is done, hence the shared_ptr
+void run_update_job(asio::io_context &io_context, unsigned int nb_threads, std::shared_ptr<update_job> const& job, entities &changed_entities)
+{
+    if (job->ents.empty())
+        return;
+
+    job->nb_chunks = 1;
+#ifndef WEBGAME_MONOTHREAD
+    job->nb_chunks = std::max<size_t>(1, std::min<size_t>(nb_threads, job->ents.size() / min_update_chunk_size));
+#endif /* !WEBGAME_MONOTHREAD */
+    job->chunk_size = (job->ents.size() + job->nb_chunks - 1) / job->nb_chunks;
+    job->next_chunk = 0;
+    job->changed.resize(job->nb_chunks);
+    job->errors.resize(job->nb_chunks);
+    job->nb_done = 0;
+
+    for (size_t i = 1; i < job->nb_chunks; ++i)
+        asio::post(io_context, [job] { job->run(); });
+
+    job->run();
+
+#ifndef WEBGAME_MONOTHREAD
+    {
+        std::unique_lock<std::mutex> lock(job->done_mutex);
+        job->done_cv.wait(lock, [&job] { return job->nb_done == job->nb_chunks; });
+    }
+#endif /* !WEBGAME_MONOTHREAD */
+
+    for (size_t chunk = 0; chunk < job->nb_chunks; ++chunk)
+    {
+        if (job->errors[chunk])
+            std::rethrow_exception(job->errors[chunk]);
+        for (std::shared_ptr<entity> const* ent : job->changed[chunk])
+            if (changed_entities.find((*ent)->id()) == changed_entities.end())
+                changed_entities.add(*ent);
+    }
+}
+
+// Mobile entities of an archetype chunk that are alive this tick
+struct mobile_batch
+{
+    slot_mask                       active;
+    std::shared_ptr<entity> const*  ents[chunk_capacity];
+};
+
+#ifdef SO_REUSEPORT
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif /* SO_REUSEPORT */
+
+} // namespace
+
+server::listener::listener(asio::io_context &context)
+    : context(context)
+    , acceptor(context)
+    , socket(context)
+{}
+
 server::server(asio::io_context &io_context, unsigned int port, std::shared_ptr<persistence> const& persistence)
     : io_context_(io_context)
     , local_endpoint_(asio::ip::tcp::endpoint(asio::ip::tcp::v6(), port))
-    , acceptor_(io_context_)
-    , new_client_socket_(io_context_)
+    , shards_(nullptr)
+    , next_shard_(0)
     , persistence_(persistence)
+    , update_threads_(1)
+    , view_radius_(default_view_radius)
+    , save_interval_(default_save_interval)
     , stop_(new bool(false))
+    , shut_down_(false)
     , game_cycle_timer_(io_context)
+    , sim_thread_enabled_(false)
+    , sim_context_(1)
+    , sim_strand_(io_context.get_executor())
 {}
 
-void server::shutdown()
+server::~server()
 {
-    WEBGAME_LOCK(server_mutex_);
-
-    WEBGAME_LOG("SHUTDOWN", "Stopping game loop thread");
-    *stop_ = true;
-    game_cycle_timer_.cancel();
-
-    WEBGAME_LOG("SHUTDOWN", "Cancelling server accept");
-    acceptor_.cancel();
+    stop_simulation();
+}
 
-    for (auto conn : conns_)
+void server::shutdown()
+{
+#ifndef WEBGAME_MONOTHREAD
+    if (!shut_down_ && !sim_strand_.running_in_this_thread())
     {
-        WEBGAME_LOG("SHUTDOWN", "Closing connection " << conn->addr_str);
-        conn->close();
+        auto done = std::make_shared<std::promise<void>>();
+        std::future<void> done_fut = done->get_future();
+        std::shared_ptr<server> self = shared_from_this();
+        asio::post(sim_strand_, [self, done] {
+            self->do_shutdown();
+            done->set_value();
+        });
+        // Once the context of the strand is stopped, the post may never run
+        // and the world is only touched from here. Unless the post already
+        // started the shutdown, which ends then.
+        while (done_fut.wait_for(shutdown_poll_interval) != std::future_status::ready)
+            if (simulation_stopped() && do_shutdown())
+                break;
     }
-    conns_.clear();
-
-    entities_.clear();
+    else
+#endif /* !WEBGAME_MONOTHREAD */
+        do_shutdown();
 
-    WEBGAME_LOG("SHUTDOWN", "Closing server socket");
-    acceptor_.close();
+    stop_simulation();
+}
 
-    WEBGAME_LOG("SHUTDOWN", "Stopping persistence instance");
-    persistence_->stop();
+void server::set_update_threads(unsigned int nb_threads)
+{
+    update_threads_ = std::max(nb_threads, 1u);
 }
 
-bool server::is_player_connected(std::string const& name)
+void server::set_simulation_thread(bool enabled)
 {
-    WEBGAME_LOCK(server_mutex_);
+    sim_thread_enabled_ = enabled;
+}
 
-    for (std::shared_ptr<player_conn> const& conn : conns_)
-        if (conn->current_state() > player_conn::authenticating
-            && conn->current_state() < player_conn::closing
-            && conn->player_name() == name)
-            return true;
-    return false;
+void server::set_network_shards(io_shards &shards)
+{
+    shards_ = &shards;
 }
 
-void server::register_player(std::shared_ptr<player_conn> const& player_conn, std::shared_ptr<player> const& player_ent)
+void server::set_view_radius(double radius)
 {
-    WEBGAME_LOCK(server_mutex_);
+    view_radius_ = radius;
+}
 
-    player_conn->write(std::make_shared<std::string const>("{\"order\":\"state\",\"suborder\":\"game\",\"tick_duration\":"
-        + std::to_string(std::chrono::duration_cast<std::chrono::duration<float>>(tick_duration_).count()) + "}"));
-    player_conn->write(std::make_shared<std::string const>(json_state_player(player_ent)));
+double server::view_radius() const
+{
+    return view_radius_;
+}
 
-    entities other_ents = entities_;
-    connections other_conns;
-    for (auto &other_conn : conns_)
-        if (other_conn != player_conn && other_conn->is_ready())
-        {
-            other_conns.emplace_back(other_conn);
-            //other_ents.add(other_conn->player_entity());
-        }
+void server::set_compression(compression_options const& options)
+{
+    compression_ = options;
+}
 
-    if (!other_ents.empty())
-    {
-        player_conn->write(std::make_shared<std::string const>(json_state_entities(other_ents)));
+compression_options const& server::compression() const
+{
+    return compression_;
+}
 
-        auto new_entity_json = std::make_shared<std::string const>(json_state_entities(entities({ player_ent })));
-        for (auto &other_conn : other_conns)
-            other_conn->write(new_entity_json);
-    }
+void server::login(std::shared_ptr<player_conn> const& conn, std::string const& name)
+{
+    asio::post(sim_strand_, std::bind(&server::do_login, shared_from_this(), conn, name));
+}
 
-    entities_.add(player_ent);
+void server::register_player(std::shared_ptr<player_conn> const& conn, std::shared_ptr<player> const& player_ent)
+{
+    asio::post(sim_strand_, std::bind(&server::do_register_player, shared_from_this(), conn, player_ent));
+}
 
-    WEBGAME_LOG("SERVER", "PLAYER " << player_conn->player_name() << " REGISTERED");
+void server::post(std::function<void()> const& handler)
+{
+    asio::post(sim_strand_, handler);
 }
 
 std::shared_ptr<persistence> server::get_persistence()
@@ -130,28 +329,71 @@ entities const& server::get_entities() const
     return entities_;
 }
 
+tick_profiler const& server::profiler() const
+{
+    return profiler_;
+}
+
+void server::start_simulation()
+{
+    if (!sim_thread_enabled_ || sim_thread_.joinable())
+        return;
+
+    sim_context_.restart();
+    sim_work_.reset(new work_guard(asio::make_work_guard(sim_context_)));
+    sim_strand_ = simulation_strand(sim_context_.get_executor());
+    sim_thread_ = std::thread([this] {
+        WEBGAME_LOG("STARTUP", "SIMULATION THREAD RUNNING");
+        try {
+            sim_context_.run();
+        }
+        catch (std::exception const& e) {
+            _WEBGAME_MY_LOG("EXCEPTION THROWN: " << e.what());
+        }
+        WEBGAME_LOG("SHUTDOWN", "SIMULATION THREAD STOPPED");
+    });
+}
+
+void server::stop_simulation()
+{
+    if (!sim_thread_.joinable())
+        return;
+
+    // What is posted after the shutdown is dropped
+    sim_work_.reset();
+    sim_context_.stop();
+    if (sim_thread_.get_id() == std::this_thread::get_id())
+        sim_thread_.detach();
+    else
+        sim_thread_.join();
+}
+
 void server::start_persistence()
 {
     WEBGAME_LOG("STARTUP", "LOADING WORLD");
     if (!persistence_->start())
         throw std::runtime_error("server: could not start persistence instance");
 
-    entities_ = persistence_->load_all_npes();
-    WEBGAME_LOG("STARTUP", "LOADED " << static_cast<entity_container<stationnary_entity>>(entities_).size() << " STATIONNARY ENTITIES");
-    WEBGAME_LOG("STARTUP", "LOADED " << static_cast<entity_container<npc>>(entities_).size() << " CHARACTER ENTITIES");
+    index_.clear();
+    entities_.clear();
+    for (auto const& ent : persistence_->load_all_npes())
+        add_entity(ent.second);
+    WEBGAME_LOG("STARTUP", "LOADED " << entities_.view<stationnary_entity>().size() << " STATIONNARY ENTITIES");
+    WEBGAME_LOG("STARTUP", "LOADED " << entities_.view<npc>().size() << " CHARACTER ENTITIES");
 }
 
 void server::start_game()
 {
     *stop_ = false;
     wake_time_ = std::chrono::ceil<std::chrono::seconds>(steady_clock::now());
+    next_save_time_ = wake_time_;
 #ifndef NDEBUG
     start_time_ = wake_time_;
 #endif /* !NDEBUG */
     assert(std::chrono::duration_cast<std::chrono::nanoseconds>(wake_time_.time_since_epoch()).count() % 1000000000 == 0);
 
     game_cycle_timer_.expires_at(wake_time_);
-    game_cycle_timer_.async_wait(std::bind(&server::game_cycle, shared_from_this(), std::placeholders::_1, 0));
+    game_cycle_timer_.async_wait(asio::bind_executor(sim_strand_, std::bind(&server::game_cycle, shared_from_this(), std::placeholders::_1, 0)));
 
     WEBGAME_LOG("STARTUP", "FIRST GAME CYCLE IN "
         << std::chrono::duration_cast<std::chrono::duration<float>>(wake_time_ - std::chrono::steady_clock::now()).count()
@@ -161,28 +403,47 @@ void server::start_game()
 
 void server::start_network()
 {
-    acceptor_.open(local_endpoint_.protocol());
-    acceptor_.set_option(boost::asio::socket_base::reuse_address(true));
-    acceptor_.bind(local_endpoint_);
-    acceptor_.listen();
-
-    new_client_socket_ = asio::ip::tcp::socket(io_context_);
-
-    asio::post(acceptor_.get_executor(), std::bind(&server::do_accept, shared_from_this()));
+    listeners_.clear();
+
+    // The kernel balances the connections between the acceptors of the shards
+#ifdef SO_REUSEPORT
+    if (shards_)
+        for (size_t i = 0; i < shards_->size(); ++i)
+            listeners_.emplace_back(new listener((*shards_)[i]));
+#endif /* SO_REUSEPORT */
+    if (listeners_.empty())
+        listeners_.emplace_back(new listener(io_context_));
+
+    for (auto &l : listeners_)
+    {
+        l->acceptor.open(local_endpoint_.protocol());
+        l->acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+        if (shards_)
+            l->acceptor.set_option(reuse_port(true));
+#endif /* SO_REUSEPORT */
+        l->acceptor.bind(local_endpoint_);
+        l->acceptor.listen();
+
+        asio::post(l->acceptor.get_executor(), std::bind(&server::do_accept, shared_from_this(), l.get()));
+    }
 
-    WEBGAME_LOG("STARTUP", "LISTENNING FOR PLAYER CONNECTION");
+    if (shards_)
+        WEBGAME_LOG("STARTUP", "LISTENNING FOR PLAYER CONNECTION ON " << shards_->size() << " SHARDS, " << listeners_.size() << " ACCEPTOR" << (listeners_.size() > 1 ? "S" : ""));
+    else
+        WEBGAME_LOG("STARTUP", "LISTENNING FOR PLAYER CONNECTION");
 }
 
 void server::game_cycle(boost::system::error_code const& error, unsigned int nb_ticks)
 {
-    WEBGAME_LOCK(server_mutex_);
-
     if (*stop_)
     {
         WEBGAME_LOG("GAME LOOP", "STOPPED");
         return;
     }
 
+    profiler_.start_tick();
+
     double delta = (std::chrono::duration_cast<delta_duration>(tick_duration_) * nb_ticks).count();
 
     // If a player got disconnected, we remove the corresponding connection and entity objects
@@ -191,78 +452,52 @@ void server::game_cycle(boost::system::error_code const& error, unsigned int nb_
         if (/*(*it)->is_closed()*/(*it)->current_state() > player_conn::to_be_closed)
             its_to_remove.push_back(it);
 
-    std::list<id_t> ids_to_remove;
     for (auto it : its_to_remove)
     {
         if ((*it)->player_entity())
         {
             id_t id = (*it)->player_entity()->id();
 
-            ids_to_remove.push_back(id);
-
             assert(entities_.count(id) == 1);
-            assert(entities_.at(id)->type() == "player");
+            assert(entities_.at(id)->type().has(entity_type::player_trait));
 
             WEBGAME_LOG("GAME LOOP", "Removing id " << id << " from entities");
 
-            entities_.erase(id);
+            // Its last changes would be lost otherwise
+            std::shared_ptr<entity> const& ent = entities_.at(id);
+            if (ent->is_dirty())
+            {
+                persistence_->async_save(entities({ ent }), [] {});
+                ent->clear_dirty();
+            }
+
+            remove_entity(id);
         }
+        // Unless the player already logged in again
+        auto login = logins_.find((*it)->player_name());
+        if (login != logins_.end() && login->second == it->get())
+            logins_.erase(login);
+
         WEBGAME_LOG("GAME LOOP", "Removing conn " << (*it)->addr_str << " from connections");
         conns_.erase(it);
     }
 
-    // Fixme: should have a helper in json.cpp
-    // We build the remove message
-    std::shared_ptr<std::string const> remove_entities_msg;
-    if (!ids_to_remove.empty())
-    {
-        boost::property_tree::ptree root;
-        root.put("order", "remove");
-        root.put("suborder", "entities");
-
-        boost::property_tree::ptree ids;
-        for (auto &id : ids_to_remove)
-        {
-            boost::property_tree::ptree pt;
-            pt.put("", id);
-            ids.push_back(std::make_pair("", pt));
-        }
-        root.add_child("ids", ids);
-
-        std::stringstream ss;
-        boost::property_tree::write_json(ss, root, false);
-        remove_entities_msg = std::make_shared<std::string const>(std::move(ss.str()));
-    }
+    profiler_.end_phase(tick_phase::reaping);
 
-    // Apply all pending patches of all connections
+    // Apply the commands of all connections, one batch per connection
     for (auto &c : conns_)
     {
         if (!c->is_ready())
             continue;
 
-        while (c->has_patch())
-        {
-            player_conn::patch p = c->pop_patch();;
-
-            try {
-                if (p.what == "speed")
-                    c->player_entity()->set_speed(any_cast<double>(p.value));
-                else if (p.what == "dir")
-                {
-                    c->player_entity()->set_dir(any_cast<vector>(p.value));
-                    c->player_entity()->stop();
-                }
-                else if (p.what == "target_pos")
-                    c->player_entity()->move_to(any_cast<vector>(p.value));
-                else
-                    WEBGAME_LOG("GAME LOOP", "ERROR during patches application: unknown value: " << p.what);
-            }
-            catch (const bad_any_cast& e) {
-                WEBGAME_LOG("GAME LOOP", "ERROR during patches application: " << e.what() << ". Conn: " << c->addr_str << ", entity: " << c->player_entity()->id() << ", value name: " << p.what);
-            }
-        }
+        player &p = *c->player_entity();
+        c->commands().drain([&p](player_conn::command const& cmd) {
+            apply_command(p, cmd);
+        });
     }
 
+    profiler_.end_phase(tick_phase::commands);
+
     // Update all entities with delta
     entities changed_entities;
     entities alive_entities;
@@ -275,44 +510,56 @@ void server::game_cycle(boost::system::error_code const& error, unsigned int nb_
         alive_entities.add(ent.second);
     }
 
+    update_entities(alive_entities, delta, changed_entities);
+
+    // Positions written during the update become visible to the next tick
     for (auto &ent : alive_entities)
     {
-        env env(alive_entities);
-        // Remove the entity from its own env so it doesn't see itself
-        env.others().erase(ent.second->id());
-        if (ent.second->update(delta, env))
-            changed_entities.add(ent.second);
+        located_entity *located = dynamic_cast<located_entity*>(ent.second.get());
+        if (located)
+            located->publish();
     }
 
-    // Save to redis, fixme: maybe just save alive entities
-    persistence_->async_save(entities_, [] {
-        //LOG("SERVER", "ENTITIES SAVED");
-    });
+    profiler_.end_phase(tick_phase::update);
 
-    // We broadcast all changes to all players
-    if (remove_entities_msg)
-        for (auto &c : server::conns_)
-            if (c->is_ready())
-                c->write(remove_entities_msg);
+    if (steady_clock::now() >= next_save_time_)
+    {
+        save_dirty_entities();
+        next_save_time_ = steady_clock::now() + save_interval_;
+    }
 
-    if (!changed_entities.empty())
+    profiler_.end_phase(tick_phase::persistence);
+
+    // Each player gets what changed, entered or left around it, every entity being serialized at most once.
+    // What a player got this tick leaves in one write.
+    fragments_.clear();
+    tick_traffic traffic;
+    for (auto &c : conns_)
     {
-        std::shared_ptr<std::string const> state_entities_msg = std::make_shared<std::string const>(json_state_entities(changed_entities));
+        if (!c->is_ready())
+            continue;
 
-        for (auto &c : server::conns_)
-            if (c->is_ready())
-            {
-                entities entities_for_player = changed_entities;
-                if (entities_for_player.erase(c->player_entity()->id()) == 0)
-                    c->write(state_entities_msg);
-                else if (!entities_for_player.empty())
-                    c->write(std::make_shared<std::string const>(json_state_entities(entities_for_player)));
-            }
+        traffic.superseded += c->take_superseded();
+
+        // Its client does not keep up: only the latest states are sent once it does
+        if (c->check_congestion())
+        {
+            for (id_t id : c->in_view())
+                if (changed_entities.count(id) != 0)
+                    c->missed_changes().insert(id);
+            traffic.bytes_queued += c->stats().queued_bytes;
+            ++traffic.congested;
+            continue;
+        }
+
+        update_view(*c, alive_entities, changed_entities, fragments_);
+        write_state_player(*c);
+        c->flush();
+        traffic.bytes_queued += c->stats().queued_bytes;
     }
 
-    for (auto &c : server::conns_)
-        if (c->is_ready())
-            c->write(std::make_shared<std::string>(json_state_player(c->player_entity())));
+    profiler_.end_phase(tick_phase::broadcast);
+    profiler_.end_tick(alive_entities.size(), changed_entities.size(), traffic);
 
     if (*stop_)
     {
@@ -330,55 +577,323 @@ void server::game_cycle(boost::system::error_code const& error, unsigned int nb_
     assert(nb_ticks >= 1);
 
     if (nb_ticks > 1)
-        WEBGAME_LOG("GAME LOOP", "RETARD OF " << nb_ticks - 1 << " TICK" << (nb_ticks - 1 > 1 ? "S" : ""));
+        WEBGAME_LOG_EVERY(1s, "GAME LOOP", "RETARD OF " << nb_ticks - 1 << " TICK" << (nb_ticks - 1 > 1 ? "S" : ""));
 
     //LOG("GAME LOOP", "NEXT CYCLE AT " << std::chrono::duration_cast<std::chrono::duration<float>>(wake_time_ - start_time_).count());
     game_cycle_timer_.expires_at(wake_time_);
-    game_cycle_timer_.async_wait(std::bind(&server::game_cycle, shared_from_this(), std::placeholders::_1, nb_ticks));
+    game_cycle_timer_.async_wait(asio::bind_executor(sim_strand_, std::bind(&server::game_cycle, shared_from_this(), std::placeholders::_1, nb_ticks)));
+}
+
+void server::update_entities(entities const& alive_entities, double delta, entities &changed_entities)
+{
+    if (alive_entities.empty())
+        return;
+
+    auto before_job = std::make_shared<update_job>();
+    before_job->phase = update_job::before_move_phase;
+    before_job->alive_entities = &alive_entities;
+    before_job->index = &index_;
+    before_job->delta = delta;
+    before_job->ents.reserve(alive_entities.size());
+    before_job->mobiles.reserve(alive_entities.size());
+
+    auto after_job = std::make_shared<update_job>();
+    after_job->phase = update_job::after_move_phase;
+    after_job->alive_entities = &alive_entities;
+    after_job->index = &index_;
+    after_job->delta = delta;
+
+    std::unordered_map<located_chunk*, mobile_batch> batches;
+    for (auto const& ent : alive_entities)
+    {
+        mobile_entity *mobile = dynamic_cast<mobile_entity*>(ent.second.get());
+        before_job->ents.push_back(&ent.second);
+        before_job->mobiles.push_back(mobile);
+        if (mobile == nullptr)
+            continue;
+
+        after_job->ents.push_back(&ent.second);
+        after_job->mobiles.push_back(mobile);
+        archetype_slot const& slot = mobile->slot();
+        mobile_batch &batch = batches[slot.chunk];
+        batch.active.set(slot.index);
+        batch.ents[slot.index] = &ent.second;
+    }
+
+    run_update_job(io_context_, update_threads_, before_job, changed_entities);
+
+    // Every mobile entity moves at once, chunk by chunk
+    for (auto &pair : batches)
+    {
+        mobile_batch const& batch = pair.second;
+        slot_mask const moved = integrate(static_cast<mobile_chunk &>(*pair.first), delta, batch.active);
+        if (moved.none())
+            continue;
+
+        for (size_t i = 0; i < chunk_capacity; ++i)
+        {
+            if (!moved[i])
+                continue;
+
+            std::shared_ptr<entity> const& ent = *batch.ents[i];
+            ent->mark_dirty();
+            if (changed_entities.find(ent->id()) == changed_entities.end())
+                changed_entities.add(ent);
+        }
+    }
+
+    run_update_job(io_context_, update_threads_, after_job, changed_entities);
+}
+
+void server::save_dirty_entities()
+{
+    entities dirty_entities;
+    for (auto const& ent : entities_)
+        if (ent.second->is_dirty())
+        {
+            dirty_entities.add(ent.second);
+            ent.second->clear_dirty();
+        }
+
+    if (dirty_entities.empty())
+        return;
+
+    // Entities are serialized right away, so they can be cleared before the save completes
+    persistence_->async_save(dirty_entities, [] {
+        //LOG("SERVER", "ENTITIES SAVED");
+    });
+}
+
+void server::update_view(player_conn &conn, entities const& visible_from, entities const& changed_entities, state_fragments &fragments)
+{
+    std::shared_ptr<player> const& self = conn.player_entity();
+
+    env view(visible_from, self.get(), &index_);
+    std::vector<id_t> now_in_view;
+    for (located_entity const* ent : view.query_radius(self->published_pos(), conn.view_radius()))
+        now_in_view.push_back(ent->id());
+    std::sort(now_in_view.begin(), now_in_view.end());
+
+    std::vector<id_t> &in_view = conn.in_view();
+
+    std::vector<id_t> left_view;
+    std::set_difference(in_view.cbegin(), in_view.cend(), now_in_view.cbegin(), now_in_view.cend(), std::back_inserter(left_view));
+    wire_format format = conn.format();
+
+    if (!left_view.empty())
+    {
+        if (format == wire_format::binary)
+        {
+            for (id_t id : left_view)
+                conn.baselines().forget(id);
+            conn.write(std::make_shared<std::string const>(binary_remove_entities(left_view)));
+        }
+        else
+            conn.write(std::make_shared<std::string const>(json_remove_entities(left_view)));
+    }
+
+    // Entities entering the view are sent whatever happened to them, the others only if they changed,
+    // during this tick or the ones skipped before
+    std::unordered_set<id_t> &missed_changes = conn.missed_changes();
+    std::vector<std::string const*> fragments_to_send;
+    std::vector<state_record const*> records_to_send;
+    auto known_it = in_view.cbegin();
+    for (id_t id : now_in_view)
+    {
+        while (known_it != in_view.cend() && *known_it < id)
+            ++known_it;
+        bool known = known_it != in_view.cend() && *known_it == id;
+        if (known && changed_entities.count(id) == 0 && missed_changes.count(id) == 0)
+            continue;
+
+        entity const& ent = *visible_from.at(id);
+        if (format == wire_format::binary)
+            records_to_send.push_back(&fragments.record(ent));
+        else
+            fragments_to_send.push_back(&fragments.get(ent));
+    }
+
+    if (!fragments_to_send.empty())
+        conn.write(std::make_shared<std::string const>(json_state_entities(fragments_to_send)));
+
+    if (!records_to_send.empty())
+    {
+        // Only the fields the client does not have yet are sent
+        std::string msg = binary_state_entities(records_to_send, conn.baselines());
+        if (!msg.empty())
+        {
+            // Rendering the records registered the type tags they use
+            conn.sync_types();
+            conn.write(std::make_shared<std::string const>(std::move(msg)));
+        }
+    }
+
+    in_view = std::move(now_in_view);
+    missed_changes.clear();
+}
+
+void server::add_entity(std::shared_ptr<entity> const& ent)
+{
+    entities_.add(ent);
+
+    located_entity *located = dynamic_cast<located_entity*>(ent.get());
+    if (located)
+        index_.insert(*located);
 }
 
-void server::on_accept(const boost::system::error_code& ec) noexcept
+void server::remove_entity(id_t id)
+{
+    auto it = entities_.find(id);
+    if (it == entities_.end())
+        return;
+
+    located_entity *located = dynamic_cast<located_entity*>(it->second.get());
+    if (located)
+        index_.remove(*located);
+
+    entities_.erase(it);
+}
+
+void server::on_accept(listener *l, const boost::system::error_code& ec) noexcept
 {
     if (ec)
     {
         if (ec.value() == 995)
             WEBGAME_LOG("SERVER ACCEPT", "INFO: operation aborted");
         else
-            WEBGAME_LOG("SERVER ACCEPT", "ERROR " << ec.value() << ": " << ec.message());
+            WEBGAME_ERROR("SERVER ACCEPT", "ERROR " << ec.value() << ": " << ec.message());
 
         boost::system::error_code ec;
-        new_client_socket_.close(ec);
+        l->socket.close(ec);
 
         if (!*stop_)
-            do_accept();
+            do_accept(l);
         return;
     }
 
-    WEBGAME_LOCK(server_mutex_);
-
     // socket can be invalid even if there is no error, calling remote_endpoint() is a way to test it
     try {
-        std::string const endpoint = new_client_socket_.remote_endpoint().address().to_string() + ":" + std::to_string(new_client_socket_.remote_endpoint().port());
+        std::string const endpoint = l->socket.remote_endpoint().address().to_string() + ":" + std::to_string(l->socket.remote_endpoint().port());
         WEBGAME_LOG("SERVER ACCEPT", "New connection from: " << endpoint);
     }
     catch (...) {
-        WEBGAME_LOG("SERVER ACCEPT", "ERROR while creating new player entity, new connection or while starting it");
+        WEBGAME_ERROR("SERVER ACCEPT", "ERROR while creating new player entity, new connection or while starting it");
         boost::system::error_code ec;
-        new_client_socket_.close(ec);
+        l->socket.close(ec);
     }
 
-    auto new_conn = std::make_shared<player_conn>(std::move(new_client_socket_), shared_from_this());
-
-    conns_.emplace_back(new_conn);
+    auto new_conn = std::make_shared<player_conn>(std::move(l->socket), shared_from_this());
 
     new_conn->start();
 
-    do_accept();
+    // The simulation takes it between two ticks, accepting does not wait for it
+    asio::post(sim_strand_, std::bind(&server::add_connection, shared_from_this(), new_conn));
+
+    do_accept(l);
+}
+
+void server::do_accept(listener *l)
+{
+    // Without SO_REUSEPORT, the only acceptor deals the connections to the shards in turn
+    asio::io_context &context = shards_ && &l->context == &io_context_ ? (*shards_)[next_shard_++ % shards_->size()] : l->context;
+    l->socket = asio::ip::tcp::socket(context);
+
+    l->acceptor.async_accept(l->socket, std::bind(&server::on_accept, shared_from_this(), l, std::placeholders::_1));
+}
+
+void server::add_connection(std::shared_ptr<player_conn> const& conn)
+{
+    if (*stop_)
+    {
+        conn->close();
+        return;
+    }
+
+    conns_.emplace_back(conn);
+}
+
+bool server::do_shutdown()
+{
+    if (shut_down_.exchange(true))
+        return false;
+
+    WEBGAME_LOG("SHUTDOWN", "Stopping game loop");
+    *stop_ = true;
+    game_cycle_timer_.cancel();
+
+    WEBGAME_LOG("SHUTDOWN", "Cancelling server accept");
+    for (auto &l : listeners_)
+        l->acceptor.cancel();
+
+    for (auto conn : conns_)
+    {
+        WEBGAME_LOG("SHUTDOWN", "Closing connection " << conn->addr_str);
+        conn->close();
+    }
+    conns_.clear();
+    logins_.clear();
+
+    WEBGAME_LOG("SHUTDOWN", "Saving changed entities");
+    save_dirty_entities();
+
+    index_.clear();
+    entities_.clear();
+
+    WEBGAME_LOG("SHUTDOWN", "Closing server socket");
+    for (auto &l : listeners_)
+        l->acceptor.close();
+
+    WEBGAME_LOG("SHUTDOWN", "Stopping persistence instance");
+    persistence_->stop();
+    return true;
+}
+
+bool server::simulation_stopped() const
+{
+    return sim_thread_.joinable() ? sim_context_.stopped() : io_context_.stopped();
+}
+
+void server::do_login(std::shared_ptr<player_conn> const& conn, std::string const& name)
+{
+    if (*stop_)
+    {
+        conn->close();
+        return;
+    }
+
+    // A closing connection does not hold its player anymore
+    auto it = logins_.find(name);
+    if (it != logins_.end() && it->second->current_state() < player_conn::closing)
+    {
+        conn->on_login(false);
+        return;
+    }
+
+    logins_[name] = conn.get();
+    conn->on_login(true);
 }
 
-void server::do_accept()
+void server::do_register_player(std::shared_ptr<player_conn> const& player_conn, std::shared_ptr<player> const& player_ent)
 {
-    acceptor_.async_accept(new_client_socket_, std::bind(&server::on_accept, shared_from_this(), std::placeholders::_1));
+    // Closed while its player was loading
+    if (*stop_ || !player_conn->start_playing(player_ent))
+        return;
+
+    double tick_duration = std::chrono::duration_cast<std::chrono::duration<double>>(tick_duration_).count();
+    if (player_conn->format() == wire_format::binary)
+        player_conn->write(std::make_shared<std::string const>(binary_state_game(tick_duration)));
+    else
+        player_conn->write(std::make_shared<std::string const>(json_state_game(tick_duration)));
+    write_state_player(*player_conn);
+
+    // The player gets what is around it right away, the others see it entering their view at next tick
+    state_fragments fragments;
+    update_view(*player_conn, entities_, entities(), fragments);
+    player_conn->flush();
+
+    add_entity(player_ent);
+
+    WEBGAME_LOG("SERVER", "PLAYER " << player_conn->player_name() << " REGISTERED");
 }
 
 } // namespace webgame
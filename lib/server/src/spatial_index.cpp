@@ -0,0 +1,168 @@
+#include "spatial_index.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include "entity.hpp"
+
+namespace webgame {
+
+spatial_index::spatial_index(double cell_size)
+    : cell_size_(cell_size)
+{
+    assert(cell_size_ > 0);
+}
+
+spatial_index::~spatial_index()
+{
+    clear();
+}
+
+void spatial_index::insert(located_entity &ent)
+{
+    assert(where_.count(&ent) == 0);
+
+    cell_key key = key_of(ent.published_pos());
+    cells_[key].push_back(&ent);
+    where_.emplace(&ent, key);
+    ent.set_index(this);
+}
+
+void spatial_index::remove(located_entity &ent)
+{
+    auto it = where_.find(&ent);
+    if (it == where_.end())
+        return;
+
+    cell_erase(it->second, &ent);
+    where_.erase(it);
+    ent.set_index(nullptr);
+}
+
+void spatial_index::move(located_entity const& ent)
+{
+    auto it = where_.find(&ent);
+    assert(it != where_.end());
+
+    cell_key key = key_of(ent.published_pos());
+    if (key == it->second)
+        return;
+
+    located_entity *ent_p = cell_erase(it->second, &ent);
+    cells_[key].push_back(ent_p);
+    it->second = key;
+}
+
+void spatial_index::clear()
+{
+    for (auto &cell : cells_)
+        for (located_entity *ent : cell.second)
+            ent->set_index(nullptr);
+    cells_.clear();
+    where_.clear();
+}
+
+size_t spatial_index::size() const
+{
+    return where_.size();
+}
+
+double spatial_index::cell_size() const
+{
+    return cell_size_;
+}
+
+spatial_index::cell_key spatial_index::key_of(vector const& pos) const
+{
+    return key_of(coord_of(pos.x()), coord_of(pos.y()));
+}
+
+spatial_index::cell_key spatial_index::key_of(std::int64_t cx, std::int64_t cy) const
+{
+    return (static_cast<cell_key>(static_cast<std::uint32_t>(cx)) << 32) | static_cast<std::uint32_t>(cy);
+}
+
+std::int64_t spatial_index::coord_of(double v) const
+{
+    return static_cast<std::int64_t>(std::floor(v / cell_size_));
+}
+
+located_entity* spatial_index::cell_erase(cell_key key, located_entity const* ent)
+{
+    auto cell_it = cells_.find(key);
+    assert(cell_it != cells_.end());
+
+    std::vector<located_entity*> &cell = cell_it->second;
+    auto ent_it = std::find(cell.begin(), cell.end(), ent);
+    assert(ent_it != cell.end());
+    located_entity *ent_p = *ent_it;
+    *ent_it = cell.back();
+    cell.pop_back();
+
+    if (cell.empty())
+        cells_.erase(cell_it);
+
+    return ent_p;
+}
+
+template<class F>
+void spatial_index::for_each_in_radius(vector const& center, double radius, F &&f) const
+{
+    std::int64_t const min_cx = coord_of(center.x() - radius);
+    std::int64_t const max_cx = coord_of(center.x() + radius);
+    std::int64_t const min_cy = coord_of(center.y() - radius);
+    std::int64_t const max_cy = coord_of(center.y() + radius);
+
+    // A huge radius would make us walk more cells than there are entities
+    if (static_cast<double>(max_cx - min_cx + 1) * static_cast<double>(max_cy - min_cy + 1) > static_cast<double>(cells_.size()))
+    {
+        for (auto const& cell : cells_)
+            for (located_entity const* ent : cell.second)
+            {
+                double dist = (ent->published_pos() - center).norm();
+                if (dist <= radius)
+                    f(*ent, dist);
+            }
+        return;
+    }
+
+    for (std::int64_t cx = min_cx; cx <= max_cx; ++cx)
+        for (std::int64_t cy = min_cy; cy <= max_cy; ++cy)
+        {
+            auto cell_it = cells_.find(key_of(cx, cy));
+            if (cell_it == cells_.end())
+                continue;
+            for (located_entity const* ent : cell_it->second)
+            {
+                double dist = (ent->published_pos() - center).norm();
+                if (dist <= radius)
+                    f(*ent, dist);
+            }
+        }
+}
+
+std::vector<located_entity const*> spatial_index::query_radius(vector const& center, double radius) const
+{
+    std::vector<located_entity const*> found;
+    for_each_in_radius(center, radius, [&found](located_entity const& ent, double) {
+        found.push_back(&ent);
+    });
+    return found;
+}
+
+located_entity const* spatial_index::nearest(vector const& center, double radius, filter const& f) const
+{
+    located_entity const* closest = nullptr;
+    double closest_dist = std::numeric_limits<double>::max();
+    for_each_in_radius(center, radius, [&](located_entity const& ent, double dist) {
+        if (dist >= closest_dist || (f && !f(ent)))
+            return;
+        closest = &ent;
+        closest_dist = dist;
+    });
+    return closest;
+}
+
+} // namespace webgame
@@ -8,7 +8,7 @@ stationnary_entity::stationnary_entity(std::string const& type, vector const& po
     : located_entity(type, pos)
 {}
 
-bool stationnary_entity::update(double d, env & env)
+bool stationnary_entity::update(double d, env const& env)
 {
     return false;
 }
@@ -0,0 +1,373 @@
+#include "tick_profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "lock.hpp"
+
+namespace webgame {
+
+namespace {
+
+char const* const phase_names[nb_tick_phases] = {
+    "reaping",
+    "commands",
+    "update",
+    "persistence",
+    "broadcast"
+};
+
+uint64_t to_ns(steady_clock::duration d)
+{
+    return static_cast<uint64_t>(std::max<std::chrono::nanoseconds::rep>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), 0));
+}
+
+double to_seconds(steady_clock::duration d)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+}
+
+double to_us(steady_clock::duration d)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(d).count();
+}
+
+nlohmann::json histogram_json(latency_histogram const& h)
+{
+    return {
+        { "count", h.count() },
+        { "mean_us", h.mean() / 1000 },
+        { "p50_us", h.percentile(50) / 1000. },
+        { "p90_us", h.percentile(90) / 1000. },
+        { "p99_us", h.percentile(99) / 1000. },
+        { "p999_us", h.percentile(99.9) / 1000. },
+        { "max_us", h.max() / 1000. }
+    };
+}
+
+std::string histogram_line(char const* name, latency_histogram const& h)
+{
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1)
+        << std::setw(12) << name
+        << ": p50 " << h.percentile(50) / 1000. << "us"
+        << ", p90 " << h.percentile(90) / 1000. << "us"
+        << ", p99 " << h.percentile(99) / 1000. << "us"
+        << ", max " << h.max() / 1000. << "us"
+        << ", mean " << h.mean() / 1000 << "us";
+    return line.str();
+}
+
+} // namespace
+
+char const* tick_phase_name(tick_phase phase)
+{
+    return phase_names[static_cast<size_t>(phase)];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+latency_histogram::latency_histogram()
+{
+    clear();
+}
+
+void latency_histogram::record(uint64_t value)
+{
+    ++counts_[bucket(value)];
+    ++count_;
+    sum_ += value;
+    max_ = std::max(max_, value);
+}
+
+void latency_histogram::merge(latency_histogram const& other)
+{
+    for (size_t i = 0; i < nb_buckets; ++i)
+        counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+}
+
+void latency_histogram::clear()
+{
+    counts_.fill(0);
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+}
+
+uint64_t latency_histogram::count() const
+{
+    return count_;
+}
+
+uint64_t latency_histogram::max() const
+{
+    return max_;
+}
+
+double latency_histogram::mean() const
+{
+    return count_ == 0 ? 0 : static_cast<double>(sum_) / count_;
+}
+
+uint64_t latency_histogram::percentile(double p) const
+{
+    if (count_ == 0)
+        return 0;
+
+    uint64_t const rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(std::min(std::max(p, 0.), 100.) / 100 * count_)), 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < nb_buckets; ++i)
+    {
+        seen += counts_[i];
+        if (seen >= rank)
+            return std::min(highest_value(i), max_);
+    }
+    return max_;
+}
+
+size_t latency_histogram::bucket(uint64_t value)
+{
+    if (value < sub_count)
+        return static_cast<size_t>(value);
+
+    // Position of the highest bit, at least sub_bits
+    unsigned int high = 0;
+    for (uint64_t v = value; v >>= 1;)
+        ++high;
+
+    // The bits under the highest one tell the sub bucket
+    size_t const sub = static_cast<size_t>(value >> (high - sub_bits)) & (sub_count - 1);
+    return (high - sub_bits + 1) * sub_count + sub;
+}
+
+uint64_t latency_histogram::highest_value(size_t bucket)
+{
+    if (bucket < sub_count)
+        return bucket;
+
+    unsigned int const high = static_cast<unsigned int>(bucket / sub_count) + sub_bits - 1;
+    uint64_t const sub = bucket % sub_count;
+    uint64_t const lowest = (sub_count + sub) << (high - sub_bits);
+    return lowest + (uint64_t(1) << (high - sub_bits)) - 1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+tick_profiler::tick_profiler(size_t history_size, steady_clock::duration slice_duration, size_t nb_slices)
+    : current_()
+    , slice_duration_(slice_duration)
+    , slices_(std::max<size_t>(nb_slices, 1))
+    , slice_(0)
+    , history_(std::max<size_t>(history_size, 1))
+    , next_(0)
+    , nb_ticks_(0)
+    , entities_updated_(0)
+    , superseded_(0)
+    , skipped_ticks_(0)
+{
+    slices_[0].start = steady_clock::now();
+}
+
+void tick_profiler::start_tick()
+{
+    tick_start_ = steady_clock::now();
+    phase_start_ = tick_start_;
+    current_.phases.fill(steady_clock::duration::zero());
+}
+
+void tick_profiler::end_phase(tick_phase phase)
+{
+    steady_clock::time_point const now = steady_clock::now();
+    current_.phases[static_cast<size_t>(phase)] += now - phase_start_;
+    phase_start_ = now;
+}
+
+void tick_profiler::end_tick(size_t entities_updated, size_t entities_changed, tick_traffic const& traffic)
+{
+    steady_clock::time_point const now = steady_clock::now();
+    current_.total = now - tick_start_;
+    current_.entities_updated = entities_updated;
+    current_.entities_changed = entities_changed;
+    current_.traffic = traffic;
+
+    WEBGAME_LOCK(mutex_);
+
+    // The oldest slice makes room for the next one. After a pause, the
+    // slices older than the window are skipped by the queries.
+    if (now - slices_[slice_].start >= slice_duration_)
+    {
+        slice_ = (slice_ + 1) % slices_.size();
+        latency_slice &next = slices_[slice_];
+        for (latency_histogram &h : next.phases)
+            h.clear();
+        next.total.clear();
+        next.start = now;
+    }
+
+    latency_slice &slice = slices_[slice_];
+    for (size_t i = 0; i < nb_tick_phases; ++i)
+        slice.phases[i].record(to_ns(current_.phases[i]));
+    slice.total.record(to_ns(current_.total));
+
+    history_[next_ % history_.size()] = current_;
+    ++next_;
+    ++nb_ticks_;
+    entities_updated_ += entities_updated;
+    superseded_ += traffic.superseded;
+    skipped_ticks_ += traffic.congested;
+}
+
+uint64_t tick_profiler::nb_ticks() const
+{
+    WEBGAME_LOCK(mutex_);
+
+    return nb_ticks_;
+}
+
+steady_clock::duration tick_profiler::window() const
+{
+    return slice_duration_ * static_cast<steady_clock::rep>(slices_.size());
+}
+
+latency_histogram tick_profiler::histogram(tick_phase phase) const
+{
+    WEBGAME_LOCK(mutex_);
+
+    std::array<latency_histogram, nb_tick_phases> phases;
+    latency_histogram total;
+    merge_window(phases, total);
+    return phases[static_cast<size_t>(phase)];
+}
+
+latency_histogram tick_profiler::total_histogram() const
+{
+    WEBGAME_LOCK(mutex_);
+
+    std::array<latency_histogram, nb_tick_phases> phases;
+    latency_histogram total;
+    merge_window(phases, total);
+    return total;
+}
+
+std::vector<tick_breakdown> tick_profiler::history() const
+{
+    WEBGAME_LOCK(mutex_);
+
+    size_t const size = std::min(next_, history_.size());
+    std::vector<tick_breakdown> ticks;
+    ticks.reserve(size);
+    for (size_t i = next_ - size; i < next_; ++i)
+        ticks.push_back(history_[i % history_.size()]);
+    return ticks;
+}
+
+std::vector<std::string> tick_profiler::summary() const
+{
+    WEBGAME_LOCK(mutex_);
+
+    std::array<latency_histogram, nb_tick_phases> phases;
+    latency_histogram total;
+    merge_window(phases, total);
+
+    std::vector<std::string> lines;
+    {
+        std::ostringstream line;
+        line << "Ticks: " << nb_ticks_ << ", entities updated: " << entities_updated_
+            << ", states superseded: " << superseded_ << ", ticks skipped: " << skipped_ticks_
+            << ", latencies of the last " << to_seconds(window()) << "s";
+        if (next_ != 0)
+        {
+            tick_breakdown const& last = history_[(next_ - 1) % history_.size()];
+            line << ", last tick: " << last.entities_updated << " entities updated, "
+                << last.entities_changed << " changed, " << last.traffic.bytes_queued << " bytes queued, "
+                << last.traffic.superseded << " states superseded, " << last.traffic.congested << " connections congested";
+        }
+        lines.push_back(line.str());
+    }
+    for (size_t i = 0; i < nb_tick_phases; ++i)
+        lines.push_back(histogram_line(phase_names[i], phases[i]));
+    lines.push_back(histogram_line("total", total));
+    return lines;
+}
+
+nlohmann::json tick_profiler::dump() const
+{
+    WEBGAME_LOCK(mutex_);
+
+    std::array<latency_histogram, nb_tick_phases> window_phases;
+    latency_histogram window_total;
+    merge_window(window_phases, window_total);
+
+    nlohmann::json phases;
+    for (size_t i = 0; i < nb_tick_phases; ++i)
+        phases[phase_names[i]] = histogram_json(window_phases[i]);
+    phases["total"] = histogram_json(window_total);
+
+    nlohmann::json ticks = nlohmann::json::array();
+    size_t const size = std::min(next_, history_.size());
+    for (size_t i = next_ - size; i < next_; ++i)
+    {
+        tick_breakdown const& tick = history_[i % history_.size()];
+        nlohmann::json t;
+        for (size_t p = 0; p < nb_tick_phases; ++p)
+            t[std::string(phase_names[p]) + "_us"] = to_us(tick.phases[p]);
+        t["total_us"] = to_us(tick.total);
+        t["entities_updated"] = tick.entities_updated;
+        t["entities_changed"] = tick.entities_changed;
+        t["bytes_queued"] = tick.traffic.bytes_queued;
+        t["superseded"] = tick.traffic.superseded;
+        t["congested"] = tick.traffic.congested;
+        ticks.push_back(t);
+    }
+
+    return {
+        { "ticks", nb_ticks_ },
+        { "entities_updated", entities_updated_ },
+        { "superseded", superseded_ },
+        { "skipped_ticks", skipped_ticks_ },
+        // The phases are those of the window, the counts above since the start or the reset
+        { "window_s", to_seconds(window()) },
+        { "phases", phases },
+        { "history", ticks }
+    };
+}
+
+void tick_profiler::reset()
+{
+    WEBGAME_LOCK(mutex_);
+
+    for (latency_slice &slice : slices_)
+    {
+        for (latency_histogram &h : slice.phases)
+            h.clear();
+        slice.total.clear();
+        slice.start = steady_clock::time_point();
+    }
+    slice_ = 0;
+    slices_[0].start = steady_clock::now();
+    next_ = 0;
+    nb_ticks_ = 0;
+    entities_updated_ = 0;
+    superseded_ = 0;
+    skipped_ticks_ = 0;
+}
+
+void tick_profiler::merge_window(std::array<latency_histogram, nb_tick_phases> &phases, latency_histogram &total) const
+{
+    steady_clock::time_point const now = steady_clock::now();
+    for (latency_slice const& slice : slices_)
+    {
+        if (now - slice.start >= window())
+            continue;
+        for (size_t i = 0; i < nb_tick_phases; ++i)
+            phases[i].merge(slice.phases[i]);
+        total.merge(slice.total);
+    }
+}
+
+} // namespace webgame
@@ -2,27 +2,14 @@
 
 namespace webgame {
 
-vector::vector(std::initializer_list<value_type> const& l)
-{
-    assert(l.size() == 2);
-    auto it = l.begin();
-    (*this)[0] = *it;
-    ++it;
-    (*this)[1] = *it;
-}
-
-vector::vector(double x, double y)
-{
-    (*this)[0] = x;
-    (*this)[1] = y;
-}
-
-nlohmann::json vector::save() const
+template<class T>
+nlohmann::json basic_vec2<T>::save() const
 {
     return { {"x", x()}, {"y", y()} };
 }
 
-void vector::load(nlohmann::json const& j)
+template<class T>
+void basic_vec2<T>::load(nlohmann::json const& j)
 {
     if (!j.is_object()
         || !j.count("x")
@@ -31,49 +18,11 @@ void vector::load(nlohmann::json const& j)
         || !j["y"].is_number_float())
         throw std::runtime_error("vector: invalid JSON");
 
-    (*this)[0] = j["x"].get<double>();
-    (*this)[1] = j["y"].get<double>();
-}
-
-bool vector::operator==(vector const& other) const
-{
-    return (*this)[0] == other[0] && (*this)[1] == other[1];
-}
-
-bool vector::operator!=(vector const& other) const
-{
-    return !(*this == other);
-}
-
-double const& vector::x() const
-{
-    return (*this)[0];
+    xy_[0] = j["x"].get<T>();
+    xy_[1] = j["y"].get<T>();
 }
 
-double const& vector::y() const
-{
-    return (*this)[1];
-}
-
-double vector::norm() const
-{
-    return ublas::norm_2(*this);
-}
-
-vector vector::normalized() const
-{
-    return *this / norm();
-}
-
-void vector::normalize()
-{
-    *this /= norm();
-}
-
-std::ostream &operator<<(std::ostream &os, vector const&v)
-{
-    os << "(" << v[0] << "," << v[1] << ")";
-    return os;
-}
+template class basic_vec2<double>;
+template class basic_vec2<float>;
 
 } // namespace webgame
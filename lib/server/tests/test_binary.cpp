@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+
+#include <webgame/binary.hpp>
+#include <webgame/entities.hpp>
+#include <webgame/npc.hpp>
+#include <webgame/player.hpp>
+#include <webgame/protocol.hpp>
+
+TEST(binary, reader_writer)
+{
+    std::string data;
+    webgame::binary_writer w(data);
+    w.u8(0x12);
+    w.u16(0x3456);
+    w.u32(0x789abcde);
+    w.f32(1.5);
+    w.f64(-2.2);
+    w.str("player");
+
+    ASSERT_EQ(1 + 2 + 4 + 4 + 8 + 1 + 6, data.size());
+    // Little endian
+    ASSERT_EQ('\x56', data[1]);
+    ASSERT_EQ('\x34', data[2]);
+
+    webgame::binary_reader r(data);
+    ASSERT_EQ(0x12, r.u8());
+    ASSERT_EQ(0x3456, r.u16());
+    ASSERT_EQ(0x789abcdeu, r.u32());
+    ASSERT_EQ(1.5, r.f32());
+    ASSERT_EQ(-2.2, r.f64());
+    ASSERT_EQ("player", r.str());
+    ASSERT_TRUE(r.at_end());
+
+    ASSERT_THROW(r.u8(), std::runtime_error);
+
+    std::string truncated = data.substr(0, 2);
+    webgame::binary_reader tr(truncated);
+    ASSERT_EQ(0x12, tr.u8());
+    ASSERT_THROW(tr.u16(), std::runtime_error);
+}
+
+TEST(binary, state_player)
+{
+    std::shared_ptr<webgame::player> ent = std::make_shared<webgame::player>();
+    ent->set_pos({1.5, -2.5});
+    ent->set_dir({-3.25, 4.75});
+    ent->set_speed(0.5);
+
+    std::string msg = webgame::binary_state_player(ent);
+
+    webgame::binary_reader r(msg);
+    ASSERT_EQ(webgame::order_state_player, r.u8());
+    ASSERT_EQ(ent->id(), r.u32());
+    ASSERT_EQ(webgame::all_fields, r.u8());
+    ASSERT_EQ(webgame::entity_type("player").tag(), r.u16());
+    ASSERT_EQ(1.5, r.f32());
+    ASSERT_EQ(-2.5, r.f32());
+    ASSERT_EQ(-3.25, r.f32());
+    ASSERT_EQ(4.75, r.f32());
+    ASSERT_EQ(0.5, r.f32());
+    ASSERT_TRUE(r.at_end());
+}
+
+TEST(binary, state_entities)
+{
+    webgame::entities ents;
+    std::shared_ptr<webgame::npc> npc = std::make_shared<webgame::npc>("type1", webgame::vector({ 0, 1 }), webgame::vector({ 2, 3 }), 0, 0, webgame::npc::behaviors());
+    ents.add(npc);
+    ents.add(std::make_shared<webgame::player>());
+
+    webgame::state_baselines baselines;
+    auto records_of = [&ents](webgame::state_fragments &fragments) {
+        std::vector<webgame::state_record const*> records;
+        for (auto const& pair : ents)
+            records.push_back(&fragments.record(*pair.second));
+        return records;
+    };
+
+    // Unknown entities are sent whole
+    {
+        webgame::state_fragments fragments;
+        std::string msg = webgame::binary_state_entities(records_of(fragments), baselines);
+        ASSERT_EQ(5 + 2 * 27, msg.size());
+
+        webgame::binary_reader r(msg);
+        ASSERT_EQ(webgame::order_state_entities, r.u8());
+        ASSERT_EQ(2, r.u32());
+        for (auto const& pair : ents)
+        {
+            ASSERT_EQ(pair.first, r.u32());
+            ASSERT_EQ(webgame::all_fields, r.u8());
+            ASSERT_EQ(pair.second->type().tag(), r.u16());
+            for (int i = 0; i < 5; ++i)
+                r.f32();
+        }
+        ASSERT_TRUE(r.at_end());
+        ASSERT_EQ(2, baselines.size());
+    }
+
+    // Nothing changed, nothing to send
+    {
+        webgame::state_fragments fragments;
+        ASSERT_TRUE(webgame::binary_state_entities(records_of(fragments), baselines).empty());
+    }
+
+    // Only what changed is sent
+    npc->set_pos({ 0.5, 1 });
+    {
+        webgame::state_fragments fragments;
+        std::string msg = webgame::binary_state_entities(records_of(fragments), baselines);
+
+        webgame::binary_reader r(msg);
+        ASSERT_EQ(webgame::order_state_entities, r.u8());
+        ASSERT_EQ(1, r.u32());
+        ASSERT_EQ(npc->id(), r.u32());
+        ASSERT_EQ(webgame::field_pos, r.u8());
+        ASSERT_EQ(0.5, r.f32());
+        ASSERT_EQ(1, r.f32());
+        ASSERT_TRUE(r.at_end());
+    }
+
+    // A forgotten entity is sent whole again
+    baselines.forget(npc->id());
+    {
+        webgame::state_fragments fragments;
+        std::string msg = webgame::binary_state_entities(records_of(fragments), baselines);
+        ASSERT_EQ(5 + 27, msg.size());
+    }
+}
+
+TEST(binary, types)
+{
+    std::uint16_t tag = webgame::entity_type("binary_test_type").tag();
+    ASSERT_EQ(tag, webgame::entity_type("binary_test_type").tag());
+    ASSERT_LT(tag, webgame::entity_type::count());
+
+    std::string msg = webgame::binary_types(tag, tag + 1);
+
+    webgame::binary_reader r(msg);
+    ASSERT_EQ(webgame::order_types, r.u8());
+    ASSERT_EQ(tag, r.u16());
+    ASSERT_EQ(1, r.u16());
+    ASSERT_EQ("binary_test_type", r.str());
+    ASSERT_TRUE(r.at_end());
+}
+
+TEST(binary, remove_entities)
+{
+    std::string msg = webgame::binary_remove_entities({ 3, 1 });
+
+    webgame::binary_reader r(msg);
+    ASSERT_EQ(webgame::order_remove_entities, r.u8());
+    ASSERT_EQ(2, r.u32());
+    ASSERT_EQ(3, r.u32());
+    ASSERT_EQ(1, r.u32());
+    ASSERT_TRUE(r.at_end());
+}
@@ -4,6 +4,7 @@
 #include <webgame/env.hpp>
 #include <webgame/npc.hpp>
 #include <webgame/player.hpp>
+#include <webgame/stationnary_entity.hpp>
 
 #include "tests.hpp"
 
@@ -72,3 +73,205 @@ TEST(entity, player)
     ASSERT_FALSE(p.is_moving_to());
     ASSERT_EQ(webgame::vector({ 0, 0 }), p.pos());
 }
+
+TEST(entity, env)
+{
+    auto p1 = std::make_shared<webgame::player>();
+    auto p2 = std::make_shared<webgame::player>();
+    auto p3 = std::make_shared<webgame::player>();
+    webgame::entities ents({ p1, p2, p3 });
+
+    webgame::env full_env(ents);
+    ASSERT_EQ(3, full_env.size());
+    ASSERT_EQ(3, std::distance(full_env.begin(), full_env.end()));
+
+    for (auto const& self : ents)
+    {
+        webgame::env env(ents, self.second.get());
+        ASSERT_EQ(2, env.size());
+        size_t seen = 0;
+        for (auto const& other : env.others())
+        {
+            ASSERT_NE(self.second, other.second);
+            ++seen;
+        }
+        ASSERT_EQ(2, seen);
+    }
+
+    webgame::entities single({ p1 });
+    webgame::env alone_env(single, p1.get());
+    ASSERT_TRUE(alone_env.empty());
+    ASSERT_EQ(0, alone_env.size());
+}
+
+TEST(entity, dirty)
+{
+    auto p = std::make_shared<webgame::player>();
+    p->set_max_speed(1);
+
+    // Never saved
+    ASSERT_TRUE(p->is_dirty());
+    p->clear_dirty();
+
+    // Setting the same values changes nothing
+    p->set_pos(p->pos());
+    p->set_dir(p->dir());
+    p->set_speed(p->speed());
+    ASSERT_FALSE(p->is_dirty());
+
+    p->set_speed(0.5);
+    ASSERT_TRUE(p->is_dirty());
+    p->clear_dirty();
+
+    p->set_dir({ 1, 0 });
+    ASSERT_TRUE(p->is_dirty());
+    p->clear_dirty();
+
+    // Moving makes it dirty, standing still does not
+    webgame::entities ents({ p });
+    p->update(1, webgame::env(ents, p.get()));
+    ASSERT_TRUE(p->is_dirty());
+    p->clear_dirty();
+
+    p->set_speed(0);
+    p->clear_dirty();
+    p->update(1, webgame::env(ents, p.get()));
+    ASSERT_FALSE(p->is_dirty());
+
+    // Loaded entities are up to date with their save
+    auto loaded = std::make_shared<webgame::player>();
+    loaded->load(p->save());
+    ASSERT_FALSE(loaded->is_dirty());
+}
+
+TEST(entity, archetype)
+{
+    size_t const nb_mobiles = webgame::mobile_archetype().size();
+    size_t const nb_located = webgame::located_archetype().size();
+
+    auto p1 = std::make_shared<webgame::player>();
+    auto p2 = std::make_shared<webgame::player>();
+    auto o = std::make_shared<webgame::stationnary_entity>("object", webgame::vector({ 1, 2 }));
+    ASSERT_EQ(nb_mobiles + 2, webgame::mobile_archetype().size());
+    ASSERT_EQ(nb_located + 1, webgame::located_archetype().size());
+
+    // Components are the entries of the chunk arrays
+    p1->set_pos({ 3, 4 });
+    webgame::archetype_slot const slot1 = p1->slot();
+    ASSERT_EQ(&p1->pos(), &slot1.chunk->pos[slot1.index]);
+    ASSERT_EQ(p1.get(), slot1.chunk->owner[slot1.index]);
+    ASSERT_EQ(webgame::vector({ 3, 4 }), slot1.chunk->pos[slot1.index]);
+    ASSERT_EQ(&p1->speed(), &static_cast<webgame::mobile_chunk *>(slot1.chunk)->speed[slot1.index]);
+    ASSERT_EQ(webgame::vector({ 1, 2 }), o->slot().chunk->pos[o->slot().index]);
+
+    // Freed slots are reused lowest first
+    p1.reset();
+    ASSERT_EQ(nb_mobiles + 1, webgame::mobile_archetype().size());
+    ASSERT_EQ(nullptr, slot1.chunk->owner[slot1.index]);
+    auto p3 = std::make_shared<webgame::player>();
+    ASSERT_LE(std::make_pair(p3->slot().chunk_index, p3->slot().index), std::make_pair(slot1.chunk_index, slot1.index));
+    ASSERT_EQ(webgame::vector({ 0, 0 }), p3->pos());
+
+    size_t nb_owners = 0;
+    webgame::mobile_archetype().for_each_chunk([&nb_owners](webgame::mobile_chunk &chunk) {
+        for (std::uint32_t i = 0; i < chunk.size; ++i)
+            if (chunk.owner[i] != nullptr)
+                ++nb_owners;
+    });
+    ASSERT_EQ(webgame::mobile_archetype().size(), nb_owners);
+}
+
+TEST(entity, container)
+{
+    std::vector<std::shared_ptr<webgame::entity>> all;
+    webgame::entities ents;
+    for (int i = 0; i < 100; ++i)
+    {
+        all.push_back(std::make_shared<webgame::stationnary_entity>("object", webgame::vector({ double(i), 0 })));
+        ASSERT_EQ(all.back(), ents.add(all.back()));
+    }
+    ASSERT_EQ(100, ents.size());
+
+    // Every other entity is erased, the others are still found
+    for (int i = 0; i < 100; i += 2)
+        ASSERT_EQ(1, ents.erase(all[i]->id()));
+    ASSERT_EQ(0, ents.erase(all[0]->id()));
+    ASSERT_EQ(50, ents.size());
+    for (int i = 0; i < 100; ++i)
+    {
+        ASSERT_EQ(i % 2, ents.count(all[i]->id()));
+        if (i % 2)
+            ASSERT_EQ(all[i], ents.at(all[i]->id()));
+        else
+            ASSERT_THROW(ents.at(all[i]->id()), std::out_of_range);
+    }
+
+    // Erasing while iterating
+    for (auto it = ents.cbegin(); it != ents.cend();)
+        it = ents.erase(it);
+    ASSERT_TRUE(ents.empty());
+    ASSERT_TRUE(ents.find(all[1]->id()) == ents.cend());
+}
+
+TEST(entity, views)
+{
+    auto o = std::make_shared<webgame::stationnary_entity>("object", webgame::vector({ 1, 2 }));
+    auto n = std::make_shared<webgame::npc>("npc", webgame::vector({ 0, 0 }), webgame::vector({ 1, 0 }), 1, 1);
+    auto p = std::make_shared<webgame::player>();
+    webgame::entities ents({ o, n, p });
+
+    ASSERT_EQ(3, ents.view<webgame::located_entity>().size());
+    ASSERT_EQ(2, ents.view<webgame::mobile_entity>().size());
+    ASSERT_EQ(1, ents.view<webgame::npc>().size());
+    for (webgame::stationnary_entity &s : ents.view<webgame::stationnary_entity>())
+        ASSERT_EQ(o.get(), &s);
+
+    // Membership lists follow the changes of the container
+    ents.erase(o->id());
+    ASSERT_EQ(2, ents.view<webgame::located_entity>().size());
+    ASSERT_TRUE(ents.view<webgame::stationnary_entity>().empty());
+    auto p2 = std::make_shared<webgame::player>();
+    ents.add(p2);
+    ents.erase(p->id());
+    std::vector<webgame::entity const*> players;
+    for (auto it = ents.view<webgame::player>().begin(); it != ents.view<webgame::player>().end(); ++it)
+    {
+        players.push_back(&*it);
+        ASSERT_EQ(it.ptr().get(), &*it);
+    }
+    ASSERT_EQ(std::vector<webgame::entity const*>({ p2.get() }), players);
+    ASSERT_EQ(2, ents.view<webgame::mobile_entity>().size());
+
+    // Views of a copy
+    webgame::entities copy = ents;
+    ASSERT_EQ(1, copy.view<webgame::npc>().size());
+    ASSERT_EQ(n.get(), &*copy.view<webgame::npc>().begin());
+}
+
+TEST(entity, types)
+{
+    webgame::entity_type const player("player");
+    ASSERT_EQ(player, webgame::entity_type("player"));
+    ASSERT_EQ("player", player.name());
+    ASSERT_TRUE(player.has(webgame::entity_type::player_trait));
+    ASSERT_FALSE(player.has(webgame::entity_type::object_trait));
+    ASSERT_TRUE(webgame::entity_type("test_object").has(webgame::entity_type::object_trait));
+    ASSERT_EQ(player.tag(), webgame::player().type().tag());
+
+    // Not loaded yet
+    ASSERT_EQ(0, webgame::entity_type().tag());
+    ASSERT_EQ("", webgame::entity_type().name());
+
+    // Each type is its own faction, unless declared otherwise
+    webgame::entity_type const orc = webgame::entity_type::declare("test_orc", 0);
+    webgame::entity_type const goblin = webgame::entity_type::declare("test_goblin", 0, orc);
+    ASSERT_NE(orc, goblin);
+    ASSERT_EQ(orc.faction(), goblin.faction());
+    ASSERT_NE(orc.faction(), player.faction());
+    ASSERT_EQ(goblin.faction(), webgame::entity_type("test_goblin").faction());
+    ASSERT_NO_THROW(webgame::entity_type::declare("test_goblin", 0, orc));
+    ASSERT_THROW(webgame::entity_type::declare("test_goblin", webgame::entity_type::object_trait, orc), std::runtime_error);
+    ASSERT_THROW(webgame::entity_type::declare("player", 0), std::runtime_error);
+
+    ASSERT_THROW(webgame::entity_type::name_of(static_cast<webgame::entity_type::tag_type>(webgame::entity_type::count())), std::out_of_range);
+}
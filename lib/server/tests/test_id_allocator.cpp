@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include <webgame/id_allocator.hpp>
+#include <webgame/player.hpp>
+
+#include "tests.hpp"
+
+using ids = webgame::id_allocator;
+
+TEST(id_allocator, reuse)
+{
+    ids alloc;
+
+    ASSERT_EQ(ids::make_id(0, 0), alloc.allocate());
+    ASSERT_EQ(ids::make_id(1, 0), alloc.allocate());
+    ASSERT_EQ(ids::make_id(2, 0), alloc.allocate());
+    ASSERT_EQ(3, alloc.size());
+
+    // Lowest index first, with the next generation
+    alloc.release(ids::make_id(2, 0));
+    alloc.release(ids::make_id(0, 0));
+    ASSERT_FALSE(alloc.in_use(ids::make_id(0, 0)));
+    ASSERT_EQ(1, alloc.size());
+    ASSERT_EQ(ids::make_id(0, 1), alloc.allocate());
+    ASSERT_EQ(ids::make_id(2, 1), alloc.allocate());
+    ASSERT_EQ(ids::make_id(3, 0), alloc.allocate());
+
+    ASSERT_EQ(5u, ids::index_of(ids::make_id(5, 7)));
+    ASSERT_EQ(7u, ids::generation_of(ids::make_id(5, 7)));
+    ASSERT_EQ(ids::max_generation, ids::generation_of(~webgame::id_t(0)));
+}
+
+TEST(id_allocator, claim)
+{
+    ids alloc;
+
+    // Slots skipped by a claimed id are handed out later
+    webgame::id_t const persisted = ids::make_id(2, 5);
+    alloc.claim(persisted);
+    ASSERT_TRUE(alloc.in_use(persisted));
+    ASSERT_EQ(ids::make_id(0, 0), alloc.allocate());
+    ASSERT_EQ(ids::make_id(1, 0), alloc.allocate());
+    ASSERT_EQ(ids::make_id(3, 0), alloc.allocate());
+
+    // Same id twice, as a loaded copy of a living entity
+    alloc.claim(persisted);
+    alloc.release(persisted);
+    ASSERT_TRUE(alloc.in_use(persisted));
+
+    alloc.release(persisted);
+    ASSERT_FALSE(alloc.in_use(persisted));
+    ASSERT_EQ(ids::make_id(2, 6), alloc.allocate());
+}
+
+TEST(id_allocator, load)
+{
+    ids alloc;
+
+    // As load_all_npes, whatever the order of the keys: the stored ids are
+    // pinned, then each entity is built with an id and claims its stored one
+    webgame::id_t const stored[] = { ids::make_id(3, 0), ids::make_id(0, 0) };
+    for (webgame::id_t id : stored)
+        alloc.pin(id);
+    for (webgame::id_t id : stored)
+    {
+        webgame::id_t const built_with = alloc.allocate();
+        ASSERT_NE(ids::index_of(id), ids::index_of(built_with));
+        alloc.claim(id);
+        alloc.release(built_with);
+    }
+    ASSERT_EQ(2u, alloc.size());
+}
+
+TEST(id_allocator, legacy)
+{
+    ids alloc;
+
+    // Two random ids of the same slot: the second is kept outside the slots
+    webgame::id_t const first = ids::make_id(1, 3);
+    webgame::id_t const second = ids::make_id(1, 8);
+    alloc.pin(first);
+    alloc.pin(second);
+    alloc.claim(second);
+    ASSERT_TRUE(alloc.in_use(first));
+    ASSERT_TRUE(alloc.in_use(second));
+    ASSERT_EQ(2u, alloc.size());
+    alloc.release(second);
+    ASSERT_TRUE(alloc.in_use(second));
+
+    // Same when the slot is only carried: it is pinned from then on
+    webgame::id_t const carried = alloc.allocate();
+    webgame::id_t const other = ids::make_id(ids::index_of(carried), 4);
+    alloc.claim(other);
+    alloc.release(carried);
+    ASSERT_TRUE(alloc.in_use(carried));
+    ASSERT_TRUE(alloc.in_use(other));
+    ASSERT_NE(ids::index_of(carried), ids::index_of(alloc.allocate()));
+}
+
+TEST(id_allocator, pin)
+{
+    ids alloc;
+
+    webgame::id_t const saved = alloc.allocate();
+    alloc.pin(saved);
+    alloc.release(saved);
+
+    // Still reserved for whoever loads it back
+    ASSERT_TRUE(alloc.in_use(saved));
+    ASSERT_NE(ids::index_of(saved), ids::index_of(alloc.allocate()));
+    alloc.claim(saved);
+}
+
+TEST(id_allocator, entities)
+{
+    auto p = std::make_shared<webgame::player>();
+    webgame::id_t const id = p->id();
+    ASSERT_TRUE(webgame::entity_ids().in_use(id));
+
+    // A loaded entity keeps its persisted id and frees the one it was built with
+    auto loaded = std::make_shared<webgame::player>();
+    webgame::id_t const built_with = loaded->id();
+    loaded->load(p->save());
+    ASSERT_EQ(id, loaded->id());
+    ASSERT_FALSE(webgame::entity_ids().in_use(built_with));
+
+    p.reset();
+    ASSERT_TRUE(webgame::entity_ids().in_use(id));
+    loaded.reset();
+    ASSERT_FALSE(webgame::entity_ids().in_use(id));
+}
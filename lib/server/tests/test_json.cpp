@@ -5,6 +5,7 @@
 #include <webgame/behavior.hpp>
 #include <webgame/entities.hpp>
 #include <webgame/npc.hpp>
+#include <webgame/order_parser.hpp>
 #include <webgame/player.hpp>
 #include <webgame/protocol.hpp>
 
@@ -128,3 +129,102 @@ TEST(json, state_entities)
     ASSERT_TRUE(j["data"][1]["dir"].count("y"));
     ASSERT_TRUE(j["data"][1].count("speed"));
 }
+
+TEST(json, remove_entities)
+{
+    std::string ids_json;
+    ASSERT_NO_THROW(ids_json = webgame::json_remove_entities({ 3, 1, 2 }));
+
+    ASSERT_EQ(std::string::npos, ids_json.find('\n'));
+
+    auto j = nlohmann::json::parse(ids_json);
+
+    ASSERT_TRUE(j.is_object());
+    ASSERT_EQ("remove", j["order"].get<std::string>());
+    ASSERT_EQ("entities", j["suborder"].get<std::string>());
+
+    ASSERT_TRUE(j.count("ids"));
+    ASSERT_TRUE(j["ids"].is_array());
+    ASSERT_EQ(3, j["ids"].size());
+    ASSERT_EQ(3u, j["ids"][0].get<unsigned int>());
+    ASSERT_EQ(1u, j["ids"][1].get<unsigned int>());
+    ASSERT_EQ(2u, j["ids"][2].get<unsigned int>());
+}
+
+TEST(json, state_fragments)
+{
+    webgame::entities ents;
+    ents.add(std::make_shared<webgame::npc>("type1", webgame::vector({ 0, 1 }), webgame::vector({ 2, 3 }), 0, 0, webgame::npc::behaviors()));
+    ents.add(std::make_shared<webgame::player>());
+
+    webgame::state_fragments fragments;
+    std::vector<std::string const*> to_send;
+    for (auto const& pair : ents)
+        to_send.push_back(&fragments.get(*pair.second));
+
+    // Fragments are rendered once
+    ASSERT_EQ(to_send[0], &fragments.get(*ents.cbegin()->second));
+
+    std::string ents_json;
+    ASSERT_NO_THROW(ents_json = webgame::json_state_entities(to_send));
+    ASSERT_EQ(nlohmann::json::parse(json_state_entities(ents)), nlohmann::json::parse(ents_json));
+
+    ASSERT_EQ(nlohmann::json::parse(json_state_entities(webgame::entities())), nlohmann::json::parse(webgame::json_state_entities(std::vector<std::string const*>())));
+}
+
+TEST(json, parse_order)
+{
+    auto parse = [](std::string const& msg, webgame::client_order &order) {
+        return webgame::parse_client_order(msg.data(), msg.size(), order);
+    };
+
+    webgame::client_order order;
+    ASSERT_TRUE(parse(R"({"order": "authentication", "player_name": "player1"})", order));
+    ASSERT_EQ(webgame::client_order::authentication, order.kind);
+    ASSERT_EQ("player1", std::string(order.player_name, order.player_name_size));
+
+    order = webgame::client_order();
+    ASSERT_TRUE(parse(R"( {"speed":-1.5e1,"suborder":"change_speed","order":"action"} )", order));
+    ASSERT_EQ(webgame::client_order::change_speed, order.kind);
+    ASSERT_EQ(-15, order.speed);
+
+    order = webgame::client_order();
+    ASSERT_TRUE(parse(R"({"order": "action", "suborder": "change_dir", "dir": {"y": 0.25, "x": -2}})", order));
+    ASSERT_EQ(webgame::client_order::change_dir, order.kind);
+    ASSERT_EQ(webgame::vector(-2, 0.25), order.vec);
+
+    order = webgame::client_order();
+    ASSERT_TRUE(parse(R"({"order": "action", "suborder": "move_to", "target_pos": {"x": 0, "y": 100}})", order));
+    ASSERT_EQ(webgame::client_order::move_to, order.kind);
+    ASSERT_EQ(webgame::vector(0, 100), order.vec);
+
+    // Left to the complete parse
+    for (char const* msg : {
+        R"({"order": "authentication", "player_name": "play\"er"})",
+        R"({"order": "authentication", "player_name": "player1", "extra": 1})",
+        R"({"order": "authentication", "player_name": "player1", "player_name": "player2"})",
+        R"({"order": "action", "suborder": "change_speed", "speed": 01})",
+        R"({"order": "action", "suborder": "change_speed", "speed": 1.})",
+        R"({"order": "action", "suborder": "change_speed", "speed": 1e999})",
+        R"({"order": "action", "suborder": "move_to", "target_pos": {"x": 0, "y": -1e999}})",
+        R"({"order": "action", "suborder": "change_speed"})",
+        R"({"order": "action", "suborder": "change_dir", "dir": {"x": 1}})",
+        R"({"order": "action", "suborder": "fly", "speed": 1})",
+        R"({"order": "dance"})",
+        R"({"order": "authentication", "player_name": "player1"} x)",
+        R"({"order": "authentication", "player_name": "player1")",
+        R"([])",
+        ""
+    })
+        ASSERT_FALSE(parse(msg, order)) << msg;
+
+    // Which handles escapes and extra members, and throws for unknown orders
+    std::string player_name;
+    order = webgame::client_order();
+    webgame::parse_client_order(nlohmann::json::parse(R"({"order": "authentication", "player_name": "play\"er", "extra": 1})"), order, player_name);
+    ASSERT_EQ(webgame::client_order::authentication, order.kind);
+    ASSERT_EQ("play\"er", std::string(order.player_name, order.player_name_size));
+    ASSERT_THROW(webgame::parse_client_order(nlohmann::json::parse(R"({"order": "action", "suborder": "fly"})"), order, player_name), std::runtime_error);
+    ASSERT_THROW(webgame::parse_client_order(nlohmann::json::parse(R"({"order": "dance"})"), order, player_name), std::runtime_error);
+    ASSERT_THROW(nlohmann::json::parse(R"({"order": "action", "suborder": "change_speed", "speed": 1e999})"), nlohmann::json::out_of_range);
+}
@@ -0,0 +1,80 @@
+#include <cmath>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <webgame/kinematics.hpp>
+#include <webgame/npc.hpp>
+
+#include "tests.hpp"
+
+namespace {
+
+std::shared_ptr<webgame::npc> make_npc(int i)
+{
+    // Zero and non normalized directions, zero speeds
+    double const scale = i % 5;
+    webgame::vector const pos(i * 0.37 - 50, 20 - i * 0.11);
+    webgame::vector const dir(std::cos(i) * scale, std::sin(i) * scale);
+    double const speed = (i % 7) * 0.3;
+    return std::make_shared<webgame::npc>("npc1", pos, dir, speed, 2);
+}
+
+} // namespace
+
+TEST(kinematics, same_as_move)
+{
+    int const nb_npcs = 600;
+    double const d = 0.05;
+
+    for (webgame::simd_level level : { webgame::simd_level::scalar, webgame::simd_level::sse2, webgame::simd_level::avx2 })
+    {
+        if (level > webgame::detected_simd_level())
+            continue;
+        TEST_LOG("SIMD LEVEL " << webgame::simd_level_name(level));
+
+        std::vector<std::shared_ptr<webgame::npc>> batched;
+        std::vector<std::shared_ptr<webgame::npc>> reference;
+        std::unordered_map<webgame::mobile_chunk*, webgame::slot_mask> active;
+        for (int i = 0; i < nb_npcs; ++i)
+        {
+            reference.push_back(make_npc(i));
+            batched.push_back(make_npc(i));
+            webgame::archetype_slot const& slot = batched.back()->slot();
+            active[static_cast<webgame::mobile_chunk*>(slot.chunk)].set(slot.index);
+        }
+        // Not in the batch, must not move
+        auto left_out = make_npc(1);
+
+        std::set<webgame::entity const*> moved;
+        for (auto &pair : active)
+        {
+            webgame::slot_mask const changed = webgame::integrate(*pair.first, d, pair.second, level);
+            ASSERT_TRUE((changed & ~pair.second).none());
+            for (size_t i = 0; i < webgame::chunk_capacity; ++i)
+                if (changed[i])
+                    moved.insert(pair.first->owner[i]);
+        }
+
+        for (int i = 0; i < nb_npcs; ++i)
+        {
+            bool const changed = reference[i]->move(d);
+            // To the bit
+            ASSERT_EQ(reference[i]->pos(), batched[i]->pos()) << "npc #" << i;
+            ASSERT_EQ(reference[i]->dir(), batched[i]->dir()) << "npc #" << i;
+            ASSERT_EQ(changed, moved.count(batched[i].get()) == 1) << "npc #" << i;
+        }
+        ASSERT_EQ(make_npc(1)->pos(), left_out->pos());
+    }
+}
+
+TEST(kinematics, simd_levels)
+{
+    webgame::simd_level const level = webgame::detected_simd_level();
+#if defined(__x86_64__) || defined(_M_X64)
+    ASSERT_GE(level, webgame::simd_level::sse2);
+#endif
+    ASSERT_STRNE("unknown", webgame::simd_level_name(level));
+}
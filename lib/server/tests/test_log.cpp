@@ -0,0 +1,54 @@
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <webgame/log.hpp>
+
+#include "tests.hpp"
+
+TEST(log, lines)
+{
+    webgame::flush_log();
+    std::ostringstream out;
+    std::ostream *previous_stream = webgame::set_log_stream(&out);
+
+    {
+        webgame::log_line line("TITLE");
+        line.stream() << "first " << 1;
+        // A line logged while formatting another goes out first
+        webgame::log_line nested("NESTED");
+        nested.stream() << "nested";
+    }
+    std::thread([] {
+        webgame::log_line line(std::string("THREAD"));
+        line.stream() << "from a thread";
+    }).join();
+
+    webgame::flush_log();
+    webgame::set_log_stream(previous_stream);
+
+    std::string const text = out.str();
+    std::string const title = std::string(webgame::title_max_size - 5, ' ') + "TITLE] first 1\n";
+    ASSERT_NE(std::string::npos, text.find(title));
+    ASSERT_LT(text.find("NESTED] nested\n"), text.find(title));
+    ASSERT_NE(std::string::npos, text.find("THREAD] from a thread\n"));
+}
+
+TEST(log, limiter)
+{
+    webgame::log_limiter limiter(std::chrono::milliseconds(100));
+
+    size_t suppressed = 42;
+    ASSERT_TRUE(limiter.allow(suppressed));
+    ASSERT_EQ(0u, suppressed);
+    for (int i = 0; i < 3; ++i)
+        ASSERT_FALSE(limiter.allow(suppressed));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    ASSERT_TRUE(limiter.allow(suppressed));
+    ASSERT_EQ(3u, suppressed);
+    ASSERT_FALSE(limiter.allow(suppressed));
+}
@@ -0,0 +1,69 @@
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <webgame/mpsc_queue.hpp>
+
+#include "tests.hpp"
+
+TEST(mpsc_queue, all)
+{
+    webgame::mpsc_queue<int> q(5);
+    ASSERT_EQ(8, q.capacity());
+
+    int value;
+    ASSERT_FALSE(q.pop(value));
+
+    for (int i = 0; i < 8; ++i)
+        ASSERT_TRUE(q.push(i));
+    // Full
+    ASSERT_FALSE(q.push(8));
+
+    ASSERT_TRUE(q.pop(value));
+    ASSERT_EQ(0, value);
+    ASSERT_TRUE(q.push(8));
+
+    // In order, over the end of the ring
+    std::vector<int> popped;
+    ASSERT_EQ(8, q.drain([&popped](int const& v) { popped.push_back(v); }));
+    ASSERT_EQ(std::vector<int>({ 1, 2, 3, 4, 5, 6, 7, 8 }), popped);
+    ASSERT_EQ(0, q.drain([](int const&) {}));
+}
+
+TEST(mpsc_queue, producers)
+{
+#ifndef WEBGAME_MONOTHREAD
+    int const nb_producers = 4;
+    int const nb_pushes = 100000;
+
+    // Values are (producer, sequence number)
+    webgame::mpsc_queue<std::pair<int, int>> q(64);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < nb_producers; ++p)
+        producers.emplace_back([&q, p] {
+            for (int i = 0; i < nb_pushes; ++i)
+                while (!q.push(std::make_pair(p, i)))
+                    std::this_thread::yield();
+        });
+
+    // Nothing lost, nothing duplicated, each producer's values in order
+    std::vector<int> next(nb_producers, 0);
+    int received = 0;
+    bool in_order = true;
+    while (received < nb_producers * nb_pushes)
+        received += static_cast<int>(q.drain([&next, &in_order](std::pair<int, int> const& v) {
+            in_order = in_order && v.second == next[v.first];
+            ++next[v.first];
+        }));
+
+    for (std::thread &t : producers)
+        t.join();
+
+    ASSERT_TRUE(in_order);
+    ASSERT_EQ(std::vector<int>(nb_producers, nb_pushes), next);
+    std::pair<int, int> value;
+    ASSERT_FALSE(q.pop(value));
+#endif /* !WEBGAME_MONOTHREAD */
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <boost/asio/connect.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
@@ -64,8 +66,9 @@ TEST(redis_helper, all)
         ASSERT_NO_THROW(nb_keys = rh.keys("*").size());
         ASSERT_EQ(4, nb_keys);
     }
-    // async_get
+    // async_get, one command at a time: a write and a read each
     {
+        rh.set_pipeline_depth(1);
         bool called1 = false; bool success1; std::string value1;
         rh.async_get("a:1", [&called1, &success1, &value1](bool success, std::string &&value) {called1 = true; success1 = success; value1 = std::move(value); });
         bool called2 = false; bool success2; std::string value2;
@@ -86,6 +89,19 @@ TEST(redis_helper, all)
         ASSERT_TRUE(success3);
         ASSERT_EQ("v4", value3);
         ioc.restart();
+        rh.set_pipeline_depth(16);
+    }
+    // pipelined async_get: replies go to continuations in order
+    {
+        std::vector<std::string> values;
+        for (int i = 0; i < 40; ++i)
+            rh.async_get(i % 2 ? "a:1" : "b:2", [&values](bool success, std::string &&value) { values.emplace_back(success ? std::move(value) : "failed"); });
+        ASSERT_NO_THROW(ioc.run_for(time_out));
+        ASSERT_TRUE(ioc.stopped());
+        ASSERT_EQ(40, values.size());
+        for (int i = 0; i < 40; ++i)
+            ASSERT_EQ(i % 2 ? "v1" : "v4", values[i]);
+        ioc.restart();
     }
     // async_set and async_get pipeline
     {
@@ -125,6 +141,31 @@ TEST(redis_helper, all)
         ASSERT_EQ("v2", values[2]);
         ASSERT_EQ("v4", values[3]);
     }
+    // mget
+    {
+        std::vector<std::string> values;
+        ASSERT_NO_THROW(values = rh.mget({ "a:2", "ne_key", "b:1" }));
+        ASSERT_EQ(3, values.size());
+        ASSERT_EQ("v2", values[0]);
+        ASSERT_EQ("", values[1]);
+        ASSERT_EQ("v3", values[2]);
+        ASSERT_TRUE(rh.mget({}).empty());
+    }
+    // scan
+    {
+        std::vector<std::string> akeys;
+        std::string cursor = "0";
+        do {
+            std::vector<std::string> keys;
+            ASSERT_NO_THROW(keys = rh.scan(cursor, "a:*", 1));
+            akeys.insert(akeys.end(), keys.cbegin(), keys.cend());
+        } while (cursor != "0");
+        std::sort(akeys.begin(), akeys.end());
+        akeys.erase(std::unique(akeys.begin(), akeys.end()), akeys.end());
+        ASSERT_EQ(2, akeys.size());
+        ASSERT_EQ("a:1", akeys[0]);
+        ASSERT_EQ("a:2", akeys[1]);
+    }
     // async_get handler throw
     {
         rh.async_get("a:1", [](bool, std::string &&) {
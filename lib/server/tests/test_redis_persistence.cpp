@@ -6,6 +6,7 @@
 
 #include <webgame/entities.hpp>
 #include <webgame/entity.hpp>
+#include <webgame/id_allocator.hpp>
 #include <webgame/npc.hpp>
 #include <webgame/player.hpp>
 #include <webgame/stationnary_entity.hpp>
@@ -55,9 +56,9 @@ TEST(redis_persistence, all)
         ASSERT_NO_THROW(ents = p.load_all_npes());
         ASSERT_EQ(2, ents.size());
         ASSERT_TRUE(ents.find(npc1_id) != ents.cend());
-        ASSERT_TRUE(std::dynamic_pointer_cast<webgame::npc>(ents[npc1_id]));
+        ASSERT_TRUE(std::dynamic_pointer_cast<webgame::npc>(ents.at(npc1_id)));
         ASSERT_TRUE(ents.find(object1_id) != ents.cend());
-        ASSERT_TRUE(std::dynamic_pointer_cast<webgame::stationnary_entity>(ents[object1_id]));
+        ASSERT_TRUE(std::dynamic_pointer_cast<webgame::stationnary_entity>(ents.at(object1_id)));
     }
     // async_load_player
     {
@@ -83,7 +84,7 @@ TEST(redis_persistence, all)
             ASSERT_EQ(webgame::vector({ 0, -1 }), ent1->dir());
             ASSERT_EQ(1, ent1->max_speed());
             ASSERT_EQ(0, ent1->speed());
-            ASSERT_EQ("player", ent1->type());
+            ASSERT_EQ("player", ent1->type().name());
             ASSERT_EQ(1, ent1.use_count());
             ioc.restart();
             ents.add(ent1);
@@ -122,8 +123,51 @@ TEST(redis_persistence, all)
         ASSERT_NO_THROW(ents = p.load_all_npes());
         ASSERT_EQ(2, ents.size());
         ASSERT_TRUE(ents.find(npc1_id) != ents.cend());
-        ASSERT_TRUE(std::dynamic_pointer_cast<webgame::npc>(ents[npc1_id]));
+        ASSERT_TRUE(std::dynamic_pointer_cast<webgame::npc>(ents.at(npc1_id)));
         ASSERT_TRUE(ents.find(object1_id) != ents.cend());
-        ASSERT_TRUE(std::dynamic_pointer_cast<webgame::stationnary_entity>(ents[object1_id]));
+        ASSERT_TRUE(std::dynamic_pointer_cast<webgame::stationnary_entity>(ents.at(object1_id)));
+    }
+    // load_all_npes by small batches
+    {
+        webgame::entities ents;
+        for (int i = 0; i < 50; ++i)
+            ents.add(std::make_shared<webgame::stationnary_entity>("object2", webgame::vector({ float(i), 0 })));
+        p.async_save(ents, [] {});
+        ioc.run();
+        ioc.restart();
+
+        auto &rp = static_cast<webgame::redis_persistence &>(p);
+        rp.set_load_batch_size(7);
+        rp.set_load_threads(3);
+        webgame::entities loaded;
+        ASSERT_NO_THROW(loaded = p.load_all_npes());
+        ASSERT_EQ(52, loaded.size());
+        for (auto const& pair : ents)
+        {
+            ASSERT_TRUE(loaded.find(pair.first) != loaded.cend());
+            ASSERT_TRUE(*pair.second == *loaded.at(pair.first));
+        }
+    }
+    // Ids saved before the slot map, whatever their slot and order
+    {
+        webgame::entities ents;
+        for (webgame::id_t id : { webgame::id_allocator::make_id(webgame::id_allocator::index_of(npc1_id), 9), webgame::id_t(3000), webgame::id_t(2999) })
+        {
+            auto ent = std::make_shared<webgame::stationnary_entity>("object3", webgame::vector({ 0, 0 }));
+            nlohmann::json j = ent->save();
+            j["located_entity"]["entity"]["id"] = id;
+            ent->load(j);
+            ents.add(ent);
+        }
+        p.async_save(ents, [] {});
+        ioc.run();
+        ioc.restart();
+
+        webgame::entities loaded;
+        ASSERT_NO_THROW(loaded = p.load_all_npes());
+        ASSERT_EQ(55, loaded.size());
+        ASSERT_TRUE(loaded.find(npc1_id) != loaded.cend());
+        for (auto const& pair : ents)
+            ASSERT_TRUE(*pair.second == *loaded.at(pair.first));
     }
 }
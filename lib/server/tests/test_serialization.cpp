@@ -118,7 +118,7 @@ public:
     {}
 
 public:
-    virtual void update(double delta, webgame::env &env) override
+    virtual void update(double delta, webgame::env const& env) override
     {
         self_->set_speed(0);
         self_->set_pos({42, 42});
@@ -202,7 +202,7 @@ public:
     {}
 
 public:
-    virtual bool update(double delta, webgame::env &env) override
+    virtual bool update(double delta, webgame::env const& env) override
     {
         set_speed(0);
         set_pos({ 42, 42 });
@@ -1,4 +1,7 @@
+#include <deque>
 #include <future>
+#include <limits>
+#include <thread>
 
 #include <boost/asio/connect.hpp>
 #include <boost/asio/io_context.hpp>
@@ -8,8 +11,14 @@
 
 #include <gtest/gtest.h>
 
+#include <nlohmann/json.hpp>
+
+#include <webgame/binary.hpp>
+#include <webgame/io_shards.hpp>
 #include <webgame/npc.hpp>
 #include <webgame/persistence.hpp>
+#include <webgame/player.hpp>
+#include <webgame/player_conn.hpp>
 #include <webgame/protocol.hpp>
 #include <webgame/redis_persistence.hpp>
 #include <webgame/server.hpp>
@@ -161,6 +170,24 @@ state_player_order get_order(boost::property_tree::ptree const& ptree)
     return o;
 }
 
+template<>
+state_entities_order get_order(boost::property_tree::ptree const& ptree)
+{
+    assert(ptree.get<std::string>("order") == "state");
+    assert(ptree.get<std::string>("suborder") == "entities");
+
+    state_entities_order o;
+    for (auto const& child : ptree.get_child("data"))
+    {
+        state_entities_order::entity_state e;
+        e.id = child.second.get<size_t>("id");
+        e.type = child.second.get<std::string>("type");
+        e.pos = webgame::vector({ child.second.get<double>("pos.x"), child.second.get<double>("pos.y") });
+        o.data.push_back(e);
+    }
+    return o;
+}
+
 struct test_bot
 {
 public:
@@ -168,19 +195,28 @@ public:
     boost::beast::multi_buffer buffer;
     std::string name;
     std::string last_read;
+    // Orders of a batch not read yet
+    std::deque<std::string> unread;
 
-    test_bot(boost::asio::io_context &io_context, std::string const& n = "none")
+    test_bot(boost::asio::io_context &io_context, std::string const& n = "none", bool binary = false)
         : socket(io_context)
         , name(n)
     {
-        connect(io_context);
+        connect(io_context, binary);
     }
 
-    void connect(boost::asio::io_context &io_context)
+    void connect(boost::asio::io_context &io_context, bool binary = false)
     {
         boost::asio::ip::tcp::resolver resolver(io_context);
         boost::asio::ip::tcp::resolver::results_type results = resolver.resolve("localhost", "2000");
         boost::asio::connect(socket.next_layer(), results.begin(), results.end());
+        if (binary)
+        {
+            socket.set_option(boost::beast::websocket::stream_base::decorator([](boost::beast::websocket::request_type &req) {
+                req.set(boost::beast::http::field::sec_websocket_protocol, webgame::binary_subprotocol);
+            }));
+            socket.binary(true);
+        }
         socket.handshake("localhost", "/");
     }
 
@@ -202,9 +238,22 @@ public:
 
     void read()
     {
-        socket.read(buffer);
-        last_read = boost::beast::buffers_to_string(buffer.data());
-        buffer.consume(buffer.size());
+        while (unread.empty())
+        {
+            socket.read(buffer);
+            std::string msg = boost::beast::buffers_to_string(buffer.data());
+            buffer.consume(buffer.size());
+
+            nlohmann::json j = nlohmann::json::parse(msg);
+            if (j.is_array())
+                for (nlohmann::json const& order : j)
+                    unread.push_back(order.dump());
+            else
+                unread.push_back(std::move(msg));
+        }
+
+        last_read = std::move(unread.front());
+        unread.pop_front();
         //std::cout << last_read << std::endl;
     }
 
@@ -340,6 +389,35 @@ TEST(server, shutdown_no_clients)
     ASSERT_NO_THROW(wg->shutdown());
 }
 
+TEST(server, shutdown_stopped)
+{
+    RUN;
+
+    // Nothing runs the game loop anymore, and a second call has nothing to do
+    io_context.stop();
+    run_fut.wait();
+    ASSERT_NO_THROW(wg->shutdown());
+    ASSERT_NO_THROW(wg->shutdown());
+}
+
+TEST(server, shutdown_twice_simulation_thread)
+{
+    boost::asio::io_context io_context;
+    RESETDB;
+
+    std::shared_ptr<webgame::server> wg = std::make_shared<webgame::server>(io_context, 2000, std::make_shared<webgame::redis_persistence>(io_context, "localhost", 6379, 1));
+    wg->set_simulation_thread(true);
+    wg->start();
+    std::future<void> run_fut = std::async(std::launch::async, [&io_context] {
+        io_context.run();
+    });
+
+    wg->shutdown();
+    // The simulation thread is gone
+    wg->shutdown();
+    ASSERT_EQ(std::future_status::ready, run_fut.wait_for(dur(15)));
+}
+
 TEST(server, shutdown_one_client_ack)
 {
     RUN;
@@ -478,6 +556,28 @@ TEST(server, player_move)
     ASSERT_EQ(1, current_pos.y());
 }
 
+TEST(server, binary_invalid_value)
+{
+    PREPARE;
+
+    test_bot bot1(io_context, "bot1", true);
+    std::string order;
+    webgame::binary_writer w(order);
+    w.u8(webgame::action_authentication);
+    w.str(bot1.name);
+    bot1.socket.write(boost::asio::buffer(order));
+    // Game and player states
+    ASSERT_FALSE(bot1.read_ec());
+    ASSERT_FALSE(bot1.read_ec());
+
+    // A NaN speed would make the position of the player NaN
+    order.clear();
+    w.u8(webgame::action_change_speed);
+    w.f32(std::numeric_limits<double>::quiet_NaN());
+    bot1.socket.write(boost::asio::buffer(order));
+    EXPECT_TRUE(bot1.read_until_error());
+}
+
 TEST(server, player_reconnect)
 {
     PREPARE;
@@ -514,6 +614,176 @@ TEST(server, player_reconnect)
     ASSERT_LE(std::abs(webgame::vector(current_pos - init_pos).x()), 2.5);
 }
 
+TEST(server, shards)
+{
+    boost::asio::io_context io_context;
+    RESETDB;
+
+    webgame::io_shards shards(2);
+    std::shared_ptr<webgame::server> wg = std::make_shared<webgame::server>(io_context, 2000, std::make_shared<webgame::redis_persistence>(io_context, "localhost", 6379, 1));
+    wg->set_network_shards(shards);
+    wg->start();
+    shards.run();
+    std::future<void> run_fut = std::async(std::launch::async, [&io_context] {
+        io_context.run();
+    });
+
+    std::list<test_bot> bots;
+    for (int i = 0; i < 4; ++i)
+    {
+        bots.emplace_back(io_context, "bot" + std::to_string(i));
+        bots.back().send_order(authentication_order(bots.back().name));
+    }
+
+    // Whatever shard serves them
+    for (test_bot &bot : bots)
+    {
+        boost::property_tree::ptree ptree;
+        ASSERT_NO_THROW(ptree = bot.read_ptree());
+        ASSERT_EQ("game", ptree.get<std::string>("suborder"));
+        ASSERT_NO_THROW(ptree = bot.read_ptree());
+        ASSERT_EQ("player", ptree.get<std::string>("suborder"));
+    }
+    ASSERT_EQ(4u, wg->get_connections().size());
+
+    wg->shutdown();
+    for (test_bot &bot : bots)
+        EXPECT_EQ(boost::beast::websocket::error::closed, bot.read_until_error());
+    ASSERT_EQ(std::future_status::ready, run_fut.wait_for(dur(15)));
+    shards.join();
+}
+
+TEST(server, simulation_thread)
+{
+    boost::asio::io_context io_context;
+    RESETDB;
+
+    std::shared_ptr<webgame::server> wg = std::make_shared<webgame::server>(io_context, 2000, std::make_shared<webgame::redis_persistence>(io_context, "localhost", 6379, 1));
+    wg->set_simulation_thread(true);
+    wg->start();
+    std::future<void> run_fut = std::async(std::launch::async, [&io_context] {
+        io_context.run();
+    });
+
+    test_bot bot1(io_context, "bot1");
+    test_bot bot2(io_context, "bot2");
+    bot1.authenticate();
+    bot2.authenticate();
+
+    // The simulation turns down a second login of the same player
+    test_bot bot1_again(io_context, "bot1");
+    bot1_again.send_order(authentication_order(bot1_again.name));
+    EXPECT_TRUE(bot1_again.read_until_error());
+
+    boost::property_tree::ptree ptree;
+    ASSERT_NO_THROW(ptree = bot1.read_ptree_until_order("state", "player"));
+    ASSERT_NO_THROW(ptree = bot2.read_ptree_until_order("state", "player"));
+    ASSERT_GT(wg->profiler().nb_ticks(), 0u);
+    ASSERT_EQ(2u, wg->profiler().history().back().entities_updated);
+
+    wg->shutdown();
+    EXPECT_EQ(boost::beast::websocket::error::closed, bot1.read_until_error());
+    EXPECT_EQ(boost::beast::websocket::error::closed, bot2.read_until_error());
+    ASSERT_EQ(std::future_status::ready, run_fut.wait_for(dur(15)));
+}
+
+TEST(server, backpressure)
+{
+    PREPARE;
+
+    BOT(bot1);
+    BOT(bot2);
+    bot1.authenticate();
+    webgame::vector bot2_pos = bot2.authenticate().second.pos;
+
+    std::shared_ptr<webgame::player_conn> conn1;
+    webgame::id_t bot2_id = 0;
+    for (auto const& c : wg->get_connections())
+    {
+        if (c->player_name() == "bot1")
+            conn1 = c;
+        else
+            bot2_id = c->player_entity()->id();
+    }
+    ASSERT_TRUE(conn1);
+
+    // Until bot2 is in the view of bot1, it is then only sent when it changes
+    bool bot2_seen = false;
+    while (!bot2_seen)
+        for (auto const& e : get_order<state_entities_order>(bot1.read_ptree_until_order("state", "entities")).data)
+            bot2_seen = bot2_seen || e.id == bot2_id;
+
+    // More than the socket buffers take: the write stays pending while bot1 does not read
+    std::string const pad = "{\"order\":\"pad\",\"suborder\":\"pad\",\"data\":\"" + std::string(16 * 1024 * 1024, 'x') + "\"}";
+    bot1.socket.next_layer().set_option(boost::asio::socket_base::receive_buffer_size(64 * 1024));
+    bot1.socket.read_message_max(2 * pad.size());
+    // The writes belong to the game loop
+    auto in_simulation = [&wg](std::function<void()> const& handler) {
+        std::promise<void> done;
+        wg->post([&handler, &done] {
+            handler();
+            done.set_value();
+        });
+        done.get_future().wait();
+    };
+    in_simulation([&conn1, &pad] {
+        conn1->write(std::make_shared<std::string const>(pad));
+        conn1->flush();
+    });
+
+    // High water: the ticks skip the connection
+    for (int i = 0; i < 50 && conn1->stats().skipped_ticks == 0; ++i)
+        std::this_thread::sleep_for(dur(0.1));
+    ASSERT_GT(conn1->stats().skipped_ticks, 0u);
+    ASSERT_GT(wg->profiler().dump().at("skipped_ticks").get<uint64_t>(), 0u);
+
+    // The second snapshot replaces the first in the queue. Each one is
+    // either queued or replaces the snapshot of the last tick that got some.
+    webgame::player_conn::write_stats const before = conn1->stats();
+    in_simulation([&conn1] {
+        conn1->write_latest(std::make_shared<std::string const>("{\"order\":\"state\",\"suborder\":\"test\",\"n\":1}"));
+        conn1->flush();
+        conn1->write_latest(std::make_shared<std::string const>("{\"order\":\"state\",\"suborder\":\"test\",\"n\":2}"));
+        conn1->flush();
+    });
+    webgame::player_conn::write_stats after = conn1->stats();
+    for (int i = 0; i < 50 && after.superseded + after.queued_messages < before.superseded + before.queued_messages + 2; ++i)
+    {
+        std::this_thread::sleep_for(dur(0.1));
+        after = conn1->stats();
+    }
+    ASSERT_EQ(before.superseded + before.queued_messages + 2, after.superseded + after.queued_messages);
+    ASSERT_LE(before.superseded + 1, after.superseded);
+
+    // bot2 moves and stops while bot1 gets nothing
+    webgame::vector const target = bot2_pos + webgame::vector({ 0.5, 0 });
+    bot2.change_speed(1);
+    bot2.move_to(target);
+    while (get_order<state_player_order>(bot2.read_ptree_until_order("state", "player")).pos != target);
+    ASSERT_GT(conn1->stats().skipped_ticks, before.skipped_ticks);
+
+    // Low water once bot1 reads: the change it missed is sent although bot2 no longer changes.
+    // The padding is not parsed, it would take long.
+    bot1.unread.clear();
+    while (bot1.last_read.size() != pad.size())
+        ASSERT_FALSE(bot1.read_ec());
+    bool bot2_at_target = false;
+    // bot1 gets its player state every tick
+    for (auto deadline = std::chrono::steady_clock::now() + dur(5); !bot2_at_target && std::chrono::steady_clock::now() < deadline;)
+    {
+        boost::property_tree::ptree ptree = bot1.read_ptree();
+        if (ptree.get<std::string>("order") != "state" || ptree.get<std::string>("suborder") != "entities")
+            continue;
+        for (auto const& e : get_order<state_entities_order>(ptree).data)
+            bot2_at_target = bot2_at_target || (e.id == bot2_id && e.pos == target);
+    }
+    ASSERT_TRUE(bot2_at_target);
+
+    size_t const skipped = conn1->stats().skipped_ticks;
+    std::this_thread::sleep_for(dur(0.5));
+    ASSERT_EQ(skipped, conn1->stats().skipped_ticks);
+}
+
 TEST(server, persistence)
 {
     boost::asio::io_context io_context;
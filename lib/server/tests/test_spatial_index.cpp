@@ -0,0 +1,104 @@
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include <webgame/entities.hpp>
+#include <webgame/env.hpp>
+#include <webgame/npc.hpp>
+#include <webgame/spatial_index.hpp>
+#include <webgame/stationnary_entity.hpp>
+
+#include "tests.hpp"
+
+TEST(spatial_index, query_radius)
+{
+    webgame::spatial_index index(0.5);
+
+    auto e1 = std::make_shared<webgame::stationnary_entity>("object1", webgame::vector({ 0, 0 }));
+    auto e2 = std::make_shared<webgame::stationnary_entity>("object1", webgame::vector({ 0.3, 0.4 }));
+    auto e3 = std::make_shared<webgame::stationnary_entity>("object1", webgame::vector({ -3, 2 }));
+    index.insert(*e1);
+    index.insert(*e2);
+    index.insert(*e3);
+    ASSERT_EQ(3, index.size());
+    ASSERT_EQ(&index, e1->index());
+
+    auto found = index.query_radius({ 0, 0 }, 0.5);
+    ASSERT_EQ(2, found.size());
+    ASSERT_TRUE(std::find(found.begin(), found.end(), e1.get()) != found.end());
+    ASSERT_TRUE(std::find(found.begin(), found.end(), e2.get()) != found.end());
+
+    ASSERT_EQ(1, index.query_radius({ 0, 0 }, 0.49).size());
+    ASSERT_EQ(3, index.query_radius({ 0, 0 }, 1000).size());
+
+    // Moves are seen by the index once published
+    e3->set_pos({ 0.1, -0.1 });
+    ASSERT_EQ(2, index.query_radius({ 0, 0 }, 0.5).size());
+    e3->publish();
+    ASSERT_EQ(3, index.query_radius({ 0, 0 }, 0.5).size());
+    ASSERT_EQ(0, index.query_radius({ -3, 2 }, 0.5).size());
+
+    index.remove(*e2);
+    ASSERT_EQ(nullptr, e2->index());
+    ASSERT_EQ(2, index.query_radius({ 0, 0 }, 0.5).size());
+
+    // A destroyed entity removes itself
+    e1.reset();
+    ASSERT_EQ(1, index.size());
+
+    index.clear();
+    ASSERT_EQ(0, index.size());
+    ASSERT_EQ(nullptr, e3->index());
+}
+
+TEST(spatial_index, nearest)
+{
+    webgame::spatial_index index;
+
+    auto ally = std::make_shared<webgame::stationnary_entity>("ally", webgame::vector({ 0.1, 0 }));
+    auto enemy_far = std::make_shared<webgame::stationnary_entity>("enemy", webgame::vector({ 0, 0.6 }));
+    auto enemy_near = std::make_shared<webgame::stationnary_entity>("enemy", webgame::vector({ -0.3, 0 }));
+    index.insert(*ally);
+    index.insert(*enemy_far);
+    index.insert(*enemy_near);
+
+    ASSERT_EQ(ally.get(), index.nearest({ 0, 0 }, 1));
+    ASSERT_EQ(enemy_near.get(), index.nearest({ 0, 0 }, 1, [](webgame::located_entity const& e) {
+        return e.type() == webgame::entity_type("enemy");
+    }));
+    ASSERT_EQ(nullptr, index.nearest({ 0, 0 }, 0.05));
+}
+
+TEST(spatial_index, env)
+{
+    webgame::spatial_index index;
+
+    auto enemy = std::make_shared<webgame::npc>("npc_enemy_1", webgame::vector({ 0, 0 }), webgame::vector({ 0, 0 }), 0, 1, webgame::npc::behaviors({
+        { 0, std::make_shared<webgame::attack_on_sight>(0.7) },
+        }));
+    auto target = std::make_shared<webgame::npc>("npc_ally_1", webgame::vector({ 0.5, 0 }), webgame::vector({ 0, 0 }), 0, 1);
+    auto outsider = std::make_shared<webgame::stationnary_entity>("npc_ally_1", webgame::vector({ 0.2, 0 }));
+    webgame::entities ents({ enemy, target });
+    index.insert(*enemy);
+    index.insert(*target);
+    // Indexed but not part of the tick's entities: must not be seen
+    index.insert(*outsider);
+
+    webgame::env env(ents, enemy.get(), &index);
+    auto found = env.query_radius({ 0, 0 }, 1);
+    ASSERT_EQ(1, found.size());
+    ASSERT_EQ(target.get(), found.front());
+    ASSERT_EQ(target.get(), env.nearest({ 0, 0 }, 1));
+
+    ASSERT_TRUE(enemy->update(0.1, env));
+    ASSERT_EQ(webgame::vector({ 1, 0 }), enemy->dir());
+    ASSERT_TRUE(almost_equal(0.1, enemy->pos().x()));
+
+    // Until published, the others still see the previous position
+    ASSERT_EQ(webgame::vector({ 0, 0 }), enemy->published_pos());
+    webgame::env target_env(ents, target.get(), &index);
+    ASSERT_EQ(0, target_env.query_radius({ 0.1, 0 }, 0.05).size());
+    enemy->publish();
+    ASSERT_EQ(enemy->pos(), enemy->published_pos());
+    ASSERT_EQ(1, target_env.query_radius({ 0.1, 0 }, 0.05).size());
+}
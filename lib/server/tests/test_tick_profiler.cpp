@@ -0,0 +1,122 @@
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <webgame/tick_profiler.hpp>
+
+#include "tests.hpp"
+
+TEST(tick_profiler, histogram)
+{
+    webgame::latency_histogram h;
+    ASSERT_EQ(0u, h.percentile(50));
+
+    // Small values are exact
+    for (uint64_t v = 0; v < 16; ++v)
+        h.record(v);
+    ASSERT_EQ(7u, h.percentile(50));
+    ASSERT_EQ(15u, h.percentile(100));
+
+    // The others within 1/16, whatever their scale
+    for (uint64_t scale : { uint64_t(1000), uint64_t(1000000), uint64_t(1000000000000) })
+    {
+        h.clear();
+        for (uint64_t i = 1; i <= 100; ++i)
+            h.record(i * scale);
+
+        ASSERT_EQ(100u, h.count());
+        ASSERT_EQ(100 * scale, h.max());
+        ASSERT_DOUBLE_EQ(50.5 * scale, h.mean());
+        for (double p : { 1., 50., 90., 99. })
+        {
+            double const expected = p * scale;
+            ASSERT_GE(static_cast<double>(h.percentile(p)), expected);
+            ASSERT_LE(static_cast<double>(h.percentile(p)), expected * (1 + 1. / 16));
+        }
+        ASSERT_EQ(100 * scale, h.percentile(100));
+    }
+}
+
+TEST(tick_profiler, ticks)
+{
+    webgame::tick_profiler profiler(4);
+    ASSERT_TRUE(profiler.history().empty());
+
+    for (size_t t = 0; t < 6; ++t)
+    {
+        profiler.start_tick();
+        profiler.end_phase(webgame::tick_phase::reaping);
+        profiler.end_phase(webgame::tick_phase::commands);
+        profiler.end_phase(webgame::tick_phase::update);
+        profiler.end_phase(webgame::tick_phase::persistence);
+        profiler.end_phase(webgame::tick_phase::broadcast);
+        webgame::tick_traffic traffic;
+        traffic.bytes_queued = 100 * t;
+        traffic.superseded = t % 2;
+        traffic.congested = 1;
+        profiler.end_tick(10 + t, t, traffic);
+    }
+
+    // The last ones, oldest first
+    ASSERT_EQ(6u, profiler.nb_ticks());
+    std::vector<webgame::tick_breakdown> history = profiler.history();
+    ASSERT_EQ(4u, history.size());
+    for (size_t i = 0; i < history.size(); ++i)
+    {
+        ASSERT_EQ(12 + i, history[i].entities_updated);
+        ASSERT_EQ(2 + i, history[i].entities_changed);
+        ASSERT_EQ(100 * (2 + i), history[i].traffic.bytes_queued);
+        ASSERT_EQ(i % 2, history[i].traffic.superseded);
+
+        webgame::steady_clock::duration phases = webgame::steady_clock::duration::zero();
+        for (webgame::steady_clock::duration d : history[i].phases)
+            phases += d;
+        ASSERT_LE(phases, history[i].total);
+    }
+    ASSERT_EQ(6u, profiler.histogram(webgame::tick_phase::update).count());
+    ASSERT_EQ(6u, profiler.total_histogram().count());
+
+    nlohmann::json dump = profiler.dump();
+    ASSERT_EQ(6u, dump.at("ticks").get<uint64_t>());
+    ASSERT_EQ(75u, dump.at("entities_updated").get<uint64_t>());
+    ASSERT_EQ(3u, dump.at("superseded").get<uint64_t>());
+    ASSERT_EQ(6u, dump.at("skipped_ticks").get<uint64_t>());
+    ASSERT_EQ(6u, dump.at("phases").at("broadcast").at("count").get<uint64_t>());
+    ASSERT_EQ(4u, dump.at("history").size());
+    ASSERT_EQ(500u, dump.at("history").back().at("bytes_queued").get<size_t>());
+    ASSERT_EQ(1u, dump.at("history").back().at("congested").get<size_t>());
+    ASSERT_EQ(7u, profiler.summary().size());
+
+    profiler.reset();
+    ASSERT_EQ(0u, profiler.nb_ticks());
+    ASSERT_TRUE(profiler.history().empty());
+}
+
+TEST(tick_profiler, rolling)
+{
+    // A window of 3 slices of 100ms
+    webgame::tick_profiler profiler(4, std::chrono::milliseconds(100), 3);
+    ASSERT_EQ(std::chrono::milliseconds(300), profiler.window());
+
+    auto tick = [&profiler] {
+        profiler.start_tick();
+        profiler.end_phase(webgame::tick_phase::update);
+        profiler.end_tick(1, 1, webgame::tick_traffic());
+    };
+
+    for (int i = 0; i < 10; ++i)
+        tick();
+    ASSERT_EQ(10u, profiler.total_histogram().count());
+
+    // Older than the window, the ticks leave the histograms but not the counts
+    std::this_thread::sleep_for(std::chrono::milliseconds(350));
+    ASSERT_EQ(0u, profiler.total_histogram().count());
+    tick();
+    ASSERT_EQ(1u, profiler.histogram(webgame::tick_phase::update).count());
+    ASSERT_EQ(11u, profiler.nb_ticks());
+    ASSERT_DOUBLE_EQ(0.3, profiler.dump().at("window_s").get<double>());
+}
@@ -0,0 +1,75 @@
+#include <cstring>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <webgame/vector.hpp>
+
+#include "tests.hpp"
+
+namespace {
+
+constexpr webgame::vec2 a(1, 2);
+constexpr webgame::vec2 b(3, -4);
+
+static_assert(a + b == webgame::vec2(4, -2), "constexpr addition");
+static_assert(a - b == webgame::vec2(-2, 6), "constexpr subtraction");
+static_assert(-a == webgame::vec2(-1, -2), "constexpr negation");
+static_assert(a * 2 == webgame::vec2(2, 4) && 2 * a == a * 2, "constexpr product");
+static_assert(b / 2 == webgame::vec2(1.5, -2), "constexpr division");
+static_assert(dot(a, b) == -5, "constexpr dot product");
+static_assert(b.length_squared() == 25, "constexpr length");
+static_assert(webgame::vec2f(a) == webgame::vec2f(1, 2), "constexpr conversion");
+
+} // namespace
+
+TEST(vector, all)
+{
+    ASSERT_EQ(5, b.norm());
+    ASSERT_EQ(webgame::vec2(0.6, -0.8), b.normalized());
+
+    // Normalizing a null vector is harmless
+    webgame::vec2 null(0, 0);
+    null.normalize();
+    ASSERT_EQ(webgame::vec2(0, 0), null);
+
+    webgame::vec2 v = a;
+    v += b;
+    v *= 0.5;
+    ASSERT_EQ(webgame::vec2(2, -1), v);
+    v[1] = 7;
+    ASSERT_EQ(7, v.y());
+
+    std::ostringstream os;
+    os << a;
+    ASSERT_EQ("(1,2)", os.str());
+}
+
+TEST(vector, memcpy)
+{
+    webgame::vec2 src[3] = { a, b, webgame::vec2(5, 6) };
+    webgame::vec2 dst[3];
+    std::memcpy(dst, src, sizeof(src));
+    ASSERT_EQ(b, dst[1]);
+    // x and y of consecutive vectors follow each other
+    ASSERT_EQ(3, (&src[0][0])[2]);
+}
+
+TEST(vector, json)
+{
+    nlohmann::json j = webgame::vec2(1.5, -2.5).save();
+    ASSERT_EQ(2, j.size());
+    ASSERT_EQ(1.5, j["x"].get<double>());
+    ASSERT_EQ(-2.5, j["y"].get<double>());
+
+    webgame::vec2 loaded;
+    loaded.load(j);
+    ASSERT_EQ(webgame::vec2(1.5, -2.5), loaded);
+
+    // Float storage has the same form
+    webgame::vec2f loaded_f;
+    loaded_f.load(j);
+    ASSERT_EQ(j, loaded_f.save());
+
+    ASSERT_THROW(loaded.load({ {"x", 1.5} }), std::runtime_error);
+}